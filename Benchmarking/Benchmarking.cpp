@@ -10,6 +10,10 @@
 #include <chrono>
 #include <seal/seal.h>
 #include <iomanip>
+#ifdef BENCHMARK_DB
+#include <mysqlx/xdevapi.h>
+#endif
+#include "ScalarDecoder.h"
 
 #define PUB_KEY_FILE "RSAPub.pem"
 #define PRI_KEY_FILE "RSAPri.pem"
@@ -1556,12 +1560,200 @@ int relinTest10(int iterations) {
     return (avgTime / iterations);
 }
 
+#ifdef BENCHMARK_DB
+// Database to benchmark against, read from dbBenchmarkConfig.txt as key=value lines (host, port, user, password, schema).
+// Missing keys keep these defaults, which match a local development database
+struct DbBenchmarkConfig {
+    string host = "localhost";
+    int port = 33060;
+    string user = "root";
+    string password = "admin";
+    string schema = "bankdb";
+};
+
+DbBenchmarkConfig readDbBenchmarkConfig() {
+    DbBenchmarkConfig config;
+    try {
+        ifstream inFile("dbBenchmarkConfig.txt");
+        string line;
+        while (getline(inFile, line)) {
+            int index = line.find_first_of('=');
+            if (index == string::npos) {
+                continue;
+            }
+            string key = line.substr(0, index);
+            string value = line.substr(index + 1, line.length());
+            if (key.compare("host") == 0) {
+                config.host = value;
+            }
+            else if (key.compare("port") == 0) {
+                config.port = stoi(value);
+            }
+            else if (key.compare("user") == 0) {
+                config.user = value;
+            }
+            else if (key.compare("password") == 0) {
+                config.password = value;
+            }
+            else if (key.compare("schema") == 0) {
+                config.schema = value;
+            }
+        }
+    }
+    catch (exception& e) {
+        cout << e.what() << endl;
+    }
+    return config;
+}
 
+// Compares per-query latency of the hot DBHandler lookups built fresh with string concatenation against one statement object re-executed with new bindings.
+// Needs a bank database with at least one account. Only built with BENCHMARK_DB defined, so the other benchmarks do not link the MySQL connector.
+// No results have been recorded yet, so the statement cache's speedup is unverified until this is run with --db
+void dbQueryBenchmark(int iterations, const DbBenchmarkConfig& config) {
+    try {
+        mysqlx::Session session(mysqlx::SessionOption::USER, config.user,
+            mysqlx::SessionOption::PWD, config.password,
+            mysqlx::SessionOption::HOST, config.host,
+            mysqlx::SessionOption::PORT, config.port,
+            mysqlx::SessionOption::DB, config.schema
+        );
+        mysqlx::Schema schema(session, config.schema);
+        mysqlx::Table accounts(schema, "accounts");
+        mysqlx::Table transactions(schema, "transactions");
+        vector<int> ids;
+        for (mysqlx::Row row : accounts.select("id").execute()) {
+            ids.push_back((int)row.get(0));
+        }
+        if (ids.empty()) {
+            cout << "No accounts to query" << endl;
+            return;
+        }
+        long long concatAccount = 0, concatHistory = 0, boundAccount = 0, boundHistory = 0;
+        for (int i = 0; i < iterations; ++i) {
+            int id = ids[i % ids.size()];
+            auto start = chrono::high_resolution_clock::now();
+            accounts.select("*").where("id=" + to_string(id)).execute().fetchAll();
+            auto mid = chrono::high_resolution_clock::now();
+            transactions.select("*").where("transactionOwnerID=" + to_string(id)).orderBy("transactionTime").execute().fetchAll();
+            auto fin = chrono::high_resolution_clock::now();
+            concatAccount += chrono::duration_cast<chrono::microseconds>(mid - start).count();
+            concatHistory += chrono::duration_cast<chrono::microseconds>(fin - mid).count();
+        }
+        mysqlx::TableSelect accountById = accounts.select("*");
+        accountById.where("id = :id");
+        mysqlx::TableSelect transactionsByOwner = transactions.select("*");
+        transactionsByOwner.where("transactionOwnerID = :owner").orderBy("transactionTime");
+        for (int i = 0; i < iterations; ++i) {
+            int id = ids[i % ids.size()];
+            auto start = chrono::high_resolution_clock::now();
+            accountById.bind("id", id).execute().fetchAll();
+            auto mid = chrono::high_resolution_clock::now();
+            transactionsByOwner.bind("owner", id).execute().fetchAll();
+            auto fin = chrono::high_resolution_clock::now();
+            boundAccount += chrono::duration_cast<chrono::microseconds>(mid - start).count();
+            boundHistory += chrono::duration_cast<chrono::microseconds>(fin - mid).count();
+        }
+        cout << "Account by ID over " << iterations << " iterations: " << concatAccount / iterations << " microseconds concatenated, " << boundAccount / iterations << " microseconds cached and bound" << endl;
+        cout << "Transactions by owner over " << iterations << " iterations: " << concatHistory / iterations << " microseconds concatenated, " << boundHistory / iterations << " microseconds cached and bound" << endl;
+        session.close();
+    }
+    catch (exception& e) {
+        cout << e.what() << endl;
+    }
+}
+#endif
 
-int main()
+// Checks ScalarDecoder against CKKSEncoder::decode on fresh, subtracted and interest-style rescaled ciphertexts, timing both on each plaintext
+// as it is decrypted so none have to be kept. Returns the number of values where the two differ by a tenth of a penny or more
+int scalarDecodeBenchmark(int iterations) {
+    seal::EncryptionParameters params;
+    loadCKKSParams(params);
+    seal::SEALContext context(params);
+    seal::KeyGenerator keyGen(context);
+    seal::SecretKey key = keyGen.secret_key();
+    seal::Encryptor encryptor(context, key);
+    seal::Decryptor decryptor(context, key);
+    seal::CKKSEncoder encoder(context);
+    seal::Evaluator eval(context);
+    ScalarDecoder scalarDecoder(context);
+    double scale = pow(2, 20);
+    std::uniform_real_distribution<double> unif(-10000.00, 10000.00);
+    default_random_engine re;
+    int mismatches = 0;
+    double maxError = 0.0;
+    long long decoded = 0;
+    long long fullNanos = 0;
+    long long scalarNanos = 0;
+    for (int i = 0; i < iterations; ++i) {
+        double amount = unif(re);
+        double other = unif(re);
+        seal::Plaintext plain;
+        seal::Ciphertext balance, change;
+        encoder.encode(amount, scale, plain);
+        encryptor.encrypt_symmetric(plain, balance);
+        encoder.encode(other, scale, plain);
+        encryptor.encrypt_symmetric(plain, change);
+        vector<seal::Ciphertext> ciphers = { balance, change };
+        seal::Ciphertext difference;
+        eval.sub(balance, change, difference);
+        ciphers.push_back(difference);
+
+        // Interest as the cloud server applies it: multiply by the rate at the dropped prime's scale, rescale, and add back
+        auto contextData = context.get_context_data(balance.parms_id());
+        if (contextData->next_context_data()) {
+            seal::Plaintext ratePlain;
+            encoder.encode(0.015, balance.parms_id(), static_cast<double>(contextData->parms().coeff_modulus().back().value()), ratePlain);
+            seal::Ciphertext interest, accrued = balance;
+            eval.multiply_plain(balance, ratePlain, interest);
+            eval.rescale_to_next_inplace(interest);
+            eval.mod_switch_to_next_inplace(accrued);
+            interest.scale() = accrued.scale();
+            eval.add_inplace(accrued, interest);
+            ciphers.push_back(interest);
+            ciphers.push_back(accrued);
+        }
+        for (seal::Ciphertext& cipher : ciphers) {
+            seal::Plaintext decrypted;
+            decryptor.decrypt(cipher, decrypted);
+            auto start = chrono::high_resolution_clock::now();
+            vector<double> res;
+            encoder.decode(decrypted, res);
+            auto mid = chrono::high_resolution_clock::now();
+            double scalar = scalarDecoder.decode(decrypted);
+            auto end = chrono::high_resolution_clock::now();
+            fullNanos += chrono::duration_cast<chrono::nanoseconds>(mid - start).count();
+            scalarNanos += chrono::duration_cast<chrono::nanoseconds>(end - mid).count();
+            decoded++;
+            double error = abs(scalar - res[0]);
+            maxError = max(maxError, error);
+            if (error >= 0.001) {
+                mismatches++;
+            }
+        }
+    }
+    cout << "Scalar decode over " << decoded << " plaintexts: " << mismatches << " mismatches, largest difference from the full decode " << maxError << endl;
+    cout << fixed << setprecision(2) << "Average decode time: " << fullNanos / 1000.0 / max(1LL, decoded) << " microseconds full, " << scalarNanos / 1000.0 / max(1LL, decoded)
+        << " microseconds scalar, " << (double)fullNanos / max(1LL, scalarNanos) << "x faster" << defaultfloat << endl;
+    return mismatches;
+}
+
+// Runs the cryptography benchmarks. Pass --db to run only the database benchmark instead, which needs a build with BENCHMARK_DB defined
+int main(int argc, char* argv[])
 {
     try {
         vector<int> iterations = { 10, 100, 1000, 10000 };
+        if (argc > 1 && string(argv[1]).compare("--db") == 0) {
+#ifdef BENCHMARK_DB
+            DbBenchmarkConfig config = readDbBenchmarkConfig();
+            cout << "Database (" << config.user << "@" << config.host << ":" << config.port << "/" << config.schema << "):" << endl;
+            for (int i : iterations) {
+                dbQueryBenchmark(i, config);
+            }
+#else
+            cout << "This build has no database benchmark. Rebuild with BENCHMARK_DB defined and the MySQL connector linked." << endl;
+#endif
+            return 0;
+        }
 
         cout << "Without relinearisation" << endl;
         for (int i : iterations) {
@@ -1663,7 +1855,11 @@ int main()
         rsaDecryptThread1.join();
         ckksDecryptThread.join();
         rsaDecryptThread2.join();
-        
+
+        cout << "Scalar decode:" << endl;
+        for (int i : iterations) {
+            scalarDecodeBenchmark(i);
+        }
     }
     catch (exception& e) {
         cout << e.what() << endl;
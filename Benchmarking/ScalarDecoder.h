@@ -0,0 +1,21 @@
+#pragma once
+#include <seal/seal.h>
+
+/* Reads back amounts encoded with CKKSEncoder::encode(double, scale, ...), which puts value * scale in the constant coefficient and
+zeros everywhere else, so every slot holds the same value. Homomorphic adds, subtracts, plain multiplies and rescales keep it that way.
+Instead of an inverse NTT, CRT composition of every coefficient and an FFT over all the slots, only the constant coefficient is
+recovered: for each prime it is N^-1 times the sum of the plaintext's NTT values, and the residues are then composed into one integer.
+The result matches slot 0 of CKKSEncoder::decode up to the CKKS noise. Plaintexts encoded from vectors must use the full decode.*/
+class ScalarDecoder {
+public:
+	ScalarDecoder(const seal::SEALContext& context);
+
+	/* Value held by a plaintext in NTT form, as CKKS decryption produces.*/
+	double decode(const seal::Plaintext& plain) const;
+
+	/* Decrypts and decodes in one step.*/
+	double decrypt(seal::Decryptor& decryptor, const seal::Ciphertext& encrypted) const;
+
+private:
+	seal::SEALContext context;
+};
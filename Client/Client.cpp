@@ -6,6 +6,9 @@
 #include <fstream>
 #include <codecvt>
 #include <locale>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
 #include <openssl/conf.h>
 #include <openssl/evp.h>
 #include <openssl/err.h>
@@ -428,6 +431,65 @@ status_code sendTransfer() {
     return response.status_code();
 }
 
+// Sends an encrypted bulk transfer read from a file of "account,amount" lines to the central server in one request
+status_code sendBulkTransfer() {
+    string path;
+    cout << "Enter the path of the payments file (one \"account,amount\" per line)." << endl;
+    getline(cin, path);
+    ifstream paymentsIn(path);
+    if (!paymentsIn.is_open()) {
+        system("CLS");
+        cout << "Unable to open the payments file." << endl;
+        return status_codes::BadRequest;
+    }
+    string payments = "";
+    string line;
+    int count = 0;
+    while (getline(paymentsIn, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        payments += line + ";";
+        count++;
+    }
+    paymentsIn.close();
+    cout << "Sending " << count << " payments..." << endl;
+    string accFrom = wstring_convert<codecvt_utf8<wchar_t>>().to_bytes(loggedID);
+    // The server gives a bulk transfer up to two minutes, longer than the client's default timeout
+    http_client_config config;
+    config.set_timeout(std::chrono::seconds(130));
+    http_client client(serverDNS + L":8080/bulktransfer", config);
+    auto response = client.request(methods::POST, aesEncrypt(accFrom), aesEncrypt(payments)).get();
+    if (response.status_code() == status_codes::OK) {
+        system("CLS");
+        // The server applies payments in chunks and reports each one, so a partly applied transfer shows which payments went through
+        stringstream report(aesDecrypt(response.extract_utf16string().get()));
+        string counts;
+        getline(report, counts);
+        int index = counts.find_first_of(',');
+        string applied = counts.substr(0, index);
+        string total = counts.substr(index + 1, counts.length());
+        if (applied.compare(total) == 0) {
+            cout << "Bulk transfer successful! " << applied << " payments sent." << endl;
+        }
+        else {
+            cout << "Bulk transfer stopped part way. " << applied << " of " << total << " payments sent." << endl;
+            while (getline(report, line)) {
+                cout << line << endl;
+            }
+        }
+    }
+    else if (response.status_code() == status_codes::InternalError) {
+        system("CLS");
+        cout << "An error occurred on the server. Please try again later." << endl;
+    }
+    else {
+        system("CLS");
+        wcout << response.extract_utf16string().get() << endl;
+    }
+    return response.status_code();
+}
+
 // Sends encrypted balance request to the central server. Receives encrypted balance
 status_code checkBalance() {
     try {
@@ -457,24 +519,62 @@ status_code checkBalance() {
     }
 }
 
-// Sends encrypted transaction history request to the central server. Receives encrypted transaction history
+// Converts a DD/MM/YYYY date typed by the user to a timestamp. endOfDay moves it to the last second of that day. Blank input returns the fallback
+time_t readHistoryDate(string prompt, time_t fallback, bool endOfDay) {
+    cout << prompt << flush;
+    string input;
+    getline(cin, input);
+    if (input.empty()) {
+        return fallback;
+    }
+    tm date = {};
+    stringstream dateStream(input);
+    dateStream >> get_time(&date, "%d/%m/%Y");
+    if (dateStream.fail()) {
+        cout << "Unrecognised date, showing all dates instead." << endl;
+        return fallback;
+    }
+    date.tm_isdst = -1;
+    if (endOfDay) {
+        date.tm_hour = 23;
+        date.tm_min = 59;
+        date.tm_sec = 59;
+    }
+    return mktime(&date);
+}
+
+// Sends encrypted transaction history requests to the central server one page at a time. The next page is only requested when the user asks for it
 status_code checkHistory() {
     try {
-        http_client client(serverDNS + L":8080/history");
-        string toEncrypt = wstring_convert<codecvt_utf8<wchar_t>>().to_bytes(loggedID);
-        wstring toSend = aesEncrypt(toEncrypt);
-        auto response = client.request(methods::GET, toSend).get();
-        if (response.status_code() == status_codes::OK) {
+        const int pageSize = 10;
+        time_t fromTime = readHistoryDate("Show transactions from (DD/MM/YYYY, blank for the beginning): ", 0, false);
+        time_t toTime = readHistoryDate("Show transactions up to (DD/MM/YYYY, blank for today): ", time(nullptr), true);
+        string cursor = "";
+        system("CLS");
+        while (true) {
+            http_client client(serverDNS + L":8080/history");
+            string toEncrypt = wstring_convert<codecvt_utf8<wchar_t>>().to_bytes(loggedID) + "," + to_string(pageSize) + "," + to_string(fromTime) + "," + to_string(toTime) + "," + cursor;
+            wstring toSend = aesEncrypt(toEncrypt);
+            auto response = client.request(methods::GET, toSend).get();
+            if (response.status_code() != status_codes::OK) {
+                system("CLS");
+                wcout << response.extract_utf16string().get() << endl;
+                return response.status_code();
+            }
             wstring body = response.extract_utf16string().get();
-            string history = aesDecrypt(body);
-            system("CLS");
-            cout << history << endl;
-        }
-        else {
-            system("CLS");
-            wcout << response.extract_utf16string().get() << endl;
+            cout << aesDecrypt(body) << endl;
+            if (!response.headers().has(L"X-Next-Cursor")) {
+                return status_codes::OK;
+            }
+            cursor = aesDecrypt(response.headers()[L"X-Next-Cursor"]);
+            cout << "Press enter to see more transactions, or type q to return to the menu: " << flush;
+            string input;
+            getline(cin, input);
+            if (input.compare("q") == 0 || input.compare("Q") == 0) {
+                system("CLS");
+                return status_codes::OK;
+            }
         }
-        return response.status_code();
     }
     catch (exception& e) {
         system("CLS");
@@ -710,7 +810,7 @@ int main()
             std::thread heartbeatThread(heartbeat);
             do {
                 cout << "What do you want to do?" << endl;
-                std::cout << "1: Make a transfer.\n2: Check balance.\n3: Check transaction history.\n4: Add or remove direct debits.\n5: Log out." << std::endl;
+                std::cout << "1: Make a transfer.\n2: Check balance.\n3: Check transaction history.\n4: Add or remove direct debits.\n5: Log out.\n6: Make a bulk transfer from a file." << std::endl;
                 std::cout << "Choice: " << std::flush;
                 std::string input;
                 std::getline(std::cin, input);
@@ -740,6 +840,9 @@ int main()
                     sendLogout();
                     heartbeatThread.join();
                     break;
+                case 6:
+                    sendBulkTransfer();
+                    break;
                 default:
                     system("CLS");
                     std::cout << "Invalid choice. Please try again." << std::endl;
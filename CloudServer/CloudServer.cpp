@@ -8,8 +8,27 @@
 #include <cpprest/http_listener.h>
 #include <cpprest/json.h>
 #include <cpprest/filestream.h>
+#include <cpprest/containerstream.h>
 #include <cpprest/http_client.h>
 #include <codecvt>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include <openssl/conf.h>
 #include <openssl/evp.h>
 #include <openssl/err.h>
@@ -25,6 +44,39 @@ using namespace std;
 seal::EncryptionParameters* params = new seal::EncryptionParameters();
 seal::SEALContext* context = new seal::SEALContext(NULL);
 wstring serverIP;
+mutex ledgerMutex; // Serialises every read-modify-write of balance files
+map<wstring, unsigned long long> fileVersions; // Bumped when a file is rewritten, so only balances get an entry; amount files are written once. Guarded by ledgerMutex
+long long ledgerEpoch = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count(); // Versions restart with the process, so tags carry its start time
+
+mutex timeoutLock;
+map<string, long long> timeoutCounts; // Requests answered 504 because their deadline passed, by the stage that noticed
+
+#define JOURNAL_FILE "transfer.journal" // Write-ahead journal for multi-file updates
+#define JOURNAL_TEMP_FILE "transfer.journal.tmp" // Journal being written. Only renamed to JOURNAL_FILE once complete and on disk
+
+// Set by Ctrl+C or a console close. main sleeps on shutdownSignal until then
+atomic<bool> shutdownRequested = false;
+mutex shutdownLock;
+condition_variable shutdownSignal;
+
+#ifdef _WIN32
+BOOL WINAPI onConsoleEvent(DWORD event) {
+    shutdownRequested = true;
+    shutdownSignal.notify_all();
+    return TRUE;
+}
+#else
+void onSignal(int sig) {
+    shutdownRequested = true;
+}
+#endif
+
+// A single update to a balance file: the amount ciphertext is subtracted from the balance and stored under amountFile
+struct Leg {
+    wstring balanceFile;
+    wstring amountFile;
+    seal::Ciphertext amount;
+};
 
 // Reads in cloud DNS from file
 wstring readCloudDNS() {
@@ -70,15 +122,215 @@ void loadCKKSParams(seal::EncryptionParameters& params) {
     }
 }
 
-// Receives HTTP request from central server for a file. Sends encrypted file contents.
+// Brings a freshly encrypted amount down to the level of a balance that has been through homomorphic interest, so the two can be combined
+void alignToBalance(seal::Evaluator& evaluator, seal::Ciphertext& amount, const seal::Ciphertext& balance) {
+    if (amount.parms_id() != balance.parms_id()) {
+        evaluator.mod_switch_to_inplace(amount, balance.parms_id());
+    }
+}
+
+// Replies 504 if the caller's X-Request-Deadline (milliseconds since the epoch) has passed, so work is not done for a caller that has given up.
+// Requests without the header never expire
+bool deadlinePassed(http_request request, const string& stage) {
+    auto header = request.headers().find(L"X-Request-Deadline");
+    if (header == request.headers().end()) {
+        return false;
+    }
+    long long now = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    try {
+        if (stoll(header->second) > now) {
+            return false;
+        }
+    }
+    catch (exception&) {
+        return false;
+    }
+    {
+        lock_guard<mutex> guard(timeoutLock);
+        timeoutCounts[stage]++;
+    }
+    cout << "Request deadline passed at " << stage << "." << endl;
+    request.reply(status_codes::GatewayTimeout, L"Request deadline passed");
+    return true;
+}
+
+void printTimeoutMetrics() {
+    lock_guard<mutex> guard(timeoutLock);
+    cout << "Timeouts by stage:";
+    for (auto& [stage, count] : timeoutCounts) {
+        cout << " " << stage << "=" << count;
+    }
+    cout << endl;
+}
+
+// Entity tag of a file's current contents. Caller must hold ledgerMutex
+wstring etagOf(const wstring& file) {
+    auto found = fileVersions.find(file);
+    unsigned long long version = found == fileVersions.end() ? 0 : found->second;
+    return L"\"" + to_wstring(ledgerEpoch) + L"." + to_wstring(version) + L"\"";
+}
+
+// Writes bytes to path and forces them to disk before returning
+bool writeDurably(const string& path, const string& bytes) {
+    FILE* out = nullptr;
+#ifdef _WIN32
+    fopen_s(&out, path.c_str(), "wb");
+#else
+    out = fopen(path.c_str(), "wb");
+#endif
+    if (out == nullptr) {
+        return false;
+    }
+    bool written = fwrite(bytes.data(), 1, bytes.size(), out) == bytes.size() && fflush(out) == 0;
+#ifdef _WIN32
+    written = written && _commit(_fileno(out)) == 0;
+#else
+    written = written && fsync(fileno(out)) == 0;
+#endif
+    return fclose(out) == 0 && written;
+}
+
+// Forces renames in the working directory to disk. Windows makes a rename durable with the file itself
+void syncDirectory() {
+#ifndef _WIN32
+    int dir = open(".", O_RDONLY);
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+#endif
+}
+
+// Swaps committed staged files into their targets, skipping any already swapped in. A rename that fails is retried a few times, since a scanner
+// or backup holding a file open usually lets go quickly. Throws if it still fails. Returns the number of files swapped in
+int rollForward(const vector<pair<string, string>>& entries) {
+    int swapped = 0;
+    for (int attempt = 1; ; ++attempt) {
+        try {
+            for (auto& [pending, target] : entries) {
+                if (filesystem::exists(pending)) {
+                    filesystem::rename(pending, target);
+                    swapped++;
+                }
+            }
+            syncDirectory();
+            return swapped;
+        }
+        catch (filesystem::filesystem_error& e) {
+            if (attempt == 3) {
+                throw;
+            }
+            cout << "Retrying journal roll forward: " << e.what() << endl;
+            this_thread::sleep_for(chrono::milliseconds(100 * attempt));
+        }
+    }
+}
+
+// Completes any multi-file update that was committed to the journal but not fully applied, whether by a crash or by renames that kept failing.
+// A journal counts only if it ends with a "commit,<count>" line matching its entries; anything else was never committed and is discarded.
+// Staged files left by an uncommitted or finished update are deleted
+void recoverJournal() {
+    try {
+        if (filesystem::exists(JOURNAL_FILE)) {
+            ifstream journalIn(JOURNAL_FILE);
+            vector<pair<string, string>> entries;
+            string line;
+            bool committed = false;
+            while (getline(journalIn, line)) {
+                if (committed) {
+                    // Nothing may follow the commit line
+                    committed = false;
+                    break;
+                }
+                int index = line.find_first_of(',');
+                if (index == string::npos) {
+                    break;
+                }
+                if (line.substr(0, index).compare("commit") == 0) {
+                    try {
+                        committed = stoul(line.substr(index + 1, line.length())) == entries.size() && !entries.empty();
+                    }
+                    catch (exception&) {
+                        break;
+                    }
+                    continue;
+                }
+                entries.push_back(make_pair(line.substr(0, index), line.substr(index + 1, line.length())));
+            }
+            journalIn.close();
+            if (committed) {
+                int recovered = rollForward(entries);
+                cout << "Recovered " << recovered << " file(s) from the transfer journal." << endl;
+            }
+            else {
+                cout << "Discarded a transfer journal without a valid commit line." << endl;
+            }
+            filesystem::remove(JOURNAL_FILE);
+        }
+        filesystem::remove(JOURNAL_TEMP_FILE);
+        int stray = 0;
+        for (const filesystem::directory_entry& entry : filesystem::directory_iterator(".")) {
+            if (entry.is_regular_file() && entry.path().extension() == ".pending") {
+                filesystem::remove(entry.path());
+                stray++;
+            }
+        }
+        if (stray > 0) {
+            cout << "Removed " << stray << " staged file(s) from uncommitted updates." << endl;
+        }
+    }
+    catch (exception& e) {
+        cout << e.what() << endl;
+    }
+}
+
+// Replies 503 if an update committed to the journal has still not been fully applied and cannot be now, since files on disk may then predate it.
+// Until it is, nothing is read from or written to the ledger. Caller must hold ledgerMutex
+bool ledgerBlocked(http_request request) {
+    if (!filesystem::exists(JOURNAL_FILE)) {
+        return false;
+    }
+    recoverJournal();
+    if (!filesystem::exists(JOURNAL_FILE)) {
+        return false;
+    }
+    cout << "Ledger blocked by a transfer journal that could not be rolled forward." << endl;
+    request.reply(status_codes::ServiceUnavailable, L"Ledger recovery pending");
+    return true;
+}
+
+// Receives HTTP request from central server for a file. Sends encrypted file contents with their ETag, or 304 Not Modified if the
+// server's If-None-Match already names the current version
 bool sendBalance(http_request request) {
     try {
         if (request.get_remote_address().compare(serverIP) == 0) {
+            if (deadlinePassed(request, "cloud arrival")) {
+                return false;
+            }
             wstring fileName = request.relative_uri().to_string();
             fileName = fileName.substr(1, fileName.length());
+            unique_lock<mutex> lock(ledgerMutex);
+            if (ledgerBlocked(request)) {
+                return false;
+            }
             if (filesystem::exists(fileName)) {
-                auto f = file_stream<char>::open_istream(fileName, std::ios::binary).get();
-                request.reply(status_codes::OK, f.streambuf());
+                wstring etag = etagOf(fileName);
+                auto match = request.headers().find(L"If-None-Match");
+                if (match != request.headers().end() && match->second.compare(etag) == 0) {
+                    lock.unlock();
+                    http_response response(status_codes::NotModified);
+                    response.headers().add(L"ETag", etag);
+                    request.reply(response);
+                    return true;
+                }
+                ifstream fileIn(fileName, std::ios::binary);
+                vector<unsigned char> contents((istreambuf_iterator<char>(fileIn)), istreambuf_iterator<char>());
+                fileIn.close();
+                lock.unlock();
+                http_response response(status_codes::OK);
+                response.headers().add(L"ETag", etag);
+                response.set_body(contents);
+                request.reply(response);
                 return true;
             }
             else {
@@ -102,6 +354,9 @@ bool sendBalance(http_request request) {
 bool transaction(http_request request) {
     try {
         if (request.get_remote_address().compare(serverIP) == 0) {
+            if (deadlinePassed(request, "cloud arrival")) {
+                return false;
+            }
             // Partition URI into relevant segments
             wstring uri = request.relative_uri().to_string();
             int index = uri.find_first_of(',');
@@ -136,6 +391,11 @@ bool transaction(http_request request) {
                 balOut.close();
 
                 // Extract the ciphertexts from balance and amount files
+                lock_guard<mutex> lock(ledgerMutex);
+                if (deadlinePassed(request, "cloud ledger lock") || ledgerBlocked(request)) {
+                    filesystem::remove(amountFile);
+                    return false;
+                }
                 seal::Ciphertext fromBal, toBal, amount;
                 ifstream fromIn(fileFrom, std::ios::binary);
                 fromBal.load(*context, fromIn);
@@ -146,12 +406,14 @@ bool transaction(http_request request) {
 
                 // Perform encrypted arithmetic on ciphertexts to update balances
                 seal::Evaluator evaluator(*context);
+                alignToBalance(evaluator, amount, fromBal);
                 evaluator.sub_inplace(fromBal, amount);
                 cout << "Amount processed" << endl;
                 // Write new balances into balance files
                 ofstream fromOut(fileFrom, std::ios::binary);
                 fromBal.save(fromOut);
                 fromOut.close();
+                fileVersions[fileFrom]++;
                 // Reply with the OK message if all goes to plan
                 request.reply(status_codes::OK);
                 return true;
@@ -173,10 +435,484 @@ bool transaction(http_request request) {
     }
 }
 
+// Checks that an amount file name is a .txt file that has not been stored before
+bool validAmountFile(wstring amountFile) {
+    if (amountFile.length() <= 4 || amountFile.substr(amountFile.length() - 4, amountFile.length()).compare(L".txt") != 0) {
+        return false;
+    }
+    return !filesystem::exists(amountFile);
+}
+
+// Writes every ciphertext or none of them. Each is staged beside its target and synced, then the journal is written to a temporary file,
+// ended with a "commit,<count>" line, synced and renamed into place as the commit point. Only then are the staged files swapped in.
+// Once committed the update is reported as applied even if the swaps fail: the journal is then left on disk and ledgerBlocked turns every request away until it is rolled forward.
+// Caller must hold ledgerMutex and have checked ledgerBlocked
+status_code commitCiphertexts(vector<pair<wstring, seal::Ciphertext*>>& files) {
+    vector<pair<string, string>> staged;
+    vector<wstring> rewritten;
+    try {
+        for (auto& [file, ciphertext] : files) {
+            string target = wstring_convert<codecvt_utf8<wchar_t>>().to_bytes(file);
+            stringstream stagedOut(std::ios::in | std::ios::out | std::ios::binary);
+            ciphertext->save(stagedOut);
+            staged.push_back(make_pair(target + ".pending", target));
+            if (filesystem::exists(file)) {
+                rewritten.push_back(file);
+            }
+            if (!writeDurably(target + ".pending", stagedOut.str())) {
+                throw runtime_error("Could not stage " + target);
+            }
+        }
+        string journal = "";
+        for (auto& [pending, target] : staged) {
+            journal += pending + "," + target + "\n";
+        }
+        journal += "commit," + to_string(staged.size()) + "\n";
+        if (!writeDurably(JOURNAL_TEMP_FILE, journal)) {
+            throw runtime_error("Could not write the transfer journal");
+        }
+        filesystem::rename(JOURNAL_TEMP_FILE, JOURNAL_FILE);
+        syncDirectory();
+    }
+    catch (exception& e) {
+        cout << e.what() << endl;
+        for (auto& [pending, target] : staged) {
+            filesystem::remove(pending);
+        }
+        filesystem::remove(JOURNAL_TEMP_FILE);
+        filesystem::remove(JOURNAL_FILE);
+        return status_codes::InternalError;
+    }
+
+    // The journal is durable, so from here the update is finished, never undone
+    for (wstring& file : rewritten) {
+        fileVersions[file]++;
+    }
+    try {
+        rollForward(staged);
+        filesystem::remove(JOURNAL_FILE);
+    }
+    catch (exception& e) {
+        cout << "Committed update left in the transfer journal: " << e.what() << endl;
+    }
+    return status_codes::OK;
+}
+
+// Applies every leg or none of them. Arithmetic is done in memory and the results are committed together.
+// Returns GatewayTimeout, having already replied, if the request's deadline passed while it waited for the lock or the ledger is blocked.
+// On success versions holds one "balanceFile,previousETag,newETag" line per balance changed, so the central server can apply the same legs to its cached copies
+status_code applyLegs(http_request request, vector<Leg>& legs, string& versions) {
+    lock_guard<mutex> lock(ledgerMutex);
+    if (deadlinePassed(request, "cloud ledger lock") || ledgerBlocked(request)) {
+        return status_codes::GatewayTimeout;
+    }
+    map<wstring, seal::Ciphertext> balances;
+    set<wstring> amountFiles;
+    for (Leg& leg : legs) {
+        if (!validAmountFile(leg.amountFile) || !amountFiles.insert(leg.amountFile).second) {
+            wcout << "Invalid or pre-existing amount file " << leg.amountFile << endl;
+            return status_codes::BadRequest;
+        }
+        if (!balances.contains(leg.balanceFile)) {
+            if (!filesystem::exists(leg.balanceFile)) {
+                wcout << "Balance file " << leg.balanceFile << " not found." << endl;
+                return status_codes::NotFound;
+            }
+            seal::Ciphertext balance;
+            ifstream balIn(leg.balanceFile, std::ios::binary);
+            balance.load(*context, balIn);
+            balIn.close();
+            balances.insert(make_pair(leg.balanceFile, balance));
+        }
+    }
+
+    seal::Evaluator evaluator(*context);
+    for (Leg& leg : legs) {
+        seal::Ciphertext& balance = balances.at(leg.balanceFile);
+        alignToBalance(evaluator, leg.amount, balance);
+        evaluator.sub_inplace(balance, leg.amount);
+    }
+
+    vector<pair<wstring, seal::Ciphertext*>> files;
+    map<wstring, wstring> previous;
+    for (auto& [balanceFile, balance] : balances) {
+        files.push_back(make_pair(balanceFile, &balance));
+        previous[balanceFile] = etagOf(balanceFile);
+    }
+    for (Leg& leg : legs) {
+        files.push_back(make_pair(leg.amountFile, &leg.amount));
+    }
+    status_code code = commitCiphertexts(files);
+    if (code == status_codes::OK) {
+        for (auto& [balanceFile, etag] : previous) {
+            versions += wstring_convert<codecvt_utf8<wchar_t>>().to_bytes(balanceFile + L"," + etag + L"," + etagOf(balanceFile)) + "\n";
+        }
+    }
+    return code;
+}
+
+// Receives both legs of a transfer in one request and applies them atomically. URI is /fromBalance,toBalance,fromAmountFile,toAmountFile and the body holds the two amount ciphertexts back to back
+bool transfer2(http_request request) {
+    try {
+        if (request.get_remote_address().compare(serverIP) != 0) {
+            request.reply(status_codes::Forbidden, L"Not authorised to make request");
+            return false;
+        }
+        if (deadlinePassed(request, "cloud arrival")) {
+            return false;
+        }
+        wstring uri = request.relative_uri().to_string();
+        uri = uri.substr(1, uri.length());
+        vector<wstring> parts;
+        int index = uri.find_first_of(',');
+        while (index != wstring::npos) {
+            parts.push_back(uri.substr(0, index));
+            uri = uri.substr(index + 1, uri.length());
+            index = uri.find_first_of(',');
+        }
+        parts.push_back(uri);
+        if (parts.size() != 4) {
+            request.reply(status_codes::BadRequest, L"Invalid transfer request");
+            return false;
+        }
+        vector<unsigned char> body = request.extract_vector().get();
+        stringstream bodyIn(string(body.begin(), body.end()), std::ios::in | std::ios::binary);
+        vector<Leg> legs(2);
+        legs[0].balanceFile = parts[0];
+        legs[0].amountFile = parts[2];
+        legs[0].amount.load(*context, bodyIn);
+        legs[1].balanceFile = parts[1];
+        legs[1].amountFile = parts[3];
+        legs[1].amount.load(*context, bodyIn);
+        string versions;
+        status_code code = applyLegs(request, legs, versions);
+        if (code == status_codes::GatewayTimeout) {
+            return false;
+        }
+        if (code == status_codes::OK) {
+            wcout << "Transfer applied between " << parts[0] << " and " << parts[1] << endl;
+            request.reply(code, versions);
+            return true;
+        }
+        request.reply(code);
+        return false;
+    }
+    catch (exception& e) {
+        cout << e.what() << endl;
+        request.reply(status_codes::InternalError);
+        return false;
+    }
+}
+
+// Reads one line from a request body stream, without its line ending
+pplx::task<string> readBodyLine(concurrency::streams::istream body) {
+    auto line = make_shared<concurrency::streams::container_buffer<string>>();
+    return body.read_line(*line).then([line](size_t) {
+        return line->collection();
+    });
+}
+
+// Reads exactly size bytes from a request body stream, continuing from the read bytes already in the buffer. Fails if the body ends first
+pplx::task<string> readBodyBytes(concurrency::streams::istream body, shared_ptr<concurrency::streams::container_buffer<string>> bytes, size_t size, size_t read) {
+    if (read >= size) {
+        return pplx::task_from_result(bytes->collection());
+    }
+    return body.read(*bytes, size - read).then([body, bytes, size, read](size_t got) {
+        if (got == 0) {
+            throw runtime_error("Request body ended early");
+        }
+        return readBodyBytes(body, bytes, size, read + got);
+    });
+}
+
+// Reads the manifest line of each leg from index onwards
+pplx::task<void> readBatchManifest(concurrency::streams::istream body, shared_ptr<vector<Leg>> legs, size_t index) {
+    if (index == legs->size()) {
+        return pplx::task_from_result();
+    }
+    return readBodyLine(body).then([body, legs, index](string line) {
+        int split = line.find_first_of(',');
+        if (split == string::npos) {
+            throw invalid_argument("Invalid batch manifest");
+        }
+        (*legs)[index].balanceFile = wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(line.substr(0, split));
+        (*legs)[index].amountFile = wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(line.substr(split + 1, line.length()));
+        return readBatchManifest(body, legs, index + 1);
+    });
+}
+
+// Reads the size line and ciphertext of each leg's amount from index onwards
+pplx::task<void> readBatchAmounts(concurrency::streams::istream body, shared_ptr<vector<Leg>> legs, size_t index) {
+    if (index == legs->size()) {
+        return pplx::task_from_result();
+    }
+    return readBodyLine(body).then([body](string size) {
+        return readBodyBytes(body, make_shared<concurrency::streams::container_buffer<string>>(), stoul(size), 0);
+    }).then([body, legs, index](string bytes) {
+        stringstream amountIn(bytes, std::ios::in | std::ios::binary);
+        (*legs)[index].amount.load(*context, amountIn);
+        return readBatchAmounts(body, legs, index + 1);
+    });
+}
+
+// Receives many transfer legs in one request and applies them atomically. The body starts with a manifest line holding the leg count, then one "balanceFile,amountFile" line per leg,
+// followed by each amount ciphertext in manifest order as a line holding its size and then its bytes. The body is read as it arrives, each read a continuation of the last,
+// so no thread waits on a slow upload
+bool transferBatch(http_request request) {
+    try {
+        if (request.get_remote_address().compare(serverIP) != 0) {
+            request.reply(status_codes::Forbidden, L"Not authorised to make request");
+            return false;
+        }
+        if (deadlinePassed(request, "cloud arrival")) {
+            return false;
+        }
+        concurrency::streams::istream body = request.body();
+        shared_ptr<vector<Leg>> legs = make_shared<vector<Leg>>();
+        readBodyLine(body).then([body, legs](string count) {
+            if (stoi(count) <= 0) {
+                throw invalid_argument("Empty batch");
+            }
+            legs->resize(stoi(count));
+            return readBatchManifest(body, legs, 0);
+        }).then([body, legs]() {
+            return readBatchAmounts(body, legs, 0);
+        }).then([request, legs](pplx::task<void> read) {
+            try {
+                read.get();
+            }
+            catch (exception& e) {
+                cout << "Could not read batch: " << e.what() << endl;
+                request.reply(status_codes::BadRequest, L"Invalid batch");
+                return;
+            }
+            try {
+                string versions;
+                status_code code = applyLegs(request, *legs, versions);
+                if (code == status_codes::GatewayTimeout) {
+                    return;
+                }
+                if (code == status_codes::OK) {
+                    cout << "Batch of " << legs->size() << " legs applied." << endl;
+                    request.reply(code, versions);
+                    return;
+                }
+                request.reply(code);
+            }
+            catch (exception& e) {
+                cout << e.what() << endl;
+                request._reply_if_not_already(status_codes::InternalError);
+            }
+        });
+        return true;
+    }
+    catch (exception& e) {
+        cout << e.what() << endl;
+        request._reply_if_not_already(status_codes::InternalError);
+        return false;
+    }
+}
+
+// Receives a newline-separated list of files and replies with their ciphertexts back to back, in the order requested, from one consistent snapshot.
+// X-ETags lists their ETags, comma separated, in the same order
+bool sendBalances(http_request request) {
+    try {
+        if (request.get_remote_address().compare(serverIP) != 0) {
+            request.reply(status_codes::Forbidden, L"Not authorised to request");
+            return false;
+        }
+        if (deadlinePassed(request, "cloud arrival")) {
+            return false;
+        }
+        stringstream namesIn(request.extract_utf8string().get());
+        string name;
+        vector<unsigned char> contents;
+        lock_guard<mutex> lock(ledgerMutex);
+        if (deadlinePassed(request, "cloud ledger lock") || ledgerBlocked(request)) {
+            return false;
+        }
+        wstring etags = L"";
+        while (getline(namesIn, name)) {
+            if (name.empty()) {
+                continue;
+            }
+            if (!filesystem::exists(name)) {
+                cout << "File " << name << " not found in balance batch." << endl;
+                request.reply(status_codes::NotFound, L"File not found");
+                return false;
+            }
+            ifstream fileIn(name, std::ios::binary);
+            contents.insert(contents.end(), istreambuf_iterator<char>(fileIn), istreambuf_iterator<char>());
+            fileIn.close();
+            etags += (etags.empty() ? L"" : L",") + etagOf(wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(name));
+        }
+        http_response response(status_codes::OK);
+        response.headers().add(L"X-ETags", etags);
+        response.set_body(contents);
+        request.reply(response);
+        return true;
+    }
+    catch (exception& e) {
+        cout << e.what() << endl;
+        request.reply(status_codes::InternalError);
+        return false;
+    }
+}
+
+// One balance in an interest command, with the ciphertexts sent for it
+struct InterestEntry {
+    wstring balanceFile;
+    wstring amountFile; // Interest credited to the account
+    wstring bankAmountFile; // The same interest debited from the bank
+    wstring etag; // Set only for a refresh: the version of the balance the replacement was computed from
+    seal::Ciphertext bankLeg; // Interest under the bank's key
+    seal::Ciphertext balance; // Replacement balance for a refresh
+    seal::Ciphertext interest; // Interest under the account's key for a refresh
+};
+
+// Pays interest on many balances and debits the total from the bank in one commit. The body holds the rate, the bank's balance file, the entry count and one
+// "balanceFile,amountFile,bankAmountFile,etag" line per balance, followed by the ciphertexts back to back in entry order: each entry's bank leg, then for a refresh its new balance and interest.
+// An entry without an etag is paid in place: the balance is multiplied by the plaintext rate, rescaled, and the product is added back and stored as the interest amount file.
+// That costs the balance a level, so a balance with none left is answered refresh and must be sent again with a new top-level balance encrypted by the interest server,
+// which is stored only if the balance still has the etag it was read at. Every paid entry's bank leg is subtracted from the bank's balance and stored as the bank amount file.
+// Replies with one "balanceFile,outcome" line per entry, where outcome is applied, refreshed, duplicate (amount file already stored), refresh, changed (etag no longer current) or missing
+bool applyInterest(http_request request) {
+    try {
+        if (request.get_remote_address().compare(serverIP) != 0) {
+            request.reply(status_codes::Forbidden, L"Not authorised to make request");
+            return false;
+        }
+        if (deadlinePassed(request, "cloud arrival")) {
+            return false;
+        }
+        vector<unsigned char> body = request.extract_vector().get();
+        stringstream bodyIn(string(body.begin(), body.end()), std::ios::in | std::ios::binary);
+        string line;
+        getline(bodyIn, line);
+        double rate = stod(line);
+        getline(bodyIn, line);
+        wstring bankFile = wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(line);
+        getline(bodyIn, line);
+        int count = stoi(line);
+        vector<InterestEntry> entries(count);
+        for (InterestEntry& entry : entries) {
+            getline(bodyIn, line);
+            vector<wstring> fields;
+            wstringstream fieldsIn(wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(line));
+            wstring field;
+            while (getline(fieldsIn, field, L',')) {
+                fields.push_back(field);
+            }
+            if (fields.size() < 3 || fields.size() > 4) {
+                request.reply(status_codes::BadRequest, L"Invalid interest manifest");
+                return false;
+            }
+            entry.balanceFile = fields[0];
+            entry.amountFile = fields[1];
+            entry.bankAmountFile = fields[2];
+            entry.etag = fields.size() == 4 ? fields[3] : L"";
+        }
+        for (InterestEntry& entry : entries) {
+            entry.bankLeg.load(*context, bodyIn);
+            if (!entry.etag.empty()) {
+                entry.balance.load(*context, bodyIn);
+                entry.interest.load(*context, bodyIn);
+            }
+        }
+
+        lock_guard<mutex> lock(ledgerMutex);
+        if (deadlinePassed(request, "cloud ledger lock") || ledgerBlocked(request)) {
+            return false;
+        }
+        if (!filesystem::exists(bankFile)) {
+            wcout << "Bank balance file " << bankFile << " not found." << endl;
+            request.reply(status_codes::NotFound, L"Bank balance not found");
+            return false;
+        }
+        seal::Ciphertext bank;
+        ifstream bankIn(bankFile, std::ios::binary);
+        bank.load(*context, bankIn);
+        bankIn.close();
+        seal::Evaluator evaluator(*context);
+        seal::CKKSEncoder encoder(*context);
+        vector<pair<wstring, seal::Ciphertext*>> files;
+        set<wstring> seen;
+        string outcome = "";
+        int paid = 0;
+        for (InterestEntry& entry : entries) {
+            string name = wstring_convert<codecvt_utf8<wchar_t>>().to_bytes(entry.balanceFile);
+            if (entry.balanceFile.compare(bankFile) == 0 || !filesystem::exists(entry.balanceFile) || !seen.insert(entry.balanceFile).second) {
+                outcome += name + ",missing\n";
+                continue;
+            }
+            if (filesystem::exists(entry.amountFile)) {
+                outcome += name + ",duplicate\n";
+                continue;
+            }
+            if (!validAmountFile(entry.amountFile) || !validAmountFile(entry.bankAmountFile)) {
+                outcome += name + ",missing\n";
+                continue;
+            }
+            if (!entry.etag.empty()) {
+                if (entry.etag.compare(etagOf(entry.balanceFile)) != 0) {
+                    outcome += name + ",changed\n";
+                    continue;
+                }
+                outcome += name + ",refreshed\n";
+            }
+            else {
+                ifstream balIn(entry.balanceFile, std::ios::binary);
+                entry.balance.load(*context, balIn);
+                balIn.close();
+                auto contextData = context->get_context_data(entry.balance.parms_id());
+                if (!contextData || !contextData->next_context_data()) {
+                    outcome += name + ",refresh\n";
+                    continue;
+                }
+                // Encoding the rate at exactly the prime that rescaling removes keeps the interest at the balance's scale
+                double rateScale = static_cast<double>(contextData->parms().coeff_modulus().back().value());
+                seal::Plaintext ratePlain;
+                encoder.encode(rate, entry.balance.parms_id(), rateScale, ratePlain);
+                evaluator.multiply_plain(entry.balance, ratePlain, entry.interest);
+                evaluator.rescale_to_next_inplace(entry.interest);
+                evaluator.mod_switch_to_next_inplace(entry.balance);
+                entry.interest.scale() = entry.balance.scale();
+                evaluator.add_inplace(entry.balance, entry.interest);
+                outcome += name + ",applied\n";
+            }
+            alignToBalance(evaluator, entry.bankLeg, bank);
+            evaluator.sub_inplace(bank, entry.bankLeg);
+            files.push_back(make_pair(entry.balanceFile, &entry.balance));
+            files.push_back(make_pair(entry.amountFile, &entry.interest));
+            files.push_back(make_pair(entry.bankAmountFile, &entry.bankLeg));
+            paid++;
+        }
+        if (paid > 0) {
+            files.push_back(make_pair(bankFile, &bank));
+        }
+        status_code code = files.empty() ? status_codes::OK : commitCiphertexts(files);
+        if (code != status_codes::OK) {
+            request.reply(code);
+            return false;
+        }
+        cout << "Interest paid on " << paid << " of " << count << " balances." << endl;
+        request.reply(status_codes::OK, outcome);
+        return true;
+    }
+    catch (exception& e) {
+        cout << e.what() << endl;
+        request.reply(status_codes::InternalError);
+        return false;
+    }
+}
+
 // Receives file from central server. Places file in storage given it is a .txt file and does not already exist
 bool directDebit(http_request request) {
     try {
         if (request.get_remote_address().compare(serverIP) == 0) {
+            if (deadlinePassed(request, "cloud arrival")) {
+                return false;
+            }
             wstring fileName = request.relative_uri().to_string();
             fileName = fileName.substr(1, fileName.length());
             if (fileName.length() <= 4) {
@@ -218,12 +954,34 @@ bool directDebit(http_request request) {
     }
 }
 
+// Runs a handler once the whole request body has arrived, so its body reads complete immediately and a slow upload never holds a listener thread
+function<void(http_request)> whenBodyReady(function<bool(http_request)> handler) {
+    return [handler](http_request request) {
+        request.content_ready().then([handler, request](pplx::task<http_request> ready) {
+            try {
+                handler(ready.get());
+            }
+            catch (exception& e) {
+                cout << "Could not read request body: " << e.what() << endl;
+                request._reply_if_not_already(status_codes::BadRequest);
+            }
+        });
+    };
+}
+
 int main()
 {
+#ifdef _WIN32
+    SetConsoleCtrlHandler(onConsoleEvent, TRUE);
+#else
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+#endif
     try {
         wstring cloudDNS = readCloudDNS();
         serverIP = readServerIP();
         loadCKKSParams(*params);
+        recoverJournal();
         http_listener balanceListener(cloudDNS + L":8081/balance");
         balanceListener.support(methods::GET, sendBalance);
         balanceListener
@@ -232,20 +990,60 @@ int main()
             .wait();
 
         http_listener transferListener(cloudDNS + L":8081/transfer");
-        transferListener.support(methods::PUT, transaction);
+        transferListener.support(methods::PUT, whenBodyReady(transaction));
         transferListener
             .open()
             .then([&transferListener]() {wcout << (L"Starting to listen for transaction requests") << endl; })
             .wait();
 
+        http_listener transfer2Listener(cloudDNS + L":8081/transfer2");
+        transfer2Listener.support(methods::PUT, whenBodyReady(transfer2));
+        transfer2Listener
+            .open()
+            .then([&transfer2Listener]() {wcout << (L"Starting to listen for atomic transfer requests") << endl; })
+            .wait();
+
+        http_listener batchListener(cloudDNS + L":8081/transferbatch");
+        // Bulk chunks are read as they stream in, so the handler starts before the body has arrived and reads it with continuations
+        batchListener.support(methods::PUT, transferBatch);
+        batchListener
+            .open()
+            .then([&batchListener]() {wcout << (L"Starting to listen for batched transfer requests") << endl; })
+            .wait();
+
+        http_listener balancesListener(cloudDNS + L":8081/balances");
+        balancesListener.support(methods::POST, whenBodyReady(sendBalances));
+        balancesListener
+            .open()
+            .then([&balancesListener]() {wcout << (L"Starting to listen for batched balance requests") << endl; })
+            .wait();
+
+        http_listener interestListener(cloudDNS + L":8081/interest");
+        interestListener.support(methods::PUT, whenBodyReady(applyInterest));
+        interestListener
+            .open()
+            .then([&interestListener]() {wcout << (L"Starting to listen for interest requests") << endl; })
+            .wait();
+
         http_listener debitListener(cloudDNS + L":8081/debits");
-        debitListener.support(methods::POST, directDebit);
+        debitListener.support(methods::POST, whenBodyReady(directDebit));
         debitListener
             .open()
             .then([&debitListener]() {wcout << (L"Starting to listen for direct debit requests") << endl; })
             .wait();
 
-        while (true);
+        // Handlers run on the cpprest pool, so this thread only waits to be told to stop
+        {
+            unique_lock<mutex> guard(shutdownLock);
+            while (!shutdownRequested) {
+                shutdownSignal.wait_for(guard, chrono::seconds(1));
+            }
+        }
+        cout << "Shutting down." << endl;
+        for (http_listener* listener : { &balanceListener, &transferListener, &transfer2Listener, &batchListener, &balancesListener, &interestListener, &debitListener }) {
+            listener->close().wait();
+        }
+        printTimeoutMetrics();
     }
     catch (exception& e) {
         cout << e.what() << endl;
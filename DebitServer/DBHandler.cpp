@@ -2,54 +2,57 @@
 #include <croncpp/croncpp.h>
 #include <string>
 #include <fstream>
-using namespace mysqlx;
 
 // Class constructor
 DBHandler::DBHandler(TransactionHandler* tran)
 {
 	this->tran = tran;
-	this->schema = nullptr;
-	this->session = nullptr;
-	this->accounts = nullptr;
-	this->transactions = nullptr;
-	this->debits = nullptr;
+	this->store = nullptr;
+	this->transactionLog = nullptr;
 }
 
 // Logs transaction in database
 bool DBHandler::logTransaction(Account* from, Account* to, time_t nowTime)
 {
-	session->startTransaction();
+	std::string transactionAddressFrom = std::to_string(from->getId()) + "'" + std::to_string(to->getId()) + "'" + std::to_string(nowTime) + ".txt";
+	std::string transactionAddressTo = std::to_string(to->getId()) + "'" + std::to_string(from->getId()) + "'" + std::to_string(nowTime) + ".txt";
+	// Debits run on the debit server's own worker threads, so waiting for the commit here holds no listener or task pool thread
+	return transactionLog->append({
+		LogRecord{ nowTime, "debit", transactionAddressFrom, from->getId(), to->getId() },
+		LogRecord{ nowTime, "credit", transactionAddressTo, to->getId(), from->getId() }
+	}).get();
+}
+
+// Writes a batch from the log writer in one commit
+bool DBHandler::writeTransactions(const std::vector<LogRecord>& records)
+{
 	try {
-		std::string transactionAddressFrom = std::to_string(from->getId()) + "'" + std::to_string(to->getId()) + "'" + std::to_string(nowTime) + ".txt";
-		std::string transactionAddressTo = std::to_string(to->getId()) + "'" + std::to_string(from->getId()) + "'" + std::to_string(nowTime) + ".txt";
-		transactions->insert("transactionTime", "transactionType", "amount", "transactionOwnerID", "otherAccountID").values(nowTime, "debit", transactionAddressFrom, from->getId(), to->getId()).execute();
-		transactions->insert("transactionTime", "transactionType", "amount", "transactionOwnerID", "otherAccountID").values(nowTime, "credit", transactionAddressTo, to->getId(), from->getId()).execute();
-		session->commit();
+		store->insertTransactions(records);
 		return true;
 	}
-	catch (const Error& e) {
+	catch (std::exception& e) {
 		std::cout << "Error caught: " << e.what() << std::endl;
-		session->rollback();
 		return false;
 	}
 }
 
+void DBHandler::printLogMetrics() {
+	if (transactionLog != nullptr) {
+		transactionLog->printMetrics();
+	}
+	if (store != nullptr) {
+		store->printMetrics();
+	}
+}
+
 // Establishes connection with database
-bool DBHandler::connectToDB()
+bool DBHandler::connectToDB(StorageBackend* store, LogDurability logDurability, size_t logBatchSize, size_t logMaxQueued, int logFlushMs)
 {
 	try {
-		Session* session = new Session(mysqlx::SessionOption::USER, "root",
-			mysqlx::SessionOption::PWD, "admin",
-			mysqlx::SessionOption::HOST, "localhost",
-			mysqlx::SessionOption::PORT, 33060,
-			mysqlx::SessionOption::DB, "bankdb"
-		);
-		Schema* schema = new Schema(*session, "bankdb");
-		this->schema = schema;
-		this->session = session;
-		this->accounts = new Table(*schema, "accounts");
-		this->transactions = new Table(*schema, "transactions");
-		this->debits = new Table(*schema, "direct_debits");
+		this->store = store;
+		store->open();
+		this->transactionLog = new TransactionLogWriter([this](const std::vector<LogRecord>& records) { return writeTransactions(records); },
+			logDurability, logBatchSize, logMaxQueued, std::chrono::milliseconds(logFlushMs));
 		return true;
 	}
 	catch (std::exception& e) {
@@ -62,10 +65,16 @@ bool DBHandler::connectToDB()
 // Ends connection with database
 bool DBHandler::endConnection() {
 	try {
-		if (session != nullptr && schema != nullptr) {
-			session->close();
-			schema = nullptr;
-			session = nullptr;
+		if (transactionLog != nullptr) {
+			transactionLog->stop();
+			transactionLog->printMetrics();
+			delete transactionLog;
+			transactionLog = nullptr;
+		}
+		if (store != nullptr) {
+			store->close();
+			delete store;
+			store = nullptr;
 			std::cout << "Connection closed." << std::endl;
 			return true;
 		}
@@ -79,52 +88,49 @@ bool DBHandler::endConnection() {
 	}
 }
 
-Schema* DBHandler::getSchema() {
-	return schema;
+Account* DBHandler::toAccount(const AccountRow& row, seal::SEALContext context) {
+	return new Account(row.id, row.firstName, row.lastName, row.overdraft, row.pin, row.balanceAddress, row.keyAddress, context);
 }
 
-Session* DBHandler::getSession() {
-	return session;
-}
-
-Table* DBHandler::getAccounts() {
-	return accounts;
+DirectDebit* DBHandler::toDebit(const DebitRow& row, seal::SEALContext context) {
+	return new DirectDebit(row.debitID, getAccount(row.ownerID, context), getAccount(row.otherID, context), row.amount, cron::make_cron(row.regularity), row.timeSet);
 }
 
 // Gets list of accounts
 std::vector<Account*> DBHandler::getAccounts(seal::SEALContext context) {
-	RowResult accountNums = accounts->select("id").orderBy("id").execute();
+	std::vector<AccountRow> rows = store->getAccounts();
 	std::vector<Account*> accounts;
-	if (accountNums.count() == 0) {
+	if (rows.size() == 0) {
 		std::cout << "No accounts exist." << std::endl;
 	}
 	else {
-		for (Row row : accountNums) {
-			int accountId = (int)row.get(0);
-			Account* toAdd = getAccount(accountId, context);
-			accounts.push_back(toAdd);
+		for (AccountRow& row : rows) {
+			accounts.push_back(toAccount(row, context));
 		}
 	}
 	return accounts;
 }
 
-Table* DBHandler::getTransactions() {
-	return transactions;
-}
-
 // Gets list of transactions on an account
+// Loads the account's history, then its counterparties in one batch. Each counterparty is built once and shared by all of its transactions
 TransactionList* DBHandler::getTransactions(int accountId, seal::SEALContext context) {
-	RowResult tra = transactions->select("*").where("transactionOwnerID=" + std::to_string(accountId)).orderBy("transactionTime").execute();
-	if (tra.count() == 0) {
+	std::vector<TransactionRow> tra = store->getTransactions(accountId);
+	if (tra.size() == 0) {
 		std::cout << "No transactions have occurred on this account." << std::endl;
 		return nullptr;
 	}
 	else {
-		for (Row row : tra) {
-			int otherAccountId = (int)row.get(5);
-			Account* currentAccount = getAccount(accountId, context);
-			Account* otherAccount = getAccount(otherAccountId, context);
-			Transaction* temp = new Transaction((std::string)row.get(3), currentAccount, otherAccount, (std::string)row.get(2), (std::time_t)row.get(1));
+		Account* currentAccount = getAccount(accountId, context);
+		std::vector<int> ids;
+		for (TransactionRow& row : tra) {
+			ids.push_back(row.otherID);
+		}
+		std::map<int, Account*> counterparties;
+		for (AccountRow& row : store->getAccounts(ids)) {
+			counterparties[row.id] = toAccount(row, context);
+		}
+		for (TransactionRow& row : tra) {
+			Transaction* temp = new Transaction(row.amount, currentAccount, counterparties[row.otherID], row.type, row.time);
 			tran->getTransactions()->addTransaction(temp);
 		}
 		return tran->getTransactions();
@@ -135,13 +141,9 @@ TransactionList* DBHandler::getTransactions(int accountId, seal::SEALContext con
 
 // Gets account by ID
 Account* DBHandler::getAccount(int id, seal::SEALContext context) {
-	RowResult acc = accounts->select("*").where("id=" + std::to_string(id)).execute();
-	if (acc.count() == 1) {
-		Row row = acc.fetchOne();
-		std::string getBal = (std::string)row.get(3);
-		std::string getKey = (std::string)row.get(4);
-		Account* accountSearched = new Account((int)row.get(0), (std::string)row.get(1), (std::string)row.get(2), (double)row.get(5), (size_t)row.get(6), getBal, getKey, context);
-		return accountSearched;
+	AccountRow row;
+	if (store->getAccount(id, row)) {
+		return toAccount(row, context);
 	}
 	else return nullptr;
 }
@@ -168,14 +170,11 @@ bool DBHandler::directDebit(DirectDebit* dD, seal::PublicKey public_key, seal::S
 bool DBHandler::addDebit(DirectDebit* d, std::string regString, seal::SEALContext context, seal::EncryptionParameters params)
 {
 	try {
-		session->startTransaction();
-		debits->insert("transactionOwnerID", "otherAccountID", "amount", "regularity", "timeSet").values(d->getFrom()->getId(), d->getTo()->getId(), d->getAmountAddress(), regString, d->getTimeSet()).execute();
-		session->commit();
+		store->insertDebit(DebitRow{ 0, d->getFrom()->getId(), d->getTo()->getId(), d->getAmountAddress(), regString, d->getTimeSet() });
 		return tran->getDebitList()->addDebit(d);
 	}
-	catch (Error& e) {
+	catch (std::exception& e) {
 		std::cout << e.what() << std::endl;
-		session->rollback();
 		return false;
 	}
 }
@@ -183,20 +182,14 @@ bool DBHandler::addDebit(DirectDebit* d, std::string regString, seal::SEALContex
 // Gets list of direct debits from database
 DebitList* DBHandler::queryDebits(seal::SEALContext context) {
 	try {
-		RowResult deb = debits->select("*").execute();
+		std::vector<DebitRow> deb = store->getDebits();
 		DebitList* newList = new DebitList();
-		if (deb.count() > 0) {
-			for (Row r : deb) {
-				time_t newTime;
-				if ((time_t)r.get(5) < time(nullptr)) {
-					time_t now = time(nullptr);
-					time_t next = cron::cron_next(cron::make_cron((std::string)r.get(4)), now);
-					newTime = cron::cron_next(cron::make_cron((std::string)r.get(4)), time(nullptr));
+		if (deb.size() > 0) {
+			for (DebitRow& r : deb) {
+				if (r.timeSet < time(nullptr)) {
+					r.timeSet = cron::cron_next(cron::make_cron(r.regularity), time(nullptr));
 				}
-				else {
-					newTime = (time_t)r.get(5);
-				}
-				DirectDebit* d = new DirectDebit((int)r.get(0), getAccount((int)r.get(1), context), getAccount((int)r.get(2), context), (std::string)r.get(3), cron::make_cron((std::string)r.get(4)), newTime);
+				DirectDebit* d = toDebit(r, context);
 				newList->addDebit(d);
 				updateDebits(d);
 			}
@@ -212,16 +205,34 @@ DebitList* DBHandler::queryDebits(seal::SEALContext context) {
 	return nullptr;
 }
 
+// Gets the ID and next firing time of every direct debit, without loading the debits themselves
+std::vector<std::pair<int, time_t>> DBHandler::getDebitSchedule() {
+	std::vector<std::pair<int, time_t>> schedule;
+	try {
+		schedule = store->getDebitSchedule();
+	}
+	catch (std::exception& e) {
+		std::cout << e.what() << std::endl;
+	}
+	return schedule;
+}
+
+// Gets a single direct debit by ID. Returns nullptr if it no longer exists
+DirectDebit* DBHandler::getDebit(int id, seal::SEALContext context) {
+	DebitRow r;
+	if (store->getDebit(id, r)) {
+		return toDebit(r, context);
+	}
+	return nullptr;
+}
+
 // Updates time set in the database for direct debit
 void DBHandler::updateDebits(DirectDebit* d) {
 	try {
-		session->startTransaction();
-		debits->update().set("timeSet", d->getTimeSet()).where("debitID = :id").bind("id", d->getId()).execute();
-		session->commit();
+		store->setDebitTime(d->getId(), d->getTimeSet());
 	}
 	catch (std::exception& e) {
 		std::cout << e.what() << std::endl;
-		session->rollback();
 	}
 }
 
@@ -240,41 +251,27 @@ void DBHandler::refreshDebits(seal::SEALContext context) {
 // Deletes direct debit by reference
 void DBHandler::removeDebit(DirectDebit* d)
 {
-	try {
-		session->startTransaction();
-		debits->remove().where("debitID = :debitID").bind("debitID", d->getId()).execute();
-		session->commit();
-	}
-	catch (std::exception& e) {
-		std::cout << e.what() << std::endl;
-		session->rollback();
-	}
+	removeDebit(d->getId());
 }
 
 // Deletes direct debit by ID
 void DBHandler::removeDebit(int id) {
 	try {
-		session->startTransaction();
-		debits->remove().where("debitID = :debitID").bind("debitID", id).execute();
-		session->commit();
+		store->removeDebit(id);
 	}
 	catch (std::exception& e) {
 		std::cout << e.what() << std::endl;
-		session->rollback();
 	}
 }
 
 // Adds interest accrual transaction to database
 void DBHandler::addInterestTransaction(Account* account, seal::SEALContext context, seal::EncryptionParameters params, seal::PublicKey publicKey, time_t nowTime) {
 	try {
-		session->startTransaction();
 		std::string outputAddress = std::to_string(1) + "'" + std::to_string(account->getId()) + "'" + std::to_string(nowTime) + ".txt";
 		std::ofstream output(outputAddress, std::ios::binary);
-		transactions->insert("transactionTime", "transactionType", "amount", "transactionOwnerID", "otherAccountID").values(nowTime, "Monthly interest", outputAddress, account->getId(), 1).execute();
-		session->commit();
+		store->insertTransactions({ LogRecord{ nowTime, "Monthly interest", outputAddress, account->getId(), 1 } });
 	}
 	catch (std::exception& e) {
 		std::cout << e.what() << std::endl;
-		session->rollback();
 	}
 }
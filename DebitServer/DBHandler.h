@@ -1,40 +1,38 @@
 #pragma once
 #include "TransactionHandler.h"
+#include "TransactionLogWriter.h"
+#include "StorageBackend.h"
 
-#include <mysqlx/xdevapi.h>
-
-using mysqlx::Session;
-using mysqlx::Schema;
-using mysqlx::Table;
+#include <map>
+#include <utility>
 
 class DBHandler {
 private:
 	TransactionHandler* tran;
-	Session* session;
-	Schema* schema;
-	Table* accounts;
-	Table* transactions;
-	Table* debits;
+	StorageBackend* store;
+	TransactionLogWriter* transactionLog;
+
+	bool writeTransactions(const std::vector<LogRecord>& records);
+
+	Account* toAccount(const AccountRow& row, seal::SEALContext context);
+
+	DirectDebit* toDebit(const DebitRow& row, seal::SEALContext context);
 
 public:
 	DBHandler(TransactionHandler* tran);
 
+	/* Logs both legs of a debit through the transaction log, returning false if they were not written. Safe to call without holding the session lock.*/
 	bool logTransaction(Account* from, Account* to, time_t nowTime);
 
-	bool connectToDB();
-
-	bool endConnection();
+	/* Opens the store, which the handler then owns.*/
+	bool connectToDB(StorageBackend* store, LogDurability logDurability = LogDurability::Flush, size_t logBatchSize = 500, size_t logMaxQueued = 5000, int logFlushMs = 20);
 
-	Schema* getSchema();
+	void printLogMetrics();
 
-	Session* getSession();
-
-	Table* getAccounts();
+	bool endConnection();
 
 	std::vector<Account*> getAccounts(seal::SEALContext context);
 
-	Table* getTransactions();
-
 	TransactionList* getTransactions(int accountId, seal::SEALContext context);
 
 	Account* getAccount(int id, seal::SEALContext context);
@@ -45,6 +43,11 @@ public:
 
 	DebitList* queryDebits(seal::SEALContext context);
 
+	std::vector<std::pair<int, time_t>> getDebitSchedule();
+
+	/* Loads one debit and its accounts. Returns nullptr if the debit no longer exists, and throws if the lookup itself fails.*/
+	DirectDebit* getDebit(int id, seal::SEALContext context);
+
 	void updateDebits(DirectDebit* d);
 
 	void refreshDebits(seal::SEALContext context);
@@ -54,4 +57,4 @@ public:
 	void removeDebit(int id);
 
 	void addInterestTransaction(Account* account, seal::SEALContext context, seal::EncryptionParameters params, seal::PublicKey publicKey, time_t nowTime);
-};
\ No newline at end of file
+};
@@ -0,0 +1,89 @@
+#include "DebitScheduler.h"
+#include <chrono>
+
+DebitScheduler::DebitScheduler() {
+	this->stopped = false;
+}
+
+void DebitScheduler::schedule(int debitID, std::time_t due) {
+	std::lock_guard<std::mutex> guard(lock);
+	scheduled[debitID] = due;
+	bool earliest = heap.empty() || due < heap.top().due;
+	heap.push(Entry{ due, debitID });
+	compact();
+	if (earliest) {
+		changed.notify_all();
+	}
+}
+
+void DebitScheduler::cancel(int debitID) {
+	std::lock_guard<std::mutex> guard(lock);
+	scheduled.erase(debitID);
+	compact();
+}
+
+std::vector<int> DebitScheduler::waitForDue() {
+	std::unique_lock<std::mutex> guard(lock);
+	while (!stopped) {
+		dropStaleEntries();
+		if (heap.empty()) {
+			changed.wait(guard);
+			continue;
+		}
+		std::time_t due = heap.top().due;
+		if (due <= time(nullptr)) {
+			std::vector<int> ready;
+			std::time_t now = time(nullptr);
+			while (!heap.empty() && heap.top().due <= now) {
+				Entry entry = heap.top();
+				heap.pop();
+				auto current = scheduled.find(entry.debitID);
+				if (current != scheduled.end() && current->second == entry.due) {
+					ready.push_back(entry.debitID);
+					scheduled.erase(current);
+				}
+			}
+			if (!ready.empty()) {
+				return ready;
+			}
+			continue;
+		}
+		changed.wait_until(guard, std::chrono::system_clock::from_time_t(due));
+	}
+	return std::vector<int>();
+}
+
+size_t DebitScheduler::size() {
+	std::lock_guard<std::mutex> guard(lock);
+	return scheduled.size();
+}
+
+void DebitScheduler::stop() {
+	std::lock_guard<std::mutex> guard(lock);
+	stopped = true;
+	changed.notify_all();
+}
+
+// Pops heap entries for debits that were cancelled or rescheduled since they were pushed
+void DebitScheduler::dropStaleEntries() {
+	while (!heap.empty()) {
+		auto current = scheduled.find(heap.top().debitID);
+		if (current != scheduled.end() && current->second == heap.top().due) {
+			return;
+		}
+		heap.pop();
+	}
+}
+
+// Rebuilds the heap when stale entries outnumber live ones, so memory stays proportional to the number of debits
+void DebitScheduler::compact() {
+	if (heap.size() <= 2 * scheduled.size() + 1024) {
+		return;
+	}
+	std::vector<Entry> live;
+	live.reserve(scheduled.size());
+	for (auto const& [debitID, due] : scheduled) {
+		live.push_back(Entry{ due, debitID });
+	}
+	heap = std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>>(std::greater<Entry>(), std::move(live));
+}
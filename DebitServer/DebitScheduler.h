@@ -0,0 +1,44 @@
+#pragma once
+#include <condition_variable>
+#include <ctime>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+/* Keeps the next firing time of every direct debit in a min-heap so the debit server can sleep until exactly the next deadline.
+Entries hold only the debit ID and its due time; the debit itself is loaded from the database when it fires.
+Rescheduling or cancelling leaves the old heap entry in place and it is discarded when it reaches the top.*/
+class DebitScheduler {
+private:
+	struct Entry {
+		std::time_t due;
+		int debitID;
+		bool operator>(const Entry& other) const { return due > other.due; }
+	};
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+	std::unordered_map<int, std::time_t> scheduled;
+	std::mutex lock;
+	std::condition_variable changed;
+	bool stopped;
+
+	void dropStaleEntries();
+	void compact();
+
+public:
+	DebitScheduler();
+
+	/* Adds a debit or moves it to a new due time, waking the scheduler if it is now the earliest.*/
+	void schedule(int debitID, std::time_t due);
+
+	void cancel(int debitID);
+
+	/* Blocks until at least one debit is due and returns every due debit, removing them from the schedule.
+	Returns an empty list once the scheduler has been stopped.*/
+	std::vector<int> waitForDue();
+
+	size_t size();
+
+	void stop();
+};
@@ -4,11 +4,21 @@
 #include "DebitList.h"
 #include "TransactionHandler.h"
 #include "DBHandler.h"
+#include "MySQLBackend.h"
+#include "MemoryBackend.h"
+#include "DebitScheduler.h"
+#include "Deadline.h"
+#include "ZeroPool.h"
+#include "ScalarDecoder.h"
 #include <seal/seal.h>
+#include <atomic>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <locale>
@@ -21,6 +31,7 @@
 #include <openssl/evp.h>
 #include <openssl/err.h>
 #include <sstream>
+#include <thread>
 #pragma comment(lib, "cpprest_2_10")
 
 using namespace web;
@@ -36,6 +47,8 @@ static TransactionHandler* tran = new TransactionHandler(transactions, debits);
 static DBHandler* dat = new DBHandler(tran);
 static seal::EncryptionParameters* params = new seal::EncryptionParameters(seal::scheme_type::ckks);
 static seal::SEALContext* context = new seal::SEALContext(NULL);
+static DebitScheduler* scheduler = new DebitScheduler();
+static ZeroPool* zeroPool = nullptr; // Encryptions of zero for recently paid recipients
 
 // Reads in cloud DNS from file
 wstring readCloudDNS() {
@@ -45,119 +58,370 @@ wstring readCloudDNS() {
     return wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(location);
 }
 
+// Reads in central server DNS from file. The debit server listens for schedule changes on the same host
+wstring readServerDNS() {
+    ifstream inFile("serverDNS.txt");
+    string location;
+    inFile >> location;
+    return wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(location);
+}
+
+// Reads in central server IP from file
+wstring readServerIP() {
+    ifstream inFile("serverIP.txt");
+    string location;
+    inFile >> location;
+    return wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(location);
+}
+
 wstring cloudDNS = readCloudDNS();
+wstring serverDNS = readServerDNS();
+wstring serverIP = readServerIP();
+
+// Tuning for direct debit firings, read from debitConfig.txt as key=value lines. Missing keys keep these defaults
+struct DebitConfig {
+    bool inMemory = false; // backend=memory keeps everything in process, loading accounts from memorySeed.txt. For benchmarks only: no debits reach it. backend=mysql uses bankdb
+    int workers = 4; // Threads carrying out debits that fall due together
+    int transfersPerSecond = 10; // Sustained rate of debits sent to the cloud
+    int burst = 10; // Debits allowed through at once after a quiet period
+    LogDurability logDurability = LogDurability::Flush; // logDurability=flush reports a debit done once logged, =enqueue once queued
+    size_t logBatchSize = 500; // Most transaction rows written per commit
+    size_t logMaxQueued = 5000; // Rows that may wait for a commit, the most an enqueue-mode crash can lose
+    int logFlushMs = 20; // In enqueue mode, the longest a row waits for its batch to fill
+    int debitBudgetMs = 10000; // Deadline for one debit, from picking it up to the cloud applying it. A debit that misses it is retried shortly after
+    int statementTimeoutMs = 5000; // Longest a single database read may run before the server aborts it
+    size_t zeroPoolDepth = 4; // Encryptions of zero kept ready per recently paid recipient. 0 turns the pool off
+    size_t zeroPoolAccounts = 256; // Most recipients with a zero pool at once
+};
+
+DebitConfig readDebitConfig() {
+    DebitConfig config;
+    try {
+        ifstream inFile("debitConfig.txt");
+        string line;
+        while (getline(inFile, line)) {
+            int index = line.find_first_of('=');
+            if (index == string::npos) {
+                continue;
+            }
+            string key = line.substr(0, index);
+            if (key.compare("logDurability") == 0) {
+                config.logDurability = line.substr(index + 1, line.length()).compare("enqueue") == 0 ? LogDurability::Enqueue : LogDurability::Flush;
+                continue;
+            }
+            if (key.compare("backend") == 0) {
+                config.inMemory = line.substr(index + 1, line.length()).compare("memory") == 0;
+                continue;
+            }
+            int value = stoi(line.substr(index + 1, line.length()));
+            if (key.compare("zeroPoolDepth") == 0 && value >= 0) {
+                config.zeroPoolDepth = value;
+                continue;
+            }
+            if (value <= 0) {
+                continue;
+            }
+            if (key.compare("workers") == 0) {
+                config.workers = value;
+            }
+            else if (key.compare("transfersPerSecond") == 0) {
+                config.transfersPerSecond = value;
+            }
+            else if (key.compare("burst") == 0) {
+                config.burst = value;
+            }
+            else if (key.compare("logBatchSize") == 0) {
+                config.logBatchSize = value;
+            }
+            else if (key.compare("logMaxQueued") == 0) {
+                config.logMaxQueued = value;
+            }
+            else if (key.compare("logFlushMs") == 0) {
+                config.logFlushMs = value;
+            }
+            else if (key.compare("debitBudgetMs") == 0) {
+                config.debitBudgetMs = value;
+            }
+            else if (key.compare("statementTimeoutMs") == 0) {
+                config.statementTimeoutMs = value;
+            }
+            else if (key.compare("zeroPoolAccounts") == 0) {
+                config.zeroPoolAccounts = value;
+            }
+        }
+    }
+    catch (exception& e) {
+        cout << e.what() << endl;
+    }
+    return config;
+}
+
+DebitConfig debitConfig = readDebitConfig();
+mutex dbMutex; // The DB session is shared by all workers
+
+// Token bucket shared by all workers. Refills at transfersPerSecond up to burst, and acquire() blocks until a token is free
+struct RateLimiter {
+    mutex lock;
+    double tokens = debitConfig.burst;
+    chrono::steady_clock::time_point last = chrono::steady_clock::now();
+
+    void acquire() {
+        while (true) {
+            chrono::duration<double> wait;
+            {
+                lock_guard<mutex> guard(lock);
+                auto now = chrono::steady_clock::now();
+                tokens = min((double)debitConfig.burst, tokens + chrono::duration<double>(now - last).count() * debitConfig.transfersPerSecond);
+                last = now;
+                if (tokens >= 1.0) {
+                    tokens -= 1.0;
+                    return;
+                }
+                wait = chrono::duration<double>((1.0 - tokens) / debitConfig.transfersPerSecond);
+            }
+            this_thread::sleep_for(wait);
+        }
+    }
+};
+RateLimiter rateLimiter;
+
+// One mutex per account, created on first use. A debit holds the locks of both its accounts so debits touching the same account run one at a time
+mutex accountLocksMutex;
+map<int, shared_ptr<mutex>> accountLocks;
+map<pair<int, int>, time_t> lastStamps; // Last timestamp used for each pair of accounts, guarded by accountLocksMutex
+
+shared_ptr<mutex> getAccountLock(int id) {
+    lock_guard<mutex> guard(accountLocksMutex);
+    shared_ptr<mutex>& m = accountLocks[id];
+    if (m == nullptr) {
+        m = make_shared<mutex>();
+    }
+    return m;
+}
+
+// Locks both accounts of a debit, always in ascending ID order so two workers can never deadlock
+struct AccountPairLock {
+    shared_ptr<mutex> first;
+    shared_ptr<mutex> second;
+    AccountPairLock(int a, int b) {
+        first = getAccountLock(min(a, b));
+        second = getAccountLock(max(a, b));
+        first->lock();
+        second->lock();
+    }
+    ~AccountPairLock() {
+        second->unlock();
+        first->unlock();
+    }
+};
+
+// Returns a timestamp for a transfer between two accounts that no earlier transfer between them has used. Amount files are named
+// from'to'time.txt, so two debits between the same accounts in the same second would otherwise collide
+time_t reserveTimestamp(int a, int b) {
+    lock_guard<mutex> guard(accountLocksMutex);
+    time_t& last = lastStamps[make_pair(min(a, b), max(a, b))];
+    last = max(time(nullptr), last + 1);
+    return last;
+}
 
 // HTTP request for file. Receives file information and returns ciphertext
-void getAmount(wstring balAddress, seal::Ciphertext& ciphertext) {
+void getAmount(wstring balAddress, seal::Ciphertext& ciphertext, const Deadline& deadline) {
     seal::Ciphertext ciphertext2;
-    http_client client(cloudDNS + L":8081/balance");
-    auto response = client.request(methods::GET, balAddress);
-    auto buf = response.get().body().streambuf();
-    string contents = "";
-    while (!buf.is_eof()) {
-        if (buf.getc().get() != -2) // Gets rid of weird requiring 'async required' bugs
-            contents += buf.sbumpc();
-    }
-    ofstream outFile(balAddress, std::ios::binary);
-    outFile << contents;
-    outFile.close();
-    ifstream inFile(balAddress, std::ios::binary | std::ios::beg);
-    ciphertext2.load(*context, inFile);
-    inFile.close();
+    http_request cloudRequest(methods::GET);
+    cloudRequest.set_request_uri(balAddress);
+    http_response response = deadline.send(cloudDNS + L":8081/balance", cloudRequest, "cloud fetch").get();
+    if (response.status_code() != status_codes::OK) {
+        throw runtime_error("Cloud server could not supply " + wstring_convert<codecvt_utf8<wchar_t>>().to_bytes(balAddress));
+    }
+    vector<unsigned char> contents = response.extract_vector().get();
+    stringstream inStream(string(contents.begin(), contents.end()), std::ios::in | std::ios::binary); // Loaded from memory so concurrent workers never share a temporary file
+    ciphertext2.load(*context, inStream);
     ciphertext = ciphertext2;
-    std::remove(std::wstring_convert<std::codecvt_utf8<wchar_t>>().to_bytes(balAddress).c_str());
 }
 
-// Main workhorse program for processingt direct debits. Checks to see if debit is due and carries it out if it is. Deletes debit if not enough money present in account 
-void processDebits(DBHandler* dat, TransactionHandler* tran) {
-    try {
-        while (true) {
-            auto debitList = dat->queryDebits(*context);
-            if (debitList == nullptr) {
-                _sleep(999);
-                continue;
+// Sends both legs of a debit to the cloud server in one request. The cloud applies them atomically, so a failure leaves neither balance changed
+status_code sendTransferToCloud(wstring fromBalance, wstring toBalance, wstring fromAmountFile, wstring toAmountFile, seal::Ciphertext& amountFrom, seal::Ciphertext& amountTo, const Deadline& deadline) {
+    stringstream body(std::ios::in | std::ios::out | std::ios::binary);
+    amountFrom.save(body);
+    amountTo.save(body);
+    string bytes = body.str();
+    http_request cloudRequest(methods::PUT);
+    cloudRequest.set_request_uri(fromBalance + L"," + toBalance + L"," + fromAmountFile + L"," + toAmountFile);
+    cloudRequest.set_body(vector<unsigned char>(bytes.begin(), bytes.end()));
+    return deadline.send(cloudDNS + L":8081/transfer2", cloudRequest, "cloud transfer").get().status_code();
+}
+
+// Carries out one due direct debit. Returns the cloud status, or PaymentRequired if the debit was deleted for lack of funds
+status_code executeDebit(DirectDebit* d, time_t nowTime, const Deadline& deadline) {
+    string keyAddress = d->getFrom()->getKeyAddress();
+    cout <<"Key address: " <<  keyAddress << endl;
+    std::ifstream keyIn(keyAddress, std::ios::binary);
+    seal::SecretKey secret_keyFrom;
+    seal::SecretKey secret_keyTo;
+    secret_keyFrom.load(*context, keyIn);
+    keyIn.close();
+    ifstream keyInTo(d->getTo()->getKeyAddress(), std::ios::binary);
+    secret_keyTo.load(*context, keyInTo);
+    keyInTo.close();
+    string address = d->getAmountAddress();
+    wstring toSend = wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(address);
+    seal::Ciphertext ciphertext, fromBal, toBal;
+    getAmount(toSend, ciphertext, deadline);
+    seal::Decryptor decryptor(*context, secret_keyFrom);
+    seal::CKKSEncoder encoder(*context);
+    ScalarDecoder decoder(*context);
+    double amount = decoder.decrypt(decryptor, ciphertext);
+    Account* from = d->getFrom();
+    Account* to = d->getTo();
+    string fromAddress = from->getBalanceAddress();
+    toSend = wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(fromAddress);
+    getAmount(toSend, fromBal, deadline);
+    double bal = decoder.decrypt(decryptor, fromBal);
+    cout << "Account balance: " << bal << endl;
+    cout << "Amount to send: " << amount << endl;
+    if (bal + from->getOverdraft() > amount) {
+        wstring fromFile = to_wstring(from->getId()) + L"'" + to_wstring(to->getId()) + L"'" + to_wstring(nowTime) + L".txt";
+        wstring toFile = to_wstring(to->getId()) + L"'" + to_wstring(from->getId()) + L"'" + to_wstring(nowTime) + L".txt";
+        seal::Ciphertext creditCipher;
+        double scale = pow(2, 20);
+        seal::Encryptor encryptor(*context, secret_keyTo);
+        string toKeyAddress = to->getKeyAddress();
+        zeroPool->encrypt(toKeyAddress, -amount, scale, encoder, encryptor, creditCipher);
+        // Payees of recurring debits tend to be paid many times in one firing, so their pool is kept warm from now on
+        zeroPool->track(toKeyAddress, make_shared<seal::SecretKey>(secret_keyTo));
+        wstring fromBalance = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(from->getBalanceAddress());
+        wstring toBalance = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(to->getBalanceAddress());
+        status_code code = sendTransferToCloud(fromBalance, toBalance, fromFile, toFile, ciphertext, creditCipher, deadline);
+        wcout << code << endl;
+        if (code == status_codes::OK) {
+            // The log writer has its own session, so workers' rows share commits instead of queueing on dbMutex
+            if (!dat->logTransaction(from, to, nowTime)) {
+                // The money has moved, so the debit still counts as paid
+                cout << "Could not record direct debit " << d->getId() << " in the transaction history." << endl;
             }
-            set<DirectDebit*> debits = debitList->getDebits();
-            for (DirectDebit* d : debits) {
-                time_t nowTime = time(nullptr);
-                wcout << "Next time to act: " << d->getTimeSet() << endl;
-                wcout << "Time now: " << nowTime << endl;
-                if (d->getTimeSet() <= nowTime) {
-                    string keyAddress = d->getFrom()->getKeyAddress();
-                    cout <<"Key address: " <<  keyAddress << endl;
-                    std::ifstream keyIn(keyAddress, std::ios::binary);
-                    seal::SecretKey secret_keyFrom;
-                    seal::SecretKey secret_keyTo;
-                    secret_keyFrom.load(*context, keyIn);
-                    keyIn.close();
-                    ifstream keyInTo(d->getTo()->getKeyAddress(), std::ios::binary);
-                    secret_keyTo.load(*context, keyInTo);
-                    keyInTo.close();
-                    string address = d->getAmountAddress();
-                    wstring toSend = wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(address);
-                    seal::Ciphertext ciphertext, fromBal, toBal;
-                    getAmount(toSend, ciphertext);
-                    seal::Decryptor decryptor(*context, secret_keyFrom);
-                    seal::CKKSEncoder encoder(*context);
-                    seal::Plaintext plaintext;
-                    decryptor.decrypt(ciphertext, plaintext);
-                    vector<double> res1, res2;
-                    encoder.decode(plaintext, res1);
-                    double amount = res1[0];
-                    Account* from = d->getFrom();
-                    Account* to = d->getTo();
-                    string fromAddress = from->getBalanceAddress();
-                    toSend = wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(fromAddress);
-                    getAmount(toSend, fromBal);
-                    decryptor.decrypt(fromBal, plaintext);
-                    encoder.decode(plaintext, res2);
-                    double bal = res2[0];
-                    cout << "Account balance: " << bal << endl;
-                    cout << "Amount to send: " << amount << endl;
-                    if (bal + from->getOverdraft() > amount) {
-                        http_client client(cloudDNS + L":8081/transfer");
-                        wstring wAddress = to_wstring(from->getId()) + L"'" + to_wstring(to->getId()) + L"'" + to_wstring(nowTime) + L".txt";
-                        wcout << wAddress << endl;
-                        std::ofstream outFile(address, std::ios::binary);
-                        ciphertext.save(outFile);
-                        outFile.close();
-                        wstring toSendFile = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(from->getBalanceAddress()) + L"," + std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(to->getBalanceAddress()) + L"," + wAddress;
-                        auto f = file_stream<char>::open_istream(std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(address), std::ios::binary).get();
-                        auto response = client.request(methods::PUT, toSendFile, f.streambuf());
-                        wcout << response.get().status_code();
-                        wAddress = to_wstring(to->getId()) + L"'" + to_wstring(from->getId()) + L"'" + to_wstring(nowTime) + L".txt";
-                        toSendFile = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(to->getBalanceAddress()) + L"," + std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(from->getBalanceAddress()) + L"," + wAddress;
-                        amount = -amount;
-                        double scale = pow(2, 20);
-                        encoder.encode(amount, scale, plaintext);
-                        seal::Encryptor encryptor(*context, secret_keyTo);
-                        encryptor.encrypt_symmetric(plaintext, ciphertext);
-                        ofstream outFile2(wAddress, std::ios::binary);
-                        ciphertext.save(outFile2);
-                        outFile2.close();
-                        f = file_stream<char>().open_istream(wAddress, std::ios::binary).get();
-                        response = client.request(methods::PUT, toSendFile, f.streambuf());
-                        wcout << response.get().status_code() << endl;
-                        if (response.get().status_code() == status_codes::OK) {
-                            dat->logTransaction(from, to, nowTime);
-                            cout << "Successful direct debit from " << from->getId() << " to " << to->getId() << " for amount " << (char)156 << -amount << "." << endl << endl;
-                            _sleep(1000);
+            cout << "Successful direct debit from " << from->getId() << " to " << to->getId() << " for amount " << (char)156 << amount << "." << endl << endl;
+        }
+        return code;
+    }
+    else {
+        std::wcout << "Deleting direct debit " << d->getId() << " as user " << from->getId() << " does not have the sufficient balance" << endl << endl;
+        lock_guard<mutex> lock(dbMutex);
+        dat->removeDebit(d->getId());
+        return status_codes::PaymentRequired;
+    }
+}
+
+// Loads and carries out one due debit while holding both of its account locks, then schedules its next firing. Returns true if money moved
+bool runDebit(int debitID) {
+    Deadline deadline = Deadline::after(chrono::milliseconds(debitConfig.debitBudgetMs));
+    DirectDebit* d = nullptr;
+    try {
+        lock_guard<mutex> lock(dbMutex);
+        d = dat->getDebit(debitID, *context);
+    }
+    catch (exception& e) {
+        // The debit may well still exist, so a failed lookup is retried like a failed transfer instead of dropping the standing order
+        cout << "Could not load direct debit " << debitID << ": " << e.what() << endl;
+        scheduler->schedule(debitID, time(nullptr) + 5);
+        return false;
+    }
+    if (d == nullptr) {
+        // Deleted since it was scheduled
+        return false;
+    }
+    status_code code = status_codes::InternalError;
+    try {
+        AccountPairLock accounts(d->getFrom()->getId(), d->getTo()->getId());
+        rateLimiter.acquire();
+        deadline.check("debit queue");
+        code = executeDebit(d, reserveTimestamp(d->getFrom()->getId(), d->getTo()->getId()), deadline);
+    }
+    catch (exception& e) {
+        std::wcout << e.what() << endl;
+    }
+    time_t nowTime = time(nullptr);
+    if (code == status_codes::OK) {
+        d->setNewTime(cron::cron_next(d->getRegularity(), nowTime));
+        {
+            lock_guard<mutex> lock(dbMutex);
+            dat->updateDebits(d);
+        }
+        scheduler->schedule(d->getId(), d->getTimeSet());
+    }
+    else if (code != status_codes::PaymentRequired) {
+        // Cloud refused or failed the transfer, try again shortly rather than skipping this payment
+        scheduler->schedule(d->getId(), nowTime + 5);
+    }
+    delete d->getFrom();
+    delete d->getTo();
+    delete d;
+    return code == status_codes::OK;
+}
+
+// Main workhorse program for processing direct debits. Sleeps until the scheduler reports debits due, then shares them between a pool of workers.
+// Debits from different payers run concurrently; debits touching the same account wait for each other so overdraft checks see the latest balance
+void processDebits(DBHandler* dat, DebitScheduler* scheduler) {
+    while (true) {
+        vector<int> due = scheduler->waitForDue();
+        if (due.empty()) {
+            return;
+        }
+        auto start = chrono::steady_clock::now();
+        atomic<size_t> next = 0;
+        atomic<int> succeeded = 0;
+        int workerCount = min((int)due.size(), debitConfig.workers);
+        vector<thread> workers;
+        for (int w = 0; w < workerCount; w++) {
+            workers.push_back(thread([&]() {
+                for (size_t i = next++; i < due.size(); i = next++) {
+                    try {
+                        if (runDebit(due[i])) {
+                            succeeded++;
                         }
                     }
-                    else {
-                        std::wcout << "Deleting direct debit " << d->getId() << " as user " << from->getId() << " does not have the sufficient balance" << endl << endl;
-                        dat->removeDebit(d->getId());
+                    catch (exception& e) {
+                        std::wcout << e.what() << endl;
                     }
-                    delete from;
-                    delete to;
                 }
-                debitList->removeDebit(d);
-            }
-            _sleep(999);
+            }));
+        }
+        for (thread& t : workers) {
+            t.join();
+        }
+        auto makespan = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+        cout << "Firing of " << due.size() << " direct debits finished in " << makespan << "ms with " << workerCount << " workers. "
+            << succeeded << " succeeded, " << scheduler->size() << " debits scheduled" << endl;
+        dat->printLogMetrics();
+        DeadlineExceeded::printMetrics();
+        zeroPool->printMetrics();
+        cout << endl;
+    }
+}
+
+// Receives schedule changes from the central server. POST /id,timeSet adds or moves a debit, DEL /id removes it
+bool scheduleDebit(http_request request) {
+    try {
+        wstring ip = request.get_remote_address();
+        if (ip.compare(serverIP) != 0 && ip.compare(L"127.0.0.1") != 0 && ip.compare(L"::1") != 0) {
+            request.reply(status_codes::Forbidden, L"Not authorised to make request");
+            return false;
         }
+        wstring uri = request.relative_uri().to_string();
+        uri = uri.substr(1, uri.length());
+        if (request.method() == methods::DEL) {
+            scheduler->cancel(stoi(uri));
+        }
+        else {
+            int index = uri.find_first_of(L",");
+            scheduler->schedule(stoi(uri.substr(0, index)), stoll(uri.substr(index + 1, uri.length())));
+        }
+        request.reply(status_codes::OK);
+        return true;
     }
     catch (exception& e) {
-        std::wcout << e.what() << endl;
+        cout << e.what() << endl;
+        request.reply(status_codes::BadRequest);
+        return false;
     }
 }
 
@@ -180,11 +444,31 @@ int main()
             context = new seal::SEALContext(con);
             cout << "Context copied" << endl;
         } while (false);
-        dat->connectToDB();
+        StorageBackend* store = nullptr;
+        if (debitConfig.inMemory) {
+            cout << "backend=memory is for benchmarks. The central server does not share this store, so no debits will be scheduled." << endl;
+            store = new MemoryBackend("memorySeed.txt");
+        }
+        else {
+            store = new MySQLBackend(debitConfig.statementTimeoutMs);
+        }
+        dat->connectToDB(store, debitConfig.logDurability, debitConfig.logBatchSize, debitConfig.logMaxQueued, debitConfig.logFlushMs);
         cout << "DB Connected to" << endl;
-        while (true) {
-            processDebits(dat, tran);
+        zeroPool = new ZeroPool(*context, debitConfig.zeroPoolDepth, debitConfig.zeroPoolAccounts);
+        for (auto const& [debitID, timeSet] : dat->getDebitSchedule()) {
+            scheduler->schedule(debitID, timeSet);
         }
+        cout << scheduler->size() << " direct debits scheduled" << endl;
+
+        http_listener scheduleListener(serverDNS + L":8082/schedule");
+        scheduleListener.support(methods::POST, scheduleDebit);
+        scheduleListener.support(methods::DEL, scheduleDebit);
+        scheduleListener
+            .open()
+            .then([&scheduleListener]() {wcout << (L"Starting to listen for debit schedule changes") << endl; })
+            .wait();
+
+        processDebits(dat, scheduler);
     }
     catch (exception& e) {
         cout << e.what() << endl;
@@ -193,6 +477,8 @@ int main()
     delete debits;
     delete tran;
     delete dat;
+    delete scheduler;
+    delete zeroPool;
     delete params;
     delete context;
 }
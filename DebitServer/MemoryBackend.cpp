@@ -0,0 +1,235 @@
+#include "MemoryBackend.h"
+#include <climits>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+MemoryBackend::MemoryBackend(std::string seedFile) {
+	this->seedFile = seedFile;
+	this->nextAccountID = 1;
+	this->nextTransactionID = 1;
+	this->nextDebitID = 1;
+	this->reads = 0;
+	this->writes = 0;
+}
+
+void MemoryBackend::open() {
+	std::ifstream inFile(seedFile);
+	if (!inFile.is_open()) {
+		throw std::runtime_error("Could not open account seed file " + seedFile);
+	}
+	std::string line;
+	while (getline(inFile, line)) {
+		if (line.empty()) {
+			continue;
+		}
+		std::stringstream fields(line);
+		AccountRow row;
+		std::string overdraft, pin;
+		getline(fields, row.firstName, ',');
+		getline(fields, row.lastName, ',');
+		getline(fields, row.balanceAddress, ',');
+		getline(fields, row.keyAddress, ',');
+		getline(fields, overdraft, ',');
+		getline(fields, pin, ',');
+		row.overdraft = stod(overdraft);
+		row.pin = stoull(pin);
+		insertAccount(row);
+	}
+	std::cout << "Loaded " << accounts.size() << " accounts into the in-memory store" << std::endl;
+}
+
+void MemoryBackend::close() {
+}
+
+int MemoryBackend::insertAccount(AccountRow row) {
+	std::unique_lock<std::shared_mutex> guard(lock);
+	row.id = nextAccountID++;
+	accounts[row.id] = row;
+	writes++;
+	return row.id;
+}
+
+std::vector<AccountRow> MemoryBackend::getAccounts() {
+	std::shared_lock<std::shared_mutex> guard(lock);
+	reads++;
+	std::vector<AccountRow> rows;
+	for (auto& [id, row] : accounts) {
+		rows.push_back(row);
+	}
+	return rows;
+}
+
+std::vector<AccountRow> MemoryBackend::getAccounts(const std::vector<int>& ids) {
+	std::shared_lock<std::shared_mutex> guard(lock);
+	reads++;
+	std::vector<AccountRow> rows;
+	std::set<int> seen;
+	for (int id : ids) {
+		auto found = accounts.find(id);
+		if (found != accounts.end() && seen.insert(id).second) {
+			rows.push_back(found->second);
+		}
+	}
+	return rows;
+}
+
+bool MemoryBackend::getAccount(int id, AccountRow& row) {
+	std::shared_lock<std::shared_mutex> guard(lock);
+	reads++;
+	auto found = accounts.find(id);
+	if (found == accounts.end()) {
+		return false;
+	}
+	row = found->second;
+	return true;
+}
+
+std::vector<TransactionRow> MemoryBackend::getTransactions(int ownerID) {
+	std::shared_lock<std::shared_mutex> guard(lock);
+	reads++;
+	std::vector<TransactionRow> rows;
+	auto owner = transactionsByOwner.find(ownerID);
+	if (owner != transactionsByOwner.end()) {
+		for (auto& [key, row] : owner->second) {
+			rows.push_back(row);
+		}
+	}
+	return rows;
+}
+
+std::vector<TransactionRow> MemoryBackend::getTransactionPage(int ownerID, time_t fromTime, time_t toTime, time_t afterTime, int afterID, size_t limit) {
+	std::shared_lock<std::shared_mutex> guard(lock);
+	reads++;
+	std::vector<TransactionRow> rows;
+	auto owner = transactionsByOwner.find(ownerID);
+	if (owner == transactionsByOwner.end()) {
+		return rows;
+	}
+	// Start from whichever of the range start and the cursor comes later
+	std::pair<time_t, int> after = std::make_pair(afterTime, afterID);
+	std::pair<time_t, int> from = std::make_pair(fromTime, INT_MIN);
+	auto it = after >= from ? owner->second.upper_bound(after) : owner->second.lower_bound(from);
+	for (; it != owner->second.end() && it->first.first <= toTime && rows.size() < limit; ++it) {
+		rows.push_back(it->second);
+	}
+	return rows;
+}
+
+void MemoryBackend::insertTransactions(const std::vector<LogRecord>& records) {
+	std::unique_lock<std::shared_mutex> guard(lock);
+	// Checked up front, like the foreign keys, so a bad record leaves the whole batch unwritten
+	for (const LogRecord& r : records) {
+		if (!accounts.contains(r.ownerID) || !accounts.contains(r.otherID)) {
+			throw std::runtime_error("Transaction refers to an unknown account");
+		}
+	}
+	for (const LogRecord& r : records) {
+		int id = nextTransactionID++;
+		transactionsByOwner[r.ownerID][std::make_pair(r.time, id)] = TransactionRow{ id, r.time, r.type, r.amount, r.ownerID, r.otherID };
+	}
+	writes++;
+}
+
+int MemoryBackend::insertDebit(const DebitRow& row) {
+	std::unique_lock<std::shared_mutex> guard(lock);
+	if (!accounts.contains(row.ownerID) || !accounts.contains(row.otherID)) {
+		throw std::runtime_error("Direct debit refers to an unknown account");
+	}
+	DebitRow stored = row;
+	stored.debitID = nextDebitID++;
+	debits[stored.debitID] = stored;
+	debitsByOwner[stored.ownerID].insert(stored.debitID);
+	writes++;
+	return stored.debitID;
+}
+
+std::vector<DebitRow> MemoryBackend::getDebits() {
+	std::shared_lock<std::shared_mutex> guard(lock);
+	reads++;
+	std::vector<DebitRow> rows;
+	for (auto& [id, row] : debits) {
+		rows.push_back(row);
+	}
+	return rows;
+}
+
+std::vector<std::pair<int, time_t>> MemoryBackend::getDebitSchedule() {
+	std::shared_lock<std::shared_mutex> guard(lock);
+	reads++;
+	std::vector<std::pair<int, time_t>> schedule;
+	for (auto& [id, row] : debits) {
+		schedule.push_back(std::make_pair(id, row.timeSet));
+	}
+	return schedule;
+}
+
+std::vector<DebitRow> MemoryBackend::getDebitsByOwner(int ownerID) {
+	std::shared_lock<std::shared_mutex> guard(lock);
+	reads++;
+	std::vector<DebitRow> rows;
+	auto owner = debitsByOwner.find(ownerID);
+	if (owner != debitsByOwner.end()) {
+		for (int id : owner->second) {
+			rows.push_back(debits.at(id));
+		}
+	}
+	return rows;
+}
+
+bool MemoryBackend::getDebit(int debitID, DebitRow& row) {
+	std::shared_lock<std::shared_mutex> guard(lock);
+	reads++;
+	auto found = debits.find(debitID);
+	if (found == debits.end()) {
+		return false;
+	}
+	row = found->second;
+	return true;
+}
+
+void MemoryBackend::setDebitTime(int debitID, time_t timeSet) {
+	std::unique_lock<std::shared_mutex> guard(lock);
+	auto found = debits.find(debitID);
+	if (found != debits.end()) {
+		found->second.timeSet = timeSet;
+	}
+	writes++;
+}
+
+void MemoryBackend::removeDebit(int debitID) {
+	std::unique_lock<std::shared_mutex> guard(lock);
+	auto found = debits.find(debitID);
+	if (found != debits.end()) {
+		debitsByOwner[found->second.ownerID].erase(debitID);
+		debits.erase(found);
+	}
+	writes++;
+}
+
+long long MemoryBackend::reserveIDs(const std::string& sequence, long long count) {
+	std::unique_lock<std::shared_mutex> guard(lock);
+	auto found = sequences.find(sequence);
+	if (found == sequences.end()) {
+		found = sequences.insert(std::make_pair(sequence, (long long)nextTransactionID)).first;
+	}
+	long long first = found->second;
+	found->second += count;
+	writes++;
+	return first;
+}
+
+void MemoryBackend::printMetrics() {
+	size_t accountCount = 0, debitCount = 0;
+	int transactionCount = 0;
+	{
+		std::shared_lock<std::shared_mutex> guard(lock);
+		accountCount = accounts.size();
+		debitCount = debits.size();
+		transactionCount = nextTransactionID - 1;
+	}
+	std::cout << "In-memory store: " << accountCount << " accounts, " << transactionCount << " transactions, " << debitCount << " debits, "
+		<< reads << " reads, " << writes << " writes" << std::endl;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include "StorageBackend.h"
+#include <atomic>
+#include <map>
+#include <set>
+#include <shared_mutex>
+#include <utility>
+
+/* In-process store with the same indexes as bankDB.sql: accounts by ID, transactions by (owner, time, ID) and debits by
+(owner, ID). Nothing is persisted. Accounts are loaded on open() from a seed file with one account per line:
+firstName,lastName,balanceAddress,keyAddress,overdraft,pin. For benchmarking only: it lets a server run without a DBMS,
+or be profiled without database latency. Each process has its own store, so the central server and the debit server
+cannot see each other's debits; the central server turns its debit routes away while this store is in use.*/
+class MemoryBackend : public StorageBackend {
+private:
+	std::string seedFile;
+	std::map<int, AccountRow> accounts;
+	std::map<int, std::map<std::pair<time_t, int>, TransactionRow>> transactionsByOwner;
+	std::map<int, DebitRow> debits;
+	std::map<int, std::set<int>> debitsByOwner;
+	std::map<std::string, long long> sequences;
+	int nextAccountID;
+	int nextTransactionID;
+	int nextDebitID;
+	std::shared_mutex lock;
+
+	std::atomic<long long> reads;
+	std::atomic<long long> writes;
+
+public:
+	MemoryBackend(std::string seedFile);
+
+	void open() override;
+
+	void close() override;
+
+	/* Adds an account and returns its ID.*/
+	int insertAccount(AccountRow row);
+
+	std::vector<AccountRow> getAccounts() override;
+
+	std::vector<AccountRow> getAccounts(const std::vector<int>& ids) override;
+
+	bool getAccount(int id, AccountRow& row) override;
+
+	std::vector<TransactionRow> getTransactions(int ownerID) override;
+
+	std::vector<TransactionRow> getTransactionPage(int ownerID, time_t fromTime, time_t toTime, time_t afterTime, int afterID, size_t limit) override;
+
+	void insertTransactions(const std::vector<LogRecord>& records) override;
+
+	int insertDebit(const DebitRow& row) override;
+
+	std::vector<DebitRow> getDebits() override;
+
+	std::vector<std::pair<int, time_t>> getDebitSchedule() override;
+
+	std::vector<DebitRow> getDebitsByOwner(int ownerID) override;
+
+	bool getDebit(int debitID, DebitRow& row) override;
+
+	void setDebitTime(int debitID, time_t timeSet) override;
+
+	void removeDebit(int debitID) override;
+
+	long long reserveIDs(const std::string& sequence, long long count) override;
+
+	void printMetrics() override;
+};
@@ -0,0 +1,251 @@
+#include "MySQLBackend.h"
+#include <iostream>
+using namespace mysqlx;
+
+MySQLBackend::MySQLBackend(int statementTimeoutMs) {
+	this->statementTimeoutMs = statementTimeoutMs;
+	this->session = nullptr;
+	this->schema = nullptr;
+	this->accounts = nullptr;
+	this->transactions = nullptr;
+	this->debits = nullptr;
+	this->logSession = nullptr;
+	this->logTransactions = nullptr;
+}
+
+MySQLBackend::~MySQLBackend() {
+	close();
+}
+
+Session* MySQLBackend::connect() {
+	Session* s = new Session(mysqlx::SessionOption::USER, "root",
+		mysqlx::SessionOption::PWD, "admin",
+		mysqlx::SessionOption::HOST, "localhost",
+		mysqlx::SessionOption::PORT, 33060,
+		mysqlx::SessionOption::DB, "bankdb",
+		mysqlx::SessionOption::CONNECT_TIMEOUT, (unsigned)statementTimeoutMs
+	);
+	// The server aborts any read on this session that runs longer, so one slow query cannot stall a debit firing
+	s->sql("SET SESSION max_execution_time = " + std::to_string(statementTimeoutMs)).execute();
+	return s;
+}
+
+// Row layouts follow bankDB.sql
+AccountRow MySQLBackend::toAccount(Row& row) {
+	return AccountRow{ (int)row.get(0), (std::string)row.get(1), (std::string)row.get(2), (std::string)row.get(3), (std::string)row.get(4), (double)row.get(5), (size_t)row.get(6) };
+}
+
+TransactionRow MySQLBackend::toTransaction(Row& row) {
+	return TransactionRow{ (int)row.get(0), (time_t)row.get(1), (std::string)row.get(2), (std::string)row.get(3), (int)row.get(4), (int)row.get(5) };
+}
+
+DebitRow MySQLBackend::toDebit(Row& row) {
+	return DebitRow{ (int)row.get(0), (int)row.get(1), (int)row.get(2), (std::string)row.get(3), (std::string)row.get(4), (time_t)row.get(5) };
+}
+
+void MySQLBackend::open() {
+	session = connect();
+	schema = new Schema(*session, "bankdb");
+	accounts = new Table(*schema, "accounts");
+	transactions = new Table(*schema, "transactions");
+	debits = new Table(*schema, "direct_debits");
+	logSession = connect();
+	logTransactions = new Table(Schema(*logSession, "bankdb"), "transactions");
+}
+
+// Tables are freed before the schema and session they were opened from
+void MySQLBackend::close() {
+	delete logTransactions;
+	logTransactions = nullptr;
+	if (logSession != nullptr) {
+		logSession->close();
+		delete logSession;
+		logSession = nullptr;
+	}
+	delete debits;
+	debits = nullptr;
+	delete transactions;
+	transactions = nullptr;
+	delete accounts;
+	accounts = nullptr;
+	delete schema;
+	schema = nullptr;
+	if (session != nullptr) {
+		session->close();
+		delete session;
+		session = nullptr;
+	}
+}
+
+std::vector<AccountRow> MySQLBackend::getAccounts() {
+	std::lock_guard<std::mutex> guard(lock);
+	std::vector<AccountRow> rows;
+	RowResult result = accounts->select("*").orderBy("id").execute();
+	for (Row row : result) {
+		rows.push_back(toAccount(row));
+	}
+	return rows;
+}
+
+std::vector<AccountRow> MySQLBackend::getAccounts(const std::vector<int>& ids) {
+	std::vector<AccountRow> rows;
+	if (ids.empty()) {
+		return rows;
+	}
+	std::string idList = "";
+	for (int id : ids) {
+		if (!idList.empty()) {
+			idList += ",";
+		}
+		idList += std::to_string(id);
+	}
+	std::lock_guard<std::mutex> guard(lock);
+	RowResult result = accounts->select("*").where("id IN (" + idList + ")").execute();
+	for (Row row : result) {
+		rows.push_back(toAccount(row));
+	}
+	return rows;
+}
+
+bool MySQLBackend::getAccount(int id, AccountRow& row) {
+	std::lock_guard<std::mutex> guard(lock);
+	RowResult acc = accounts->select("*").where("id = :id").bind("id", id).execute();
+	if (acc.count() != 1) {
+		return false;
+	}
+	Row r = acc.fetchOne();
+	row = toAccount(r);
+	return true;
+}
+
+std::vector<TransactionRow> MySQLBackend::getTransactions(int ownerID) {
+	std::lock_guard<std::mutex> guard(lock);
+	std::vector<TransactionRow> rows;
+	RowResult result = transactions->select("*").where("transactionOwnerID = :owner").orderBy("transactionTime").bind("owner", ownerID).execute();
+	for (Row row : result) {
+		rows.push_back(toTransaction(row));
+	}
+	return rows;
+}
+
+std::vector<TransactionRow> MySQLBackend::getTransactionPage(int ownerID, time_t fromTime, time_t toTime, time_t afterTime, int afterID, size_t limit) {
+	std::lock_guard<std::mutex> guard(lock);
+	std::vector<TransactionRow> rows;
+	RowResult result = transactions->select("*").where("transactionOwnerID = :owner AND transactionTime >= :fromTime AND transactionTime <= :toTime "
+		"AND (transactionTime > :afterTime OR (transactionTime = :afterTime AND transactionID > :afterID))")
+		.orderBy("transactionTime", "transactionID").limit(limit)
+		.bind("owner", ownerID).bind("fromTime", fromTime).bind("toTime", toTime).bind("afterTime", afterTime).bind("afterID", afterID).execute();
+	for (Row row : result) {
+		rows.push_back(toTransaction(row));
+	}
+	return rows;
+}
+
+void MySQLBackend::insertTransactions(const std::vector<LogRecord>& records) {
+	std::lock_guard<std::mutex> guard(logLock);
+	logSession->startTransaction();
+	try {
+		auto insert = logTransactions->insert("transactionTime", "transactionType", "amount", "transactionOwnerID", "otherAccountID");
+		for (const LogRecord& r : records) {
+			insert.values(r.time, r.type, r.amount, r.ownerID, r.otherID);
+		}
+		insert.execute();
+		logSession->commit();
+	}
+	catch (std::exception& e) {
+		logSession->rollback();
+		throw;
+	}
+}
+
+int MySQLBackend::insertDebit(const DebitRow& row) {
+	std::lock_guard<std::mutex> guard(lock);
+	session->startTransaction();
+	try {
+		Result res = debits->insert("transactionOwnerID", "otherAccountID", "amount", "regularity", "timeSet").values(row.ownerID, row.otherID, row.amount, row.regularity, row.timeSet).execute();
+		session->commit();
+		return (int)res.getAutoIncrementValue();
+	}
+	catch (std::exception& e) {
+		session->rollback();
+		throw;
+	}
+}
+
+std::vector<DebitRow> MySQLBackend::getDebits() {
+	std::lock_guard<std::mutex> guard(lock);
+	std::vector<DebitRow> rows;
+	RowResult result = debits->select("*").execute();
+	for (Row row : result) {
+		rows.push_back(toDebit(row));
+	}
+	return rows;
+}
+
+std::vector<std::pair<int, time_t>> MySQLBackend::getDebitSchedule() {
+	std::lock_guard<std::mutex> guard(lock);
+	std::vector<std::pair<int, time_t>> schedule;
+	RowResult result = debits->select("debitID", "timeSet").execute();
+	for (Row row : result) {
+		schedule.push_back(std::make_pair((int)row.get(0), (time_t)row.get(1)));
+	}
+	return schedule;
+}
+
+std::vector<DebitRow> MySQLBackend::getDebitsByOwner(int ownerID) {
+	std::lock_guard<std::mutex> guard(lock);
+	std::vector<DebitRow> rows;
+	RowResult result = debits->select("*").where("transactionOwnerID = :owner").orderBy("debitID").bind("owner", ownerID).execute();
+	for (Row row : result) {
+		rows.push_back(toDebit(row));
+	}
+	return rows;
+}
+
+bool MySQLBackend::getDebit(int debitID, DebitRow& row) {
+	std::lock_guard<std::mutex> guard(lock);
+	RowResult deb = debits->select("*").where("debitID = :id").bind("id", debitID).execute();
+	if (deb.count() != 1) {
+		return false;
+	}
+	Row r = deb.fetchOne();
+	row = toDebit(r);
+	return true;
+}
+
+void MySQLBackend::setDebitTime(int debitID, time_t timeSet) {
+	std::lock_guard<std::mutex> guard(lock);
+	session->startTransaction();
+	try {
+		debits->update().set("timeSet", timeSet).where("debitID = :id").bind("id", debitID).execute();
+		session->commit();
+	}
+	catch (std::exception& e) {
+		session->rollback();
+		throw;
+	}
+}
+
+void MySQLBackend::removeDebit(int debitID) {
+	std::lock_guard<std::mutex> guard(lock);
+	session->startTransaction();
+	try {
+		debits->remove().where("debitID = :debitID").bind("debitID", debitID).execute();
+		session->commit();
+	}
+	catch (std::exception& e) {
+		session->rollback();
+		throw;
+	}
+}
+
+long long MySQLBackend::reserveIDs(const std::string& sequence, long long count) {
+	std::lock_guard<std::mutex> guard(lock);
+	session->sql("INSERT IGNORE INTO id_sequences (name, nextValue) SELECT ?, COALESCE(MAX(transactionID), 0) + 1 FROM transactions").bind(sequence).execute();
+	session->sql("UPDATE id_sequences SET nextValue = LAST_INSERT_ID(nextValue + ?) WHERE name = ?").bind(count, sequence).execute();
+	SqlResult last = session->sql("SELECT LAST_INSERT_ID()").execute();
+	return (int64_t)last.fetchOne().get(0) - count;
+}
+
+void MySQLBackend::printMetrics() {
+}
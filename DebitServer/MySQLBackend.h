@@ -0,0 +1,64 @@
+#pragma once
+#include "StorageBackend.h"
+#include <mysqlx/xdevapi.h>
+#include <mutex>
+
+/* Storage in the bankdb MySQL schema over the X DevAPI. Calls share one session, taken in turn.
+Transaction rows go through a second session so the log writer never waits behind the debit workers.*/
+class MySQLBackend : public StorageBackend {
+private:
+	mysqlx::Session* session;
+	mysqlx::Schema* schema;
+	mysqlx::Table* accounts;
+	mysqlx::Table* transactions;
+	mysqlx::Table* debits;
+	mysqlx::Session* logSession;
+	mysqlx::Table* logTransactions;
+	std::mutex lock;
+	std::mutex logLock;
+	int statementTimeoutMs;
+
+	mysqlx::Session* connect();
+	static AccountRow toAccount(mysqlx::Row& row);
+	static TransactionRow toTransaction(mysqlx::Row& row);
+	static DebitRow toDebit(mysqlx::Row& row);
+
+public:
+	MySQLBackend(int statementTimeoutMs);
+
+	~MySQLBackend();
+
+	void open() override;
+
+	void close() override;
+
+	std::vector<AccountRow> getAccounts() override;
+
+	std::vector<AccountRow> getAccounts(const std::vector<int>& ids) override;
+
+	bool getAccount(int id, AccountRow& row) override;
+
+	std::vector<TransactionRow> getTransactions(int ownerID) override;
+
+	std::vector<TransactionRow> getTransactionPage(int ownerID, time_t fromTime, time_t toTime, time_t afterTime, int afterID, size_t limit) override;
+
+	void insertTransactions(const std::vector<LogRecord>& records) override;
+
+	int insertDebit(const DebitRow& row) override;
+
+	std::vector<DebitRow> getDebits() override;
+
+	std::vector<std::pair<int, time_t>> getDebitSchedule() override;
+
+	std::vector<DebitRow> getDebitsByOwner(int ownerID) override;
+
+	bool getDebit(int debitID, DebitRow& row) override;
+
+	void setDebitTime(int debitID, time_t timeSet) override;
+
+	void removeDebit(int debitID) override;
+
+	long long reserveIDs(const std::string& sequence, long long count) override;
+
+	void printMetrics() override;
+};
@@ -0,0 +1,88 @@
+#pragma once
+#include "TransactionLogWriter.h"
+#include <ctime>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Plain copies of the bankdb rows, so DBHandler can build its objects without knowing where the rows came from.*/
+struct AccountRow {
+	int id;
+	std::string firstName;
+	std::string lastName;
+	std::string balanceAddress;
+	std::string keyAddress;
+	double overdraft;
+	size_t pin;
+};
+
+struct TransactionRow {
+	int transactionID;
+	time_t time;
+	std::string type;
+	std::string amount;
+	int ownerID;
+	int otherID;
+};
+
+struct DebitRow {
+	int debitID;
+	int ownerID;
+	int otherID;
+	std::string amount;
+	std::string regularity;
+	time_t timeSet;
+};
+
+/* The storage operations DBHandler needs. Every method may be called from several threads at once.
+Failures are thrown as exceptions after any open DB transaction has been rolled back.*/
+class StorageBackend {
+public:
+	virtual ~StorageBackend() = default;
+
+	/* Connects or loads the store. Throws if it cannot be opened.*/
+	virtual void open() = 0;
+
+	virtual void close() = 0;
+
+	/* Every account ordered by ID.*/
+	virtual std::vector<AccountRow> getAccounts() = 0;
+
+	/* The listed accounts in no particular order. Unknown IDs are skipped.*/
+	virtual std::vector<AccountRow> getAccounts(const std::vector<int>& ids) = 0;
+
+	/* Returns false if the account does not exist.*/
+	virtual bool getAccount(int id, AccountRow& row) = 0;
+
+	/* An account's transactions ordered by time.*/
+	virtual std::vector<TransactionRow> getTransactions(int ownerID) = 0;
+
+	/* At most limit transactions in [fromTime, toTime] after the (afterTime, afterID) cursor, ordered by time then ID.*/
+	virtual std::vector<TransactionRow> getTransactionPage(int ownerID, time_t fromTime, time_t toTime, time_t afterTime, int afterID, size_t limit) = 0;
+
+	/* Inserts every record in one commit. Nothing is written if any insert fails.*/
+	virtual void insertTransactions(const std::vector<LogRecord>& records) = 0;
+
+	/* Inserts a debit, ignoring row.debitID, and returns the ID it was given.*/
+	virtual int insertDebit(const DebitRow& row) = 0;
+
+	virtual std::vector<DebitRow> getDebits() = 0;
+
+	/* The ID and next firing time of every debit, without the rest of each row.*/
+	virtual std::vector<std::pair<int, time_t>> getDebitSchedule() = 0;
+
+	/* A single owner's debits ordered by ID.*/
+	virtual std::vector<DebitRow> getDebitsByOwner(int ownerID) = 0;
+
+	/* Returns false if the debit does not exist.*/
+	virtual bool getDebit(int debitID, DebitRow& row) = 0;
+
+	virtual void setDebitTime(int debitID, time_t timeSet) = 0;
+
+	virtual void removeDebit(int debitID) = 0;
+
+	/* Takes count consecutive values from a named sequence and returns the first. The "transfer" sequence starts after the highest transaction ID.*/
+	virtual long long reserveIDs(const std::string& sequence, long long count) = 0;
+
+	virtual void printMetrics() = 0;
+};
@@ -0,0 +1,86 @@
+#pragma once
+#include <pplx/pplxtasks.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* One row of the transactions table.*/
+struct LogRecord {
+	time_t time;
+	std::string type;
+	std::string amount;
+	int ownerID;
+	int otherID;
+};
+
+/* Flush: append()'s task completes once the records are committed, with the commit's result.
+Enqueue: append()'s task completes once the records are queued. A crash can lose at most the queue, which holds maxQueued records
+and is flushed at least every maxDelay.*/
+enum class LogDurability { Flush, Enqueue };
+
+/* Collects transaction rows from every handler thread and writes them from a single thread, many appends to one
+multi-row insert and one commit. The records passed to one append() always land in the same commit.*/
+class TransactionLogWriter {
+private:
+	struct Pending {
+		std::vector<LogRecord> records;
+		std::chrono::steady_clock::time_point queued;
+		pplx::task_completion_event<bool> done; // Only waited on in Flush mode
+	};
+
+	std::function<bool(const std::vector<LogRecord>&)> write;
+	LogDurability durability;
+	size_t maxBatch;
+	size_t maxQueued;
+	std::chrono::milliseconds maxDelay;
+
+	std::deque<Pending> queue;
+	size_t queuedRecords;
+	size_t inFlight;
+	bool stopping;
+	bool flushing;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable drained;
+	std::thread worker;
+
+	std::atomic<long long> appends;
+	std::atomic<long long> batches;
+	std::atomic<long long> recordsWritten;
+	std::atomic<long long> failures;
+	std::atomic<long long> dropped;
+	std::atomic<long long> totalFlushMicros;
+	std::atomic<long long> maxFlushMicros;
+	std::atomic<long long> totalCommitMicros;
+	std::atomic<long long> maxDepth;
+
+	void run();
+
+public:
+	TransactionLogWriter(std::function<bool(const std::vector<LogRecord>&)> write, LogDurability durability, size_t maxBatch,
+		size_t maxQueued, std::chrono::milliseconds maxDelay);
+
+	~TransactionLogWriter();
+
+	/* Queues the records to be written together. Blocks only while the queue is full; the commit itself is never waited for
+	here, so the result can be chained on from a continuation without holding its thread.*/
+	pplx::task<bool> append(std::vector<LogRecord> records);
+
+	/* Blocks until everything appended so far has been written or given up on.*/
+	void flush();
+
+	/* Writes what is queued and stops the writer thread.*/
+	void stop();
+
+	size_t depth();
+
+	void printMetrics();
+};
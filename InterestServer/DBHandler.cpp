@@ -1,6 +1,7 @@
 #include "DBHandler.h"
 #include <croncpp/croncpp.h>
 #include <string>
+#include <algorithm>
 #include <fstream>
 using namespace mysqlx;
 
@@ -32,15 +33,18 @@ bool DBHandler::logTransaction(Account* from, Account* to, time_t nowTime)
 	}
 }
 
-bool DBHandler::connectToDB()
+bool DBHandler::connectToDB(int statementTimeoutMs)
 {
 	try {
 		Session* session = new Session(mysqlx::SessionOption::USER, "root",
 			mysqlx::SessionOption::PWD, "admin",
 			mysqlx::SessionOption::HOST, "localhost",
 			mysqlx::SessionOption::PORT, 33060,
-			mysqlx::SessionOption::DB, "bankdb"
+			mysqlx::SessionOption::DB, "bankdb",
+			mysqlx::SessionOption::CONNECT_TIMEOUT, (unsigned)statementTimeoutMs
 		);
+		// The server aborts any read on this session that runs longer, so a stalled query fails its shard instead of hanging the run
+		session->sql("SET SESSION max_execution_time = " + std::to_string(statementTimeoutMs)).execute();
 		Schema* schema = new Schema(*session, "bankdb");
 		this->schema = schema;
 		this->session = session;
@@ -88,16 +92,14 @@ Table* DBHandler::getAccounts() {
 }
 
 std::vector<Account*> DBHandler::getAccounts(seal::SEALContext context) {
-	RowResult accountNums = accounts->select("id").orderBy("id").execute();
+	RowResult rows = accounts->select("*").orderBy("id").execute();
 	std::vector<Account*> accounts;
-	if (accountNums.count() == 0) {
+	if (rows.count() == 0) {
 		std::cout << "No accounts exist." << std::endl;
 	}
 	else {
-		for (Row row : accountNums) {
-			int accountId = (int)row.get(0);
-			Account* toAdd = getAccount(accountId, context);
-			accounts.push_back(toAdd);
+		for (Row row : rows) {
+			accounts.push_back(new Account((int)row.get(0), (std::string)row.get(1), (std::string)row.get(2), (double)row.get(5), (size_t)row.get(6), (std::string)row.get(3), (std::string)row.get(4), context));
 		}
 	}
 	return accounts;
@@ -107,18 +109,25 @@ Table* DBHandler::getTransactions() {
 	return transactions;
 }
 
+// Loads an account's history with its counterparties in one JOIN. Each counterparty is built once and shared by all of its transactions
 TransactionList* DBHandler::getTransactions(int accountId, seal::SEALContext context) {
-	RowResult tra = transactions->select("*").where("transactionOwnerID=" + std::to_string(accountId)).orderBy("transactionTime").execute();
+	SqlResult tra = session->sql("SELECT t.transactionTime, t.transactionType, t.amount, a.id, a.firstName, a.lastName, a.overdraft, a.pin, a.balanceAddress, a.keyAddress "
+		"FROM transactions t JOIN accounts a ON a.id = t.otherAccountID WHERE t.transactionOwnerID = ? ORDER BY t.transactionTime")
+		.bind(accountId).execute();
 	if (tra.count() == 0) {
 		std::cout << "No transactions have occurred on this account." << std::endl;
 		return nullptr;
 	}
 	else {
+		Account* account = getAccount(accountId, context);
+		std::map<int, Account*> counterparties;
 		for (Row row : tra) {
-			int otherAccountId = (int)row.get(5);
-			Account* account = getAccount(accountId, context);
-			Account* otherAccount = getAccount(otherAccountId, context);
-			Transaction* temp = new Transaction((std::string)row.get(3), account, otherAccount, (std::string)row.get(2), (std::time_t)row.get(1));
+			int otherAccountId = (int)row.get(3);
+			Account*& otherAccount = counterparties[otherAccountId];
+			if (otherAccount == nullptr) {
+				otherAccount = new Account(otherAccountId, (std::string)row.get(4), (std::string)row.get(5), (double)row.get(6), (size_t)row.get(7), (std::string)row.get(8), (std::string)row.get(9), context);
+			}
+			Transaction* temp = new Transaction((std::string)row.get(2), account, otherAccount, (std::string)row.get(1), (std::time_t)row.get(0));
 			tran->getTransactions()->addTransaction(temp);
 		}
 		return tran->getTransactions();
@@ -260,3 +269,141 @@ void DBHandler::addInterestTransaction(Account* account, seal::SEALContext conte
 		session->rollback();
 	}
 }
+
+
+void DBHandler::createInterestShards(time_t runID, int shardSize) {
+	try {
+		Row bounds = accounts->select("MIN(id)", "MAX(id)").where("id > 1").execute().fetchOne();
+		if (bounds[0].isNull()) {
+			return;
+		}
+		int first = (int)bounds[0];
+		int last = (int)bounds[1];
+		session->startTransaction();
+		int shardID = 0;
+		for (int start = first; start <= last; start += shardSize) {
+			session->sql("INSERT IGNORE INTO interest_shards (runID, shardID, firstAccountID, lastAccountID, checkpointAccountID, status, owner, leaseExpires) VALUES (?, ?, ?, ?, ?, 'pending', NULL, 0)")
+				.bind(runID, shardID, start, std::min(start + shardSize - 1, last), start - 1).execute();
+			shardID++;
+		}
+		session->commit();
+	}
+	catch (std::exception& e) {
+		std::cout << e.what() << std::endl;
+		session->rollback();
+	}
+}
+
+bool DBHandler::claimInterestShard(time_t runID, std::string owner, int leaseSeconds, InterestShard& shard) {
+	try {
+		time_t now = time(nullptr);
+		RowResult candidates = session->sql("SELECT shardID, firstAccountID, lastAccountID FROM interest_shards WHERE runID = ? AND status <> 'done' AND (status = 'pending' OR owner = ? OR leaseExpires < ?) ORDER BY shardID")
+			.bind(runID, owner, now).execute();
+		for (Row row : candidates) {
+			int shardID = (int)row[0];
+			// The same predicate guards the update, so only one claimant can win a shard
+			SqlResult claimed = session->sql("UPDATE interest_shards SET status = 'claimed', owner = ?, leaseExpires = ? WHERE runID = ? AND shardID = ? AND status <> 'done' AND (status = 'pending' OR owner = ? OR leaseExpires < ?)")
+				.bind(owner, now + leaseSeconds, runID, shardID, owner, now).execute();
+			if (claimed.getAffectedItemsCount() == 1) {
+				Row current = session->sql("SELECT checkpointAccountID FROM interest_shards WHERE runID = ? AND shardID = ?").bind(runID, shardID).execute().fetchOne();
+				shard.runID = runID;
+				shard.shardID = shardID;
+				shard.firstAccountID = (int)row[1];
+				shard.lastAccountID = (int)row[2];
+				shard.checkpointAccountID = (int)current[0];
+				return true;
+			}
+		}
+	}
+	catch (std::exception& e) {
+		std::cout << e.what() << std::endl;
+	}
+	return false;
+}
+
+std::vector<Account*> DBHandler::getAccountsInRange(int afterId, int lastId, seal::SEALContext context) {
+	std::vector<Account*> found;
+	RowResult rows = accounts->select("*").where("id > :after AND id <= :last").orderBy("id").bind("after", afterId).bind("last", lastId).execute();
+	for (Row row : rows) {
+		found.push_back(new Account((int)row.get(0), (std::string)row.get(1), (std::string)row.get(2), (double)row.get(5), (size_t)row.get(6), (std::string)row.get(3), (std::string)row.get(4), context));
+	}
+	return found;
+}
+
+bool DBHandler::checkpointInterestShard(InterestShard& shard, std::string owner, int checkpointAccountID, std::vector<Account*> paid, int leaseSeconds) {
+	try {
+		session->startTransaction();
+		if (!paid.empty()) {
+			auto insert = transactions->insert("transactionTime", "transactionType", "amount", "transactionOwnerID", "otherAccountID");
+			for (Account* account : paid) {
+				std::string outputAddress = std::to_string(1) + "'" + std::to_string(account->getId()) + "'" + std::to_string(shard.runID) + ".txt";
+				insert.values(shard.runID, "Monthly interest", outputAddress, account->getId(), 1);
+				// The bank's side of the same payment, so its history shows what it paid out
+				insert.values(shard.runID, "Monthly interest", std::to_string(1) + "'" + std::to_string(account->getId()) + "'" + std::to_string(shard.runID) + ".bank.txt", 1, account->getId());
+			}
+			insert.execute();
+		}
+		SqlResult updated = session->sql("UPDATE interest_shards SET checkpointAccountID = ?, leaseExpires = ? WHERE runID = ? AND shardID = ? AND owner = ?")
+			.bind(checkpointAccountID, time(nullptr) + leaseSeconds, shard.runID, shard.shardID, owner).execute();
+		if (updated.getAffectedItemsCount() != 1) {
+			// Another worker took the shard over after our lease lapsed; its checkpoint wins
+			session->rollback();
+			return false;
+		}
+		session->commit();
+		shard.checkpointAccountID = checkpointAccountID;
+		return true;
+	}
+	catch (std::exception& e) {
+		std::cout << e.what() << std::endl;
+		session->rollback();
+		return false;
+	}
+}
+
+void DBHandler::completeInterestShard(InterestShard& shard, std::string owner) {
+	try {
+		session->sql("UPDATE interest_shards SET status = 'done' WHERE runID = ? AND shardID = ? AND owner = ?").bind(shard.runID, shard.shardID, owner).execute();
+	}
+	catch (std::exception& e) {
+		std::cout << e.what() << std::endl;
+	}
+}
+
+void DBHandler::releaseInterestShard(InterestShard& shard, std::string owner) {
+	try {
+		session->sql("UPDATE interest_shards SET status = 'pending', owner = NULL, leaseExpires = 0 WHERE runID = ? AND shardID = ? AND owner = ? AND status <> 'done'")
+			.bind(shard.runID, shard.shardID, owner).execute();
+	}
+	catch (std::exception& e) {
+		// The lease still lapses on its own, after which the shard can be claimed again
+		std::cout << e.what() << std::endl;
+	}
+}
+
+std::vector<time_t> DBHandler::getUnfinishedInterestRuns() {
+	std::vector<time_t> runs;
+	try {
+		RowResult rows = session->sql("SELECT DISTINCT runID FROM interest_shards WHERE status <> 'done' ORDER BY runID").execute();
+		for (Row row : rows) {
+			runs.push_back((time_t)row[0]);
+		}
+	}
+	catch (std::exception& e) {
+		std::cout << e.what() << std::endl;
+	}
+	return runs;
+}
+
+std::pair<int, int> DBHandler::getInterestRunProgress(time_t runID) {
+	try {
+		Row row = session->sql("SELECT CAST(COALESCE(SUM(status = 'done'), 0) AS SIGNED), COUNT(*) FROM interest_shards WHERE runID = ?").bind(runID).execute().fetchOne();
+		if (!row[1].isNull() && (int)row[1] > 0) {
+			return std::make_pair((int)row[0], (int)row[1]);
+		}
+	}
+	catch (std::exception& e) {
+		std::cout << e.what() << std::endl;
+	}
+	return std::make_pair(0, 0);
+}
@@ -3,11 +3,22 @@
 #include "TransactionHandler.h"
 
 #include <mysqlx/xdevapi.h>
+#include <map>
+#include <utility>
 
 using mysqlx::Session;
 using mysqlx::Schema;
 using mysqlx::Table;
 
+/* A contiguous range of account IDs within an interest run, with the last account whose interest has been recorded.*/
+struct InterestShard {
+	time_t runID;
+	int shardID;
+	int firstAccountID;
+	int lastAccountID;
+	int checkpointAccountID;
+};
+
 class DBHandler {
 private:
 	TransactionHandler* tran;
@@ -22,7 +33,7 @@ public:
 
 	bool logTransaction(Account* from, Account* to, time_t nowTime);
 
-	bool connectToDB();
+	bool connectToDB(int statementTimeoutMs = 30000);
 
 	bool endConnection();
 
@@ -55,4 +66,25 @@ public:
 	void removeDebit(int id);
 
 	void addInterestTransaction(Account* account, seal::SEALContext context, seal::EncryptionParameters params, time_t nowTime);
+
+	/* Splits an interest run into shards of contiguous account IDs. Safe to call from every process: existing shards are left alone.*/
+	void createInterestShards(time_t runID, int shardSize);
+
+	/* Claims a shard that is pending, already owned by this owner, or whose lease has lapsed. Returns false when none is left.*/
+	bool claimInterestShard(time_t runID, std::string owner, int leaseSeconds, InterestShard& shard);
+
+	std::vector<Account*> getAccountsInRange(int afterId, int lastId, seal::SEALContext context);
+
+	/* Records the interest paid and moves the shard checkpoint in one DB transaction, renewing the lease. Returns false if the lease was lost.*/
+	bool checkpointInterestShard(InterestShard& shard, std::string owner, int checkpointAccountID, std::vector<Account*> paid, int leaseSeconds);
+
+	void completeInterestShard(InterestShard& shard, std::string owner);
+
+	/* Hands a shard this owner failed on back to the pool, so any worker can claim it and resume from its checkpoint.*/
+	void releaseInterestShard(InterestShard& shard, std::string owner);
+
+	std::vector<time_t> getUnfinishedInterestRuns();
+
+	/* Returns the number of finished shards and the total number of shards in a run.*/
+	std::pair<int, int> getInterestRunProgress(time_t runID);
 };
\ No newline at end of file
@@ -0,0 +1,114 @@
+#include "Deadline.h"
+#include <algorithm>
+#include <iostream>
+
+using namespace web::http;
+using namespace web::http::client;
+
+std::mutex DeadlineExceeded::statsLock;
+std::map<std::string, long long> DeadlineExceeded::counts;
+thread_local const Deadline* Deadline::scoped = nullptr;
+
+DeadlineExceeded::DeadlineExceeded(const std::string& stage) : std::runtime_error("Deadline passed during " + stage) {
+	this->stageName = stage;
+	std::lock_guard<std::mutex> guard(statsLock);
+	counts[stage]++;
+}
+
+const std::string& DeadlineExceeded::stage() const {
+	return stageName;
+}
+
+void DeadlineExceeded::printMetrics() {
+	std::lock_guard<std::mutex> guard(statsLock);
+	if (counts.empty()) {
+		return;
+	}
+	std::cout << "Timeouts by stage:";
+	for (auto& [stage, count] : counts) {
+		std::cout << " " << stage << "=" << count;
+	}
+	std::cout << std::endl;
+}
+
+Deadline::Deadline(std::chrono::system_clock::time_point at) {
+	this->at = at;
+}
+
+Deadline Deadline::after(std::chrono::milliseconds budget) {
+	return Deadline(std::chrono::system_clock::now() + budget);
+}
+
+Deadline Deadline::of(const http_request& request, std::chrono::milliseconds budget) {
+	Deadline fallback = after(budget);
+	auto header = request.headers().find(L"X-Request-Deadline");
+	if (header == request.headers().end()) {
+		return fallback;
+	}
+	try {
+		std::chrono::system_clock::time_point sent(std::chrono::milliseconds(std::stoll(header->second)));
+		return Deadline(std::min(sent, fallback.at));
+	}
+	catch (std::exception& e) {
+		return fallback;
+	}
+}
+
+std::chrono::milliseconds Deadline::remaining() const {
+	return std::max(std::chrono::milliseconds(0), std::chrono::duration_cast<std::chrono::milliseconds>(at - std::chrono::system_clock::now()));
+}
+
+bool Deadline::expired() const {
+	return std::chrono::system_clock::now() >= at;
+}
+
+void Deadline::check(const std::string& stage) const {
+	if (expired()) {
+		throw DeadlineExceeded(stage);
+	}
+}
+
+void Deadline::attach(http_request& request) const {
+	long long millis = std::chrono::duration_cast<std::chrono::milliseconds>(at.time_since_epoch()).count();
+	request.headers().remove(L"X-Request-Deadline");
+	request.headers().add(L"X-Request-Deadline", std::to_wstring(millis));
+}
+
+pplx::task<http_response> Deadline::send(const std::wstring& uri, http_request outgoing, const std::string& stage) const {
+	check(stage);
+	attach(outgoing);
+	http_client_config config;
+	config.set_timeout(std::max(remaining(), std::chrono::milliseconds(1)));
+	http_client client(uri, config);
+	Deadline deadline = *this;
+	return client.request(outgoing).then([stage, deadline](pplx::task<http_response> response) {
+		http_response result;
+		try {
+			result = response.get();
+		}
+		catch (http_exception& e) {
+			// WinHTTP reports a timeout as ERROR_WINHTTP_TIMEOUT in the system category rather than timed_out, so a failure once the deadline has passed counts too
+			if (e.error_code() == std::errc::timed_out || deadline.expired()) {
+				throw DeadlineExceeded(stage);
+			}
+			throw;
+		}
+		if (result.status_code() == status_codes::GatewayTimeout) {
+			throw DeadlineExceeded(stage);
+		}
+		return result;
+	});
+}
+
+Deadline::Scope::Scope(const Deadline& deadline) {
+	this->previous = scoped;
+	scoped = &deadline;
+}
+
+Deadline::Scope::~Scope() {
+	scoped = previous;
+}
+
+const Deadline* Deadline::current() {
+	return scoped;
+}
@@ -4,6 +4,8 @@
 #include "DebitList.h"
 #include "TransactionHandler.h"
 #include "DBHandler.h"
+#include "Deadline.h"
+#include "ScalarDecoder.h"
 #include <seal/seal.h>
 #include <filesystem>
 #include <fstream>
@@ -21,6 +23,11 @@
 #include <openssl/evp.h>
 #include <openssl/err.h>
 #include <sstream>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <semaphore>
+#include <thread>
 #pragma comment(lib, "cpprest_2_10")
 
 using namespace web;
@@ -48,12 +55,96 @@ wstring readCloudDNS() {
 
 wstring cloudDNS = readCloudDNS();
 
+// Tuning for an interest run, read from interestConfig.txt as key=value lines
+struct InterestConfig {
+    int workers = 4; // Threads processing batches
+    int cloudConcurrency = 4; // Cloud requests allowed in flight at once
+    size_t batchSize = 100; // Accounts handled per cloud round trip, and per checkpoint
+    int shardSize = 1000; // Account IDs per shard of a run
+    int leaseSeconds = 120; // How long a claimed shard stays ours without a checkpoint
+    string workerName = "interest"; // Identifies this process when claiming shards. Must be unique per process and stable across restarts
+    int batchBudgetMs = 60000; // Deadline for one batch's cloud calls. A batch that misses it fails its shard, which is resumed from its checkpoint
+    int statementTimeoutMs = 30000; // Longest a single database read may run before the server aborts it
+    int shardFailures = 3; // Failed shards in a row after which a worker stops claiming. Its run stays unfinished and is picked up again on a later tick
+    int shardRetryMs = 5000; // Pause after a failed shard before the worker claims again
+    int resumeCheckSeconds = 60; // How often an idle server looks for unfinished runs to resume
+};
+
+// Reads the interest run configuration, keeping the defaults for anything not set
+InterestConfig readInterestConfig() {
+    InterestConfig config;
+    try {
+        ifstream inFile("interestConfig.txt");
+        string line;
+        while (getline(inFile, line)) {
+            int index = line.find_first_of('=');
+            if (index == string::npos) {
+                continue;
+            }
+            string key = line.substr(0, index);
+            if (key.compare("workerName") == 0) {
+                config.workerName = line.substr(index + 1, line.length());
+                continue;
+            }
+            int value = stoi(line.substr(index + 1, line.length()));
+            if (value <= 0) {
+                continue;
+            }
+            if (key.compare("workers") == 0) {
+                config.workers = value;
+            }
+            else if (key.compare("cloudConcurrency") == 0) {
+                config.cloudConcurrency = value;
+            }
+            else if (key.compare("batchSize") == 0) {
+                config.batchSize = value;
+            }
+            else if (key.compare("shardSize") == 0) {
+                config.shardSize = value;
+            }
+            else if (key.compare("leaseSeconds") == 0) {
+                config.leaseSeconds = value;
+            }
+            else if (key.compare("batchBudgetMs") == 0) {
+                config.batchBudgetMs = value;
+            }
+            else if (key.compare("statementTimeoutMs") == 0) {
+                config.statementTimeoutMs = value;
+            }
+            else if (key.compare("shardFailures") == 0) {
+                config.shardFailures = value;
+            }
+            else if (key.compare("shardRetryMs") == 0) {
+                config.shardRetryMs = value;
+            }
+            else if (key.compare("resumeCheckSeconds") == 0) {
+                config.resumeCheckSeconds = value;
+            }
+        }
+    }
+    catch (exception& e) {
+        cout << e.what() << endl;
+    }
+    return config;
+}
+
+InterestConfig interestConfig = readInterestConfig();
+counting_semaphore<> cloudSlots(interestConfig.cloudConcurrency); // Bounds concurrent cloud requests across workers
+mutex dbMutex; // The DB session is shared by all workers
+
+// Holds one cloud slot for as long as it is in scope
+struct CloudSlot {
+    CloudSlot() { cloudSlots.acquire(); }
+    ~CloudSlot() { cloudSlots.release(); }
+};
+
 // Sends HTTP request for file. Receives file contents and reads this into ciphertext
-void getAmount(wstring balAddress, seal::Ciphertext& ciphertext) {
+void getAmount(wstring balAddress, seal::Ciphertext& ciphertext, const Deadline& deadline) {
     seal::Ciphertext ciphertext2;
-    http_client client(cloudDNS + L":8081/balance");
-    auto response = client.request(methods::GET, balAddress);
-    auto buf = response.get().body().streambuf();
+    http_request cloudRequest(methods::GET);
+    cloudRequest.set_request_uri(balAddress);
+    http_response response = deadline.send(cloudDNS + L":8081/balance", cloudRequest, "cloud fetch").get();
+    auto buf = response.body().streambuf();
     string contents = "";
     while (!buf.is_eof()) {
         if (buf.getc().get() != -2) // Gets rid of weird requiring 'async required' bugs
@@ -76,85 +167,346 @@ void loadCKKSParams(seal::EncryptionParameters& params) {
     paramsFileIn.close();
 }
 
-// Main workhorse program for InterestServer program. Runs monthly. Checks each account balance. If greater than zero applies interest
+// Fetches many balance ciphertexts from the cloud server in one request. Ciphertexts come back in the order requested, and etags receives the version each was read at
+bool getAmounts(vector<string>& names, vector<seal::Ciphertext>& ciphertexts, vector<string>& etags, const Deadline& deadline) {
+    string body = "";
+    for (string& name : names) {
+        body += name + "\n";
+    }
+    http_request cloudRequest(methods::POST);
+    cloudRequest.set_body(body, "text/plain");
+    CloudSlot slot;
+    auto response = deadline.send(cloudDNS + L":8081/balances", cloudRequest, "cloud fetch").get();
+    if (response.status_code() != status_codes::OK) {
+        wcout << "Batched balance request failed with status " << response.status_code() << endl;
+        return false;
+    }
+    vector<unsigned char> contents = response.extract_vector().get();
+    stringstream contentsIn(string(contents.begin(), contents.end()), std::ios::in | std::ios::binary);
+    ciphertexts.resize(names.size());
+    for (seal::Ciphertext& ciphertext : ciphertexts) {
+        ciphertext.load(*context, contentsIn);
+    }
+    etags.clear();
+    stringstream etagsIn(wstring_convert<codecvt_utf8<wchar_t>>().to_bytes(response.headers()[L"X-ETags"]));
+    string etag;
+    while (getline(etagsIn, etag, ',')) {
+        etags.push_back(etag);
+    }
+    etags.resize(names.size());
+    return true;
+}
+
+// One balance to pay interest on, with the ciphertexts the cloud server needs for it
+struct InterestEntry {
+    Account* account;
+    string amountFile;
+    string bankAmountFile;
+    string etag; // Set only when the balance has no level left and is replaced outright
+    seal::Ciphertext bankLeg;
+    seal::Ciphertext balance;
+    seal::Ciphertext interest;
+};
+
+// Sends one "pay this rate on these balances" command to the cloud server. Returns the outcome the cloud reported for each balance file
+map<string, string> applyInterestOnCloud(double interestRate, const string& bankFile, vector<InterestEntry>& entries, const Deadline& deadline) {
+    map<string, string> outcomes;
+    string manifest = to_string(interestRate) + "\n" + bankFile + "\n" + to_string(entries.size()) + "\n";
+    for (InterestEntry& entry : entries) {
+        manifest += entry.account->getBalanceAddress() + "," + entry.amountFile + "," + entry.bankAmountFile + (entry.etag.empty() ? "" : "," + entry.etag) + "\n";
+    }
+    stringstream body(std::ios::in | std::ios::out | std::ios::binary);
+    body << manifest;
+    for (InterestEntry& entry : entries) {
+        entry.bankLeg.save(body);
+        if (!entry.etag.empty()) {
+            entry.balance.save(body);
+            entry.interest.save(body);
+        }
+    }
+    string bytes = body.str();
+    http_request cloudRequest(methods::PUT);
+    cloudRequest.set_body(vector<unsigned char>(bytes.begin(), bytes.end()));
+    CloudSlot slot;
+    auto response = deadline.send(cloudDNS + L":8081/interest", cloudRequest, "cloud interest").get();
+    if (response.status_code() != status_codes::OK) {
+        wcout << "Interest request failed with status " << response.status_code() << endl;
+        throw runtime_error("Interest request rejected by cloud server");
+    }
+    stringstream outcomeIn(response.extract_utf8string().get());
+    string line;
+    while (getline(outcomeIn, line)) {
+        int index = line.find_first_of(',');
+        if (index != string::npos) {
+            outcomes.insert(make_pair(line.substr(0, index), line.substr(index + 1, line.length())));
+        }
+    }
+    return outcomes;
+}
+
+// Reads a secret key from file the first time it is needed
+seal::SecretKey& keyFor(map<string, seal::SecretKey>& keys, const string& keyAddress) {
+    if (!keys.contains(keyAddress)) {
+        std::ifstream keyIn(keyAddress, std::ios::binary);
+        seal::SecretKey secret_key;
+        secret_key.load(*context, keyIn);
+        keyIn.close();
+        keys.insert(make_pair(keyAddress, secret_key));
+    }
+    return keys.at(keyAddress);
+}
+
+// Encrypts an amount at the top level under the given key
+seal::Ciphertext encryptAmount(double amount, seal::SecretKey& secret_key) {
+    seal::Encryptor encryptor(*context, secret_key);
+    seal::CKKSEncoder encoder(*context);
+    seal::Plaintext plain;
+    seal::Ciphertext cipher;
+    double scale = pow(2, 20);
+    encoder.encode(amount, scale, plain);
+    encryptor.encrypt_symmetric(plain, cipher);
+    return cipher;
+}
+
+// Pays interest on one batch of accounts, debiting the same amounts from the bank's balance in the same cloud commit. Balances are fetched in one request
+// and decrypted here to check the positive-balance rule and to encrypt each bank leg under the bank's key. A balance with a level to spare is multiplied by the
+// rate in place on the cloud; one with none left is replaced by a new top-level balance encrypted here, which the cloud stores only if the balance has not changed
+// since it was read. Balances that changed are read again, a few times at most. Returns the accounts that were paid, including those the cloud had already
+// credited in this run before a crash (their amount file already exists)
+vector<Account*> applyInterestBatch(vector<Account*>& batch, Account* bank, double interestRate, time_t nowTime) {
+    Deadline deadline = Deadline::after(chrono::milliseconds(interestConfig.batchBudgetMs));
+    vector<Account*> paid;
+    vector<Account*> pending;
+    for (Account* acc : batch) {
+        // The bank pays no interest to itself
+        if (acc->getId() != bank->getId()) {
+            pending.push_back(acc);
+        }
+    }
+    map<string, seal::SecretKey> keys;
+    ScalarDecoder decoder(*context);
+    for (int attempt = 0; !pending.empty(); ++attempt) {
+        if (attempt == 3) {
+            // Nothing is checkpointed past this batch, so the shard resumes here later and the accounts already paid come back as duplicates
+            throw runtime_error("Balances kept changing during interest batch");
+        }
+        vector<string> names;
+        for (Account* acc : pending) {
+            names.push_back(acc->getBalanceAddress());
+        }
+        vector<seal::Ciphertext> balances;
+        vector<string> etags;
+        if (!getAmounts(names, balances, etags, deadline)) {
+            throw runtime_error("Could not fetch balances for interest batch");
+        }
+
+        vector<InterestEntry> entries;
+        for (size_t i = 0; i < pending.size(); ++i) {
+            Account* acc = pending[i];
+            seal::SecretKey& secret_key = keyFor(keys, acc->getKeyAddress());
+            seal::Decryptor decryptor(*context, secret_key);
+            double balance = decoder.decrypt(decryptor, balances[i]);
+            if (balance <= 0.0) {
+                continue;
+            }
+            double interest = balance * interestRate;
+            InterestEntry entry;
+            entry.account = acc;
+            entry.amountFile = std::to_string(1) + "'" + std::to_string(acc->getId()) + "'" + std::to_string(nowTime) + ".txt";
+            entry.bankAmountFile = std::to_string(1) + "'" + std::to_string(acc->getId()) + "'" + std::to_string(nowTime) + ".bank.txt";
+            entry.bankLeg = encryptAmount(interest, keyFor(keys, bank->getKeyAddress()));
+            auto contextData = context->get_context_data(balances[i].parms_id());
+            if (!contextData || !contextData->next_context_data()) {
+                entry.etag = etags[i];
+                entry.balance = encryptAmount(balance + interest, secret_key);
+                entry.interest = encryptAmount(interest, secret_key);
+            }
+            entries.push_back(entry);
+        }
+        if (entries.empty()) {
+            break;
+        }
+
+        map<string, string> outcomes = applyInterestOnCloud(interestRate, bank->getBalanceAddress(), entries, deadline);
+        pending.clear();
+        for (InterestEntry& entry : entries) {
+            auto found = outcomes.find(entry.account->getBalanceAddress());
+            string outcome = found == outcomes.end() ? "unanswered" : found->second;
+            if (outcome.compare("applied") == 0 || outcome.compare("refreshed") == 0 || outcome.compare("duplicate") == 0) {
+                paid.push_back(entry.account);
+            }
+            else if (outcome.compare("changed") == 0 || outcome.compare("refresh") == 0) {
+                pending.push_back(entry.account);
+            }
+            else {
+                cout << "Interest not applied to account " << entry.account->getId() << ": " << outcome << endl;
+            }
+        }
+    }
+    return paid;
+}
+
+// Works through one claimed shard from its checkpoint. Each batch's interest rows and the new checkpoint commit together,
+// and the cloud refuses to credit an amount file twice, so a shard resumed after a crash never pays an account twice
+size_t processInterestShard(InterestShard& shard, string owner, double interestRate) {
+    vector<Account*> accounts;
+    Account* bank;
+    {
+        lock_guard<mutex> lock(dbMutex);
+        accounts = dat->getAccountsInRange(shard.checkpointAccountID, shard.lastAccountID, *context);
+        bank = dat->getAccount(1, *context);
+    }
+    if (bank == nullptr) {
+        for (Account* acc : accounts) {
+            delete acc;
+        }
+        throw runtime_error("Bank account not found");
+    }
+    size_t processed = 0;
+    try {
+        for (size_t first = 0; first < accounts.size(); first += interestConfig.batchSize) {
+            vector<Account*> batch(accounts.begin() + first, accounts.begin() + min(accounts.size(), first + interestConfig.batchSize));
+            vector<Account*> paid = applyInterestBatch(batch, bank, interestRate, shard.runID);
+            bool kept;
+            {
+                lock_guard<mutex> lock(dbMutex);
+                kept = dat->checkpointInterestShard(shard, owner, batch.back()->getId(), paid, interestConfig.leaseSeconds);
+            }
+            if (!kept) {
+                cout << "Lost the lease on shard " << shard.shardID << " of run " << shard.runID << endl;
+                break;
+            }
+            processed += batch.size();
+        }
+        if (processed == accounts.size()) {
+            lock_guard<mutex> lock(dbMutex);
+            dat->completeInterestShard(shard, owner);
+        }
+    }
+    catch (exception&) {
+        for (Account* acc : accounts) {
+            delete acc;
+        }
+        delete bank;
+        throw;
+    }
+    for (Account* acc : accounts) {
+        delete acc;
+    }
+    delete bank;
+    return processed;
+}
+
+// Runs one interest run. The run is split into shards of account IDs recorded in the DB, and every worker thread of every
+// InterestServer process claims shards until none are left. Progress, throughput and ETA are reported while it runs
+void runInterestShards(time_t runID, double interestRate) {
+    {
+        lock_guard<mutex> lock(dbMutex);
+        dat->createInterestShards(runID, interestConfig.shardSize);
+    }
+    atomic<size_t> processed = 0;
+    atomic<bool> finished = false;
+    auto start = chrono::steady_clock::now();
+
+    thread reporter([&]() {
+        while (!finished) {
+            this_thread::sleep_for(chrono::seconds(5));
+            pair<int, int> progress;
+            {
+                lock_guard<mutex> lock(dbMutex);
+                progress = dat->getInterestRunProgress(runID);
+            }
+            double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            double rate = elapsed > 0 ? processed / elapsed : 0;
+            double shardRate = elapsed > 0 ? progress.first / elapsed : 0;
+            double eta = shardRate > 0 ? (progress.second - progress.first) / shardRate : 0;
+            cout << "Interest run " << runID << ": " << progress.first << "/" << progress.second << " shards done, " << processed << " accounts here at " << fixed << setprecision(1) << rate << " accounts/s, ETA " << eta << "s" << endl;
+        }
+    });
+
+    vector<thread> workers;
+    for (int w = 0; w < interestConfig.workers; ++w) {
+        workers.push_back(thread([&, w]() {
+            string owner = interestConfig.workerName + "#" + to_string(w);
+            int failures = 0;
+            while (true) {
+                InterestShard shard;
+                bool claimed;
+                {
+                    lock_guard<mutex> lock(dbMutex);
+                    claimed = dat->claimInterestShard(runID, owner, interestConfig.leaseSeconds, shard);
+                }
+                if (!claimed) {
+                    break;
+                }
+                try {
+                    processed += processInterestShard(shard, owner, interestRate);
+                    failures = 0;
+                }
+                catch (exception& e) {
+                    // Give the shard back so any worker can resume it from its checkpoint, then carry on with the rest of the run
+                    cout << "Interest shard " << shard.shardID << " failed: " << e.what() << endl;
+                    {
+                        lock_guard<mutex> lock(dbMutex);
+                        dat->releaseInterestShard(shard, owner);
+                    }
+                    if (++failures >= interestConfig.shardFailures) {
+                        cout << "Worker " << owner << " stopping after " << failures << " failed shards in a row" << endl;
+                        break;
+                    }
+                    this_thread::sleep_for(chrono::milliseconds(interestConfig.shardRetryMs));
+                }
+            }
+        }));
+    }
+    for (thread& worker : workers) {
+        worker.join();
+    }
+    finished = true;
+    reporter.join();
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Interest run " << runID << ": this process handled " << processed << " accounts in " << fixed << setprecision(1) << elapsed << "s" << endl;
+    DeadlineExceeded::printMetrics();
+}
+
+// Resumes every run that still has shards not done, whether left by a crash, by failed shards or by another process that stopped
+void resumeUnfinishedRuns(DBHandler* dat, double interestRate) {
+    vector<time_t> unfinished;
+    {
+        lock_guard<mutex> lock(dbMutex);
+        unfinished = dat->getUnfinishedInterestRuns();
+    }
+    for (time_t runID : unfinished) {
+        cout << "Resuming interest run " << runID << endl;
+        runInterestShards(runID, interestRate);
+    }
+}
+
+// Main workhorse program for InterestServer program. Runs monthly, using the scheduled time as the run ID so that every process agrees on it.
+// Unfinished runs are resumed at startup, before each new run starts and every resumeCheckSeconds while idle, so a failed shard is not left until next month
 void runInterestSubroutine(DBHandler* dat) {
     std::string regString = "0 0 0 1 * *"; // set to run monthly
     regString = "0 * * * * *"; // set to run every minute for debug 
     cron::cronexpr monthly = cron::make_cron(regString);
+    double interestRate = 0.01; // Hard-coded, not ideal but it is what it is
+    resumeUnfinishedRuns(dat, interestRate);
     time_t now = time(nullptr);
     time_t nextExec = cron::cron_next(monthly, now);
+    time_t nextCheck = now + interestConfig.resumeCheckSeconds;
     while (true) {
         now = time(nullptr);
-        wcout << "Time now: " << now << endl;
-        wcout << "Next execution: " << nextExec << endl;
         if (nextExec <= now) {
-            cout << "Let's get cracking" << endl;
-            std::vector<Account*> accounts = dat->getAccounts(*context);
-            if (accounts.size() > 0) {
-                for (Account* acc : accounts) {
-                    if (acc->getId() == 1) {
-                        continue;
-                    }
-                    cout << "We get a non-admin account" << endl;
-                    string keyAddress = acc->getKeyAddress();
-                    std::ifstream keyIn(keyAddress, std::ios::binary);
-                    seal::SecretKey secret_key;
-                    secret_key.load(*context, keyIn);
-                    keyIn.close();
-                    cout << "Read in key at " << keyAddress << endl;
-                    seal::Evaluator eval(*context);
-                    seal::Decryptor decryptor(*context, secret_key);
-                    seal::CKKSEncoder encoder(*context);
-                    string balAddress = acc->getBalanceAddress();
-                    seal::Ciphertext balanceCipher;
-                    wstring wBalAddress = wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(balAddress);
-                    wcout << "Requesting " << wBalAddress << endl;
-                    getAmount(wBalAddress, balanceCipher);
-                    cout << "Read in balance at " << balAddress << endl;
-                    double interestRate = 0.01; // Hard-coded, not ideal but it is what it is
-                    vector<double> res;
-                    seal::Plaintext plaintext;
-                    decryptor.decrypt(balanceCipher, plaintext);
-                    encoder.decode(plaintext, res);
-                    double amount = res[0];
-                    cout << "Amount in account: " << amount << endl;
-                    if (amount > 0.0) {
-                        seal::Encryptor encryptor(*context, secret_key);
-                        seal::Plaintext interestPlain;
-                        seal::CKKSEncoder encoder(*context);
-                        seal::Ciphertext interestCipher;
-                        double interest = - amount * interestRate;
-                        cout << "Interest to pay: " << - interest << endl;
-                        double scale = pow(2, 20);
-                        encoder.encode(interest, scale, interestPlain);
-                        encryptor.encrypt_symmetric(interestPlain, interestCipher);
-                        time_t nowTime = time(nullptr);
-                        cout << "Current time: " << nowTime << endl;
-                        http_client transactionClient(cloudDNS + L":8081/transfer");
-                        string outputAddress = std::to_string(1) + "'" + std::to_string(acc->getId()) + "'" + std::to_string(nowTime) + ".txt";
-                        wstring wideAddress = wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(outputAddress);
-                        wstring from = L"admin.txt";
-                        wstring to = wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(acc->getBalanceAddress());
-                        wstring toSend = to + L"," + from + L"," + wideAddress;
-                        wcout << toSend << endl;
-                        ofstream amountOut(outputAddress, std::ios::binary);
-                        interestCipher.save(amountOut);
-                        amountOut.close();
-                        cout << "Amount saved to file" << endl;
-                        auto f = file_stream<char>::open_istream(wideAddress, std::ios::binary).get();
-                        auto response = transactionClient.request(methods::PUT, toSend, f.streambuf());
-                        wcout << response.get().status_code() << endl;
-                        if (response.get().status_code() == status_codes::OK) {
-                            dat->addInterestTransaction(acc, *context, *params, nowTime);
-                            std::remove(outputAddress.c_str());
-                            cout << "Successful transaction!" << endl;
-                        }
-                    }
-                }
-            }
+            resumeUnfinishedRuns(dat, interestRate);
+            cout << "Starting interest run " << nextExec << " as " << interestConfig.workerName << " with " << interestConfig.workers << " workers and " << interestConfig.cloudConcurrency << " cloud slots" << endl;
+            runInterestShards(nextExec, interestRate);
+            nextExec = cron::cron_next(monthly, time(nullptr));
+            nextCheck = time(nullptr) + interestConfig.resumeCheckSeconds;
+        }
+        else if (nextCheck <= now) {
+            resumeUnfinishedRuns(dat, interestRate);
+            nextCheck = time(nullptr) + interestConfig.resumeCheckSeconds;
         }
         _sleep(999);
-        nextExec = cron::cron_next(monthly, now);
     }
 }
 
@@ -171,7 +523,7 @@ int main()
             context = new seal::SEALContext(con);
             cout << "Context copied" << endl;
         } while (false);
-        dat->connectToDB();
+        dat->connectToDB(interestConfig.statementTimeoutMs);
         cout << "DB Connected to" << endl;
         while (true) {
             runInterestSubroutine(dat);
@@ -57,19 +57,19 @@ string Account::convertToHex(int num) {
 	return result;
 }
 
-int Account::getId() {
+int Account::getId() const {
 	return id;
 }
 
-size_t Account::getHashedPin() {
+size_t Account::getHashedPin() const {
 	return pin;
 }
 
-string Account::getFirstName() {
+string Account::getFirstName() const {
 	return firstName;
 }
 
-string Account::getLastName() {
+string Account::getLastName() const {
 	return lastName;
 }
 
@@ -86,11 +86,11 @@ double Account::getBalance(seal::SEALContext context, seal::EncryptionParameters
 	}
 }
 
-std::string Account::getBalanceAddress() {
+std::string Account::getBalanceAddress() const {
 	return this->balanceAddress;
 }
 
-double Account::getOverdraft() {
+double Account::getOverdraft() const {
 	return overdraft;
 }
 
@@ -100,7 +100,7 @@ void Account::printDetails(seal::SEALContext context, seal::EncryptionParameters
 	std::cout << "Overdraft: " << (char)156 << round2Dp(this->overdraft) << std::endl;
 }
 
-std::string Account::getKeyAddress() {
+std::string Account::getKeyAddress() const {
 	return this->keyAddress;
 }
 
@@ -26,23 +26,23 @@ public:
 
 	static double round2Dp(double amount);
 
-	int getId();
+	int getId() const;
 
-	size_t getHashedPin();
+	size_t getHashedPin() const;
 
-	std::string getFirstName();
+	std::string getFirstName() const;
 
-	std::string getLastName();
+	std::string getLastName() const;
 
 	double getBalance(seal::SEALContext context, seal::EncryptionParameters params);
 
-	std::string getBalanceAddress();
+	std::string getBalanceAddress() const;
 
-	std::string getKeyAddress();
+	std::string getKeyAddress() const;
 
 	void printDetails(seal::SEALContext context, seal::EncryptionParameters params);
 
-	double getOverdraft();
+	double getOverdraft() const;
 
 	/* Checks to see if the account has enough money before beginning the transaction. If not, then false is returned.
 	If true, then the amount will be deducted from the balance and true is returned.*/
@@ -0,0 +1,74 @@
+#include "AccountCache.h"
+#include <iostream>
+#include <mutex>
+
+AccountCache::AccountCache(std::chrono::seconds ttl, size_t capacity) {
+	this->ttl = ttl;
+	this->capacity = capacity;
+	this->hits = 0;
+	this->misses = 0;
+}
+
+std::shared_ptr<const Account> AccountCache::get(int id) {
+	{
+		std::shared_lock<std::shared_mutex> guard(lock);
+		auto found = entries.find(id);
+		if (found != entries.end() && found->second.expires > std::chrono::steady_clock::now()) {
+			hits++;
+			return found->second.account;
+		}
+	}
+	misses++;
+	return nullptr;
+}
+
+void AccountCache::put(std::shared_ptr<const Account> account) {
+	if (account == nullptr) {
+		return;
+	}
+	std::unique_lock<std::shared_mutex> guard(lock);
+	if (entries.size() >= capacity && !entries.contains(account->getId())) {
+		dropExpired();
+		if (entries.size() >= capacity) {
+			return;
+		}
+	}
+	entries[account->getId()] = Entry{ account, std::chrono::steady_clock::now() + ttl };
+}
+
+void AccountCache::invalidate(int id) {
+	std::unique_lock<std::shared_mutex> guard(lock);
+	entries.erase(id);
+}
+
+void AccountCache::clear() {
+	std::unique_lock<std::shared_mutex> guard(lock);
+	entries.clear();
+}
+
+void AccountCache::setTTL(std::chrono::seconds ttl) {
+	std::unique_lock<std::shared_mutex> guard(lock);
+	this->ttl = ttl;
+}
+
+// Caller must hold the lock exclusively
+void AccountCache::dropExpired() {
+	auto now = std::chrono::steady_clock::now();
+	for (auto it = entries.begin(); it != entries.end();) {
+		if (it->second.expires <= now) {
+			it = entries.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+void AccountCache::printMetrics() {
+	size_t size = 0;
+	{
+		std::shared_lock<std::shared_mutex> guard(lock);
+		size = entries.size();
+	}
+	std::cout << "Account cache: " << size << " entries, " << hits << " hits, " << misses << " misses" << std::endl;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "Account.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+
+/* In-memory store of account metadata (names, key and balance addresses, overdraft, pin hash) keyed by account ID.
+Records are shared and immutable, so handlers on any thread can hold one without copying or deleting it.
+Entries expire after the TTL, and invalidate() drops one immediately when its row changes.*/
+class AccountCache {
+private:
+	struct Entry {
+		std::shared_ptr<const Account> account;
+		std::chrono::steady_clock::time_point expires;
+	};
+	std::unordered_map<int, Entry> entries;
+	std::shared_mutex lock;
+	std::chrono::seconds ttl;
+	size_t capacity;
+	std::atomic<long long> hits;
+	std::atomic<long long> misses;
+
+	void dropExpired();
+
+public:
+	AccountCache(std::chrono::seconds ttl, size_t capacity);
+
+	/* Returns the cached record, or nullptr if it is missing or has expired.*/
+	std::shared_ptr<const Account> get(int id);
+
+	void put(std::shared_ptr<const Account> account);
+
+	void invalidate(int id);
+
+	void clear();
+
+	void setTTL(std::chrono::seconds ttl);
+
+	void printMetrics();
+};
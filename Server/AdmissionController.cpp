@@ -0,0 +1,181 @@
+#include "AdmissionController.h"
+#include <algorithm>
+#include <iostream>
+
+using namespace web::http;
+
+AdmissionController::AdmissionController(size_t maxInFlight, std::chrono::milliseconds requestBudget) {
+	this->maxInFlight = maxInFlight;
+	this->inFlight = 0;
+	this->requestBudget = requestBudget;
+}
+
+void AdmissionController::addRoute(const std::string& route, RouteLimits limits) {
+	std::lock_guard<std::mutex> guard(lock);
+	routes[route].limits = limits;
+}
+
+AdmissionController::Handler AdmissionController::admit(const std::string& route, Handler handler) {
+	return [this, route, handler](http_request request) {
+		arrive(route, request, handler);
+	};
+}
+
+// Called with the lock held
+bool AdmissionController::canStart(Route& route) {
+	if (route.inFlight >= route.limits.concurrency) {
+		return false;
+	}
+	if (route.limits.priority == AdmissionPriority::High) {
+		return true;
+	}
+	if (inFlight >= maxInFlight) {
+		return false;
+	}
+	if (route.limits.priority == AdmissionPriority::Low) {
+		// Low requests never overtake Normal ones already waiting
+		for (auto& [name, other] : routes) {
+			if (other.limits.priority == AdmissionPriority::Normal && !other.queue.empty()) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Called with the lock held
+std::chrono::milliseconds AdmissionController::budgetOf(Route& route) {
+	return route.limits.budget.count() > 0 ? route.limits.budget : requestBudget;
+}
+
+// Called with the lock held. Zero until the route has served a request, so a cold route is never shed on estimate
+long long AdmissionController::expectedWaitMillis(Route& route) {
+	if (route.served == 0) {
+		return 0;
+	}
+	long long meanMicros = route.totalServiceMicros / route.served;
+	return (long long)(route.queue.size() + 1) * meanMicros / (long long)route.limits.concurrency / 1000;
+}
+
+void AdmissionController::arrive(const std::string& name, http_request request, Handler handler) {
+	bool rejected = false;
+	long long retryAfter = 0;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		Route& route = routes.at(name);
+		Deadline deadline = Deadline::of(request, budgetOf(route));
+		deadline.attach(request);
+		if (canStart(route)) {
+			route.inFlight++;
+			if (route.limits.priority != AdmissionPriority::High) {
+				inFlight++;
+			}
+			route.accepted++;
+		}
+		else {
+			long long expected = expectedWaitMillis(route);
+			long long allowed = std::min(route.limits.maxWait, deadline.remaining()).count();
+			if (route.queue.size() >= route.limits.queueCapacity || expected > allowed) {
+				route.shed++;
+				rejected = true;
+				retryAfter = std::max<long long>(expected, route.limits.maxWait.count());
+			}
+			else {
+				route.queue.push_back(Waiting{ request, handler, std::chrono::steady_clock::now() });
+				route.queued++;
+				return;
+			}
+		}
+	}
+	if (rejected) {
+		shed(request, retryAfter);
+		return;
+	}
+	run(name, request, handler);
+}
+
+// Runs an admitted request. Its slot is given back when the reply is sent, whichever thread sends it
+void AdmissionController::run(const std::string& name, http_request request, Handler handler) {
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+	request.get_response().then([this, name, started](pplx::task<http_response> response) {
+		try {
+			response.wait();
+		}
+		catch (std::exception& e) {
+			std::cout << "Request on " << name << " ended without a reply: " << e.what() << std::endl;
+		}
+		finish(name, started);
+	});
+	try {
+		handler(request);
+	}
+	catch (std::exception& e) {
+		std::cout << e.what() << std::endl;
+		request._reply_if_not_already(status_codes::InternalError);
+	}
+}
+
+// Frees the finished request's slot, then starts waiting requests in priority order while slots remain
+void AdmissionController::finish(const std::string& name, std::chrono::steady_clock::time_point started) {
+	std::vector<std::pair<std::string, Waiting>> toRun;
+	std::vector<std::pair<http_request, long long>> toShed;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		Route& route = routes.at(name);
+		route.inFlight--;
+		if (route.limits.priority != AdmissionPriority::High) {
+			inFlight--;
+		}
+		route.served++;
+		route.totalServiceMicros += std::chrono::duration_cast<std::chrono::microseconds>(now - started).count();
+		for (AdmissionPriority priority : { AdmissionPriority::High, AdmissionPriority::Normal, AdmissionPriority::Low }) {
+			for (auto& [waitingName, waiting] : routes) {
+				if (waiting.limits.priority != priority) {
+					continue;
+				}
+				while (!waiting.queue.empty() && canStart(waiting)) {
+					Waiting next = std::move(waiting.queue.front());
+					waiting.queue.pop_front();
+					long long waitedMicros = std::chrono::duration_cast<std::chrono::microseconds>(now - next.queued).count();
+					if (waitedMicros > waiting.limits.maxWait.count() * 1000 || Deadline::of(next.request, budgetOf(waiting)).expired()) {
+						// Its client has likely given up; answering now is cheaper than doing the work
+						waiting.expired++;
+						toShed.push_back(std::make_pair(next.request, expectedWaitMillis(waiting)));
+						continue;
+					}
+					waiting.totalQueueMicros += waitedMicros;
+					waiting.inFlight++;
+					if (priority != AdmissionPriority::High) {
+						inFlight++;
+					}
+					toRun.push_back(std::make_pair(waitingName, std::move(next)));
+				}
+			}
+		}
+	}
+	for (auto& [request, retryAfter] : toShed) {
+		shed(request, retryAfter);
+	}
+	for (auto& [waitingName, next] : toRun) {
+		run(waitingName, next.request, next.handler);
+	}
+}
+
+void AdmissionController::shed(http_request request, long long retryAfterMillis) {
+	http_response response(status_codes::ServiceUnavailable);
+	response.headers().add(L"Retry-After", std::to_wstring(std::max<long long>(1, (retryAfterMillis + 999) / 1000)));
+	response.set_body(L"The server is busy. Please try again shortly.");
+	request.reply(response);
+}
+
+void AdmissionController::printMetrics() {
+	std::lock_guard<std::mutex> guard(lock);
+	std::cout << "Admission: " << inFlight << "/" << maxInFlight << " shared slots in use" << std::endl;
+	for (auto& [name, route] : routes) {
+		std::cout << "  " << name << ": " << route.accepted << " accepted, " << route.queued << " queued, " << route.shed << " shed, "
+			<< route.expired << " expired, " << route.inFlight << "/" << route.limits.concurrency << " running, " << route.queue.size() << "/"
+			<< route.limits.queueCapacity << " waiting, " << (route.served == 0 ? 0 : route.totalServiceMicros / route.served) << "us mean service, "
+			<< (route.queued == 0 ? 0 : route.totalQueueMicros / route.queued) << "us mean queue wait" << std::endl;
+	}
+}
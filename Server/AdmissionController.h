@@ -0,0 +1,76 @@
+#pragma once
+#include "Deadline.h"
+#include <cpprest/http_msg.h>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* High routes (heartbeats, logouts) only count against their own limit, so they are still served when the shared slots
+are full. When a slot frees, queued Normal requests start before Low ones.*/
+enum class AdmissionPriority { High, Normal, Low };
+
+struct RouteLimits {
+	size_t concurrency = 8; // Requests of this route being handled at once
+	size_t queueCapacity = 32; // Requests that may wait for a slot before more are shed
+	std::chrono::milliseconds maxWait = std::chrono::milliseconds(2000); // Longest a request may wait for a slot
+	AdmissionPriority priority = AdmissionPriority::Normal;
+	std::chrono::milliseconds budget = std::chrono::milliseconds(0); // Deadline given on arrival. 0 uses the controller's requestBudget
+};
+
+/* Decides, per route, whether a request starts now, waits in a bounded queue or is shed with a 503 and Retry-After.
+A request holds its slot until its reply is sent, so handlers that finish in continuations are counted correctly.
+A request is shed on arrival when its queue is full or the expected wait (queue length times the route's mean
+service time) already exceeds maxWait or the request's deadline, and again on leaving the queue if it waited longer than
+maxWait. Every admitted request carries an X-Request-Deadline header, set from the route's budget (or requestBudget) on arrival unless the caller sent one.*/
+class AdmissionController {
+public:
+	typedef std::function<void(web::http::http_request)> Handler;
+
+	/* maxInFlight bounds the Normal and Low requests being handled at once across all routes.*/
+	AdmissionController(size_t maxInFlight, std::chrono::milliseconds requestBudget);
+
+	void addRoute(const std::string& route, RouteLimits limits);
+
+	/* Wraps a listener handler so it runs under the route's limits. The route must have been added.*/
+	Handler admit(const std::string& route, Handler handler);
+
+	void printMetrics();
+
+private:
+	struct Waiting {
+		web::http::http_request request;
+		Handler handler;
+		std::chrono::steady_clock::time_point queued;
+	};
+
+	struct Route {
+		RouteLimits limits;
+		size_t inFlight = 0;
+		std::deque<Waiting> queue;
+		long long accepted = 0;
+		long long queued = 0;
+		long long shed = 0;
+		long long expired = 0;
+		long long served = 0;
+		long long totalServiceMicros = 0;
+		long long totalQueueMicros = 0;
+	};
+
+	std::map<std::string, Route> routes;
+	size_t maxInFlight;
+	size_t inFlight;
+	std::chrono::milliseconds requestBudget;
+	std::mutex lock;
+
+	void arrive(const std::string& name, web::http::http_request request, Handler handler);
+	void run(const std::string& name, web::http::http_request request, Handler handler);
+	void finish(const std::string& name, std::chrono::steady_clock::time_point started);
+	bool canStart(Route& route);
+	std::chrono::milliseconds budgetOf(Route& route);
+	long long expectedWaitMillis(Route& route);
+	static void shed(web::http::http_request request, long long retryAfterMillis);
+};
@@ -0,0 +1,112 @@
+#include "CiphertextCache.h"
+#include <iostream>
+
+CiphertextCache::CiphertextCache(size_t capacity) {
+	this->capacity = capacity;
+	this->bytes = 0;
+	this->notModified = 0;
+	this->fetched = 0;
+	this->advanced = 0;
+	this->dropped = 0;
+}
+
+bool CiphertextCache::get(const std::wstring& name, seal::Ciphertext& ciphertext, std::wstring& etag) {
+	std::lock_guard<std::mutex> guard(lock);
+	auto found = entries.find(name);
+	if (found == entries.end()) {
+		return false;
+	}
+	ciphertext = found->second.ciphertext;
+	etag = found->second.etag;
+	return true;
+}
+
+bool CiphertextCache::contains(const std::wstring& name) {
+	std::lock_guard<std::mutex> guard(lock);
+	return entries.contains(name);
+}
+
+size_t CiphertextCache::bytesOf(const seal::Ciphertext& ciphertext) {
+	return ciphertext.size() * ciphertext.poly_modulus_degree() * ciphertext.coeff_modulus_size() * sizeof(seal::Ciphertext::ct_coeff_type);
+}
+
+void CiphertextCache::store(const std::wstring& name, Entry entry) {
+	auto found = entries.find(name);
+	if (found != entries.end()) {
+		bytes -= bytesOf(found->second.ciphertext);
+		entries.erase(found);
+	}
+	size_t size = bytesOf(entry.ciphertext);
+	if (size > capacity) {
+		return;
+	}
+	while (bytes + size > capacity && !entries.empty()) {
+		auto oldest = entries.begin();
+		for (auto it = entries.begin(); it != entries.end(); ++it) {
+			if (it->second.used < oldest->second.used) {
+				oldest = it;
+			}
+		}
+		bytes -= bytesOf(oldest->second.ciphertext);
+		entries.erase(oldest);
+	}
+	bytes += size;
+	entries.insert(std::make_pair(name, entry));
+}
+
+void CiphertextCache::put(const std::wstring& name, const seal::Ciphertext& ciphertext, const std::wstring& etag) {
+	fetched++;
+	if (capacity == 0) {
+		return;
+	}
+	std::lock_guard<std::mutex> guard(lock);
+	store(name, Entry{ ciphertext, etag, std::chrono::steady_clock::now() });
+}
+
+void CiphertextCache::confirm(const std::wstring& name) {
+	notModified++;
+	std::lock_guard<std::mutex> guard(lock);
+	auto found = entries.find(name);
+	if (found != entries.end()) {
+		found->second.used = std::chrono::steady_clock::now();
+	}
+}
+
+void CiphertextCache::advance(const std::wstring& name, const std::wstring& previousEtag, const seal::Ciphertext& ciphertext, const std::wstring& etag) {
+	std::lock_guard<std::mutex> guard(lock);
+	auto found = entries.find(name);
+	if (found == entries.end()) {
+		return;
+	}
+	if (found->second.etag.compare(previousEtag) == 0) {
+		store(name, Entry{ ciphertext, etag, std::chrono::steady_clock::now() });
+		advanced++;
+	}
+	else if (found->second.etag.compare(etag) != 0) {
+		// A full fetch may already have stored the new version; anything else is out of date
+		bytes -= bytesOf(found->second.ciphertext);
+		entries.erase(found);
+		dropped++;
+	}
+}
+
+void CiphertextCache::invalidate(const std::wstring& name) {
+	std::lock_guard<std::mutex> guard(lock);
+	auto found = entries.find(name);
+	if (found != entries.end()) {
+		bytes -= bytesOf(found->second.ciphertext);
+		entries.erase(found);
+	}
+}
+
+void CiphertextCache::printMetrics() {
+	size_t size = 0;
+	size_t used = 0;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		size = entries.size();
+		used = bytes;
+	}
+	std::cout << "Ciphertext cache: " << size << " entries in " << used / (1024 * 1024) << "/" << capacity / (1024 * 1024) << "MB, " << notModified << " not modified, " << fetched << " fetched in full, "
+		<< advanced << " updated locally, " << dropped << " dropped as stale" << std::endl;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <seal/seal.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+
+/* Recently fetched balance ciphertexts, keyed by cloud file name and stored with the ETag the cloud server sent. A copy is never
+served unchecked: the caller sends its ETag as If-None-Match and uses the copy only on 304 Not Modified, so the cloud stays the
+source of truth and only the ciphertext body is saved. The cache is bounded by the bytes its ciphertexts hold, since a balance shrinks
+as it loses levels; when full, the least recently used entries make room.*/
+class CiphertextCache {
+private:
+	struct Entry {
+		seal::Ciphertext ciphertext;
+		std::wstring etag;
+		std::chrono::steady_clock::time_point used;
+	};
+	std::map<std::wstring, Entry> entries;
+	std::mutex lock;
+	size_t capacity; // In bytes
+	size_t bytes;
+	std::atomic<long long> notModified;
+	std::atomic<long long> fetched;
+	std::atomic<long long> advanced;
+	std::atomic<long long> dropped;
+
+	static size_t bytesOf(const seal::Ciphertext& ciphertext);
+
+	/* Stores an entry, evicting the least recently used until it fits. Caller must hold lock.*/
+	void store(const std::wstring& name, Entry entry);
+
+public:
+	CiphertextCache(size_t capacity);
+
+	/* Copies out the cached ciphertext and its ETag. Returns false if the file is not cached.*/
+	bool get(const std::wstring& name, seal::Ciphertext& ciphertext, std::wstring& etag);
+
+	bool contains(const std::wstring& name);
+
+	/* Stores a ciphertext fetched in full.*/
+	void put(const std::wstring& name, const seal::Ciphertext& ciphertext, const std::wstring& etag);
+
+	/* Records that the cloud confirmed the cached copy with 304.*/
+	void confirm(const std::wstring& name);
+
+	/* Replaces the entry with a copy updated locally to match a cloud write, if the entry is still at previousEtag. Any other version
+	is dropped, since the write was applied to contents this cache did not hold.*/
+	void advance(const std::wstring& name, const std::wstring& previousEtag, const seal::Ciphertext& ciphertext, const std::wstring& etag);
+
+	void invalidate(const std::wstring& name);
+
+	void printMetrics();
+};
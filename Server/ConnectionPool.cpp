@@ -0,0 +1,209 @@
+#include "ConnectionPool.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+ConnectionPool::ConnectionPool(std::function<mysqlx::Session*()> connect, size_t size, std::chrono::milliseconds waitTimeout, std::chrono::seconds healthCheckAfter) {
+	this->connect = connect;
+	this->waitTimeout = waitTimeout;
+	this->healthCheckAfter = healthCheckAfter;
+	this->acquires = 0;
+	this->waits = 0;
+	this->totalWaitMicros = 0;
+	this->maxWaitMicros = 0;
+	this->timeouts = 0;
+	this->reconnects = 0;
+	for (size_t i = 0; i < size; i++) {
+		std::unique_ptr<Connection> c = std::make_unique<Connection>();
+		open(*c);
+		idle.push_back(c.get());
+		connections.push_back(std::move(c));
+	}
+}
+
+// (Re)creates a connection's session and the table handles bound to it
+void ConnectionPool::open(Connection& c) {
+	c.transactionPage.reset();
+	c.debitById.reset();
+	c.debitsByOwner.reset();
+	c.transactionsByOwner.reset();
+	c.accountById.reset();
+	c.debits.reset();
+	c.transactions.reset();
+	c.accounts.reset();
+	c.schema.reset();
+	if (c.session != nullptr) {
+		try {
+			c.session->close();
+		}
+		catch (std::exception& e) {
+			std::cout << e.what() << std::endl;
+		}
+	}
+	c.session.reset(connect());
+	c.schema = std::make_unique<mysqlx::Schema>(*c.session, "bankdb");
+	c.accounts = std::make_unique<mysqlx::Table>(*c.schema, "accounts");
+	c.transactions = std::make_unique<mysqlx::Table>(*c.schema, "transactions");
+	c.debits = std::make_unique<mysqlx::Table>(*c.schema, "direct_debits");
+	c.accountById = std::make_unique<mysqlx::TableSelect>(c.accounts->select("*"));
+	c.accountById->where("id = :id");
+	c.transactionsByOwner = std::make_unique<mysqlx::TableSelect>(c.transactions->select("*"));
+	c.transactionsByOwner->where("transactionOwnerID = :owner").orderBy("transactionTime");
+	c.debitsByOwner = std::make_unique<mysqlx::TableSelect>(c.debits->select("*"));
+	c.debitsByOwner->where("transactionOwnerID = :owner").orderBy("debitID");
+	c.debitById = std::make_unique<mysqlx::TableSelect>(c.debits->select("*"));
+	c.debitById->where("debitID = :id");
+	c.transactionPage = std::make_unique<mysqlx::TableSelect>(c.transactions->select("*"));
+	c.transactionPage->where("transactionOwnerID = :owner AND transactionTime >= :fromTime AND transactionTime <= :toTime "
+		"AND (transactionTime > :afterTime OR (transactionTime = :afterTime AND transactionID > :afterID))")
+		.orderBy("transactionTime", "transactionID");
+	c.lastUsed = std::chrono::steady_clock::now();
+	c.broken = false;
+}
+
+// Pings a connection that has sat idle, in case the server dropped it
+bool ConnectionPool::healthy(Connection& c) {
+	if (c.broken) {
+		return false;
+	}
+	if (std::chrono::steady_clock::now() - c.lastUsed < healthCheckAfter) {
+		return true;
+	}
+	try {
+		c.session->sql("SELECT 1").execute();
+		return true;
+	}
+	catch (std::exception& e) {
+		std::cout << "Pooled connection failed health check: " << e.what() << std::endl;
+		return false;
+	}
+}
+
+ConnectionPool::Lease ConnectionPool::acquire(const Deadline* deadline) {
+	auto start = std::chrono::steady_clock::now();
+	std::chrono::milliseconds wait = deadline == nullptr ? waitTimeout : std::min(waitTimeout, deadline->remaining());
+	Connection* c = nullptr;
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		if (idle.empty()) {
+			waits++;
+			if (!returned.wait_for(guard, wait, [this]() { return !idle.empty(); })) {
+				timeouts++;
+				throw DeadlineExceeded("db pool");
+			}
+		}
+		c = idle.back();
+		idle.pop_back();
+	}
+	long long waited = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	acquires++;
+	totalWaitMicros += waited;
+	long long previous = maxWaitMicros;
+	while (waited > previous && !maxWaitMicros.compare_exchange_weak(previous, waited));
+	if (!healthy(*c)) {
+		try {
+			open(*c);
+			reconnects++;
+		}
+		catch (std::exception& e) {
+			c->broken = true;
+			release(c);
+			throw;
+		}
+	}
+	return Lease(this, c);
+}
+
+void ConnectionPool::release(Connection* c) {
+	c->lastUsed = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		idle.push_back(c);
+	}
+	returned.notify_one();
+}
+
+size_t ConnectionPool::size() {
+	return connections.size();
+}
+
+size_t ConnectionPool::available() {
+	std::lock_guard<std::mutex> guard(lock);
+	return idle.size();
+}
+
+void ConnectionPool::printMetrics() {
+	long long count = acquires;
+	std::cout << "DB pool: " << available() << "/" << size() << " idle, " << count << " checkouts, " << waits << " waited, "
+		<< (count == 0 ? 0 : totalWaitMicros / count) << "us mean wait, " << maxWaitMicros << "us max wait, "
+		<< timeouts << " timeouts, " << reconnects << " reconnects" << std::endl;
+}
+
+void ConnectionPool::close() {
+	std::lock_guard<std::mutex> guard(lock);
+	for (auto& c : connections) {
+		try {
+			c->session->close();
+		}
+		catch (std::exception& e) {
+			std::cout << e.what() << std::endl;
+		}
+	}
+}
+
+ConnectionPool::Lease::Lease(ConnectionPool* pool, Connection* c) {
+	this->pool = pool;
+	this->c = c;
+}
+
+ConnectionPool::Lease::Lease(Lease&& other) noexcept {
+	this->pool = other.pool;
+	this->c = other.c;
+	other.c = nullptr;
+}
+
+ConnectionPool::Lease::~Lease() {
+	if (c != nullptr) {
+		pool->release(c);
+	}
+}
+
+mysqlx::Session& ConnectionPool::Lease::session() {
+	return *c->session;
+}
+
+mysqlx::Table& ConnectionPool::Lease::accounts() {
+	return *c->accounts;
+}
+
+mysqlx::Table& ConnectionPool::Lease::transactions() {
+	return *c->transactions;
+}
+
+mysqlx::Table& ConnectionPool::Lease::debits() {
+	return *c->debits;
+}
+
+mysqlx::TableSelect& ConnectionPool::Lease::accountById() {
+	return *c->accountById;
+}
+
+mysqlx::TableSelect& ConnectionPool::Lease::transactionsByOwner() {
+	return *c->transactionsByOwner;
+}
+
+mysqlx::TableSelect& ConnectionPool::Lease::debitsByOwner() {
+	return *c->debitsByOwner;
+}
+
+mysqlx::TableSelect& ConnectionPool::Lease::debitById() {
+	return *c->debitById;
+}
+
+mysqlx::TableSelect& ConnectionPool::Lease::transactionPage() {
+	return *c->transactionPage;
+}
+
+void ConnectionPool::Lease::discard() {
+	c->broken = true;
+}
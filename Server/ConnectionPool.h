@@ -0,0 +1,99 @@
+#pragma once
+#include "Deadline.h"
+#include <mysqlx/xdevapi.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/* Fixed-size pool of X DevAPI sessions so concurrent request handlers each get their own connection.
+A connection is borrowed with acquire() and handed back when the returned Lease goes out of scope, so a
+transaction started on a lease can never interleave with another thread's statements.*/
+class ConnectionPool {
+private:
+	struct Connection {
+		std::unique_ptr<mysqlx::Session> session;
+		std::unique_ptr<mysqlx::Schema> schema;
+		std::unique_ptr<mysqlx::Table> accounts;
+		std::unique_ptr<mysqlx::Table> transactions;
+		std::unique_ptr<mysqlx::Table> debits;
+		// Hot queries built once per connection. Executing the same statement object again with new bindings
+		// lets the server prepare it on first reuse and skip parsing from then on. The saving has not been measured yet;
+		// dbQueryBenchmark in Benchmarking compares the two forms
+		std::unique_ptr<mysqlx::TableSelect> accountById;
+		std::unique_ptr<mysqlx::TableSelect> transactionsByOwner;
+		std::unique_ptr<mysqlx::TableSelect> debitsByOwner;
+		std::unique_ptr<mysqlx::TableSelect> debitById;
+		std::unique_ptr<mysqlx::TableSelect> transactionPage;
+		std::chrono::steady_clock::time_point lastUsed;
+		bool broken = false;
+	};
+
+	std::function<mysqlx::Session*()> connect;
+	std::vector<std::unique_ptr<Connection>> connections;
+	std::vector<Connection*> idle;
+	std::mutex lock;
+	std::condition_variable returned;
+	std::chrono::milliseconds waitTimeout;
+	std::chrono::seconds healthCheckAfter;
+
+	std::atomic<long long> acquires;
+	std::atomic<long long> waits;
+	std::atomic<long long> totalWaitMicros;
+	std::atomic<long long> maxWaitMicros;
+	std::atomic<long long> timeouts;
+	std::atomic<long long> reconnects;
+
+	void open(Connection& c);
+	void release(Connection* c);
+	bool healthy(Connection& c);
+
+public:
+	/* Borrowed connection. Returns itself to the pool when destroyed.*/
+	class Lease {
+	private:
+		ConnectionPool* pool;
+		Connection* c;
+	public:
+		Lease(ConnectionPool* pool, Connection* c);
+		Lease(Lease&& other) noexcept;
+		Lease(const Lease&) = delete;
+		Lease& operator=(const Lease&) = delete;
+		~Lease();
+
+		mysqlx::Session& session();
+		mysqlx::Table& accounts();
+		mysqlx::Table& transactions();
+		mysqlx::Table& debits();
+
+		/* Cached statements. Bind :id or :owner before executing.*/
+		mysqlx::TableSelect& accountById();
+		mysqlx::TableSelect& transactionsByOwner();
+		mysqlx::TableSelect& debitsByOwner();
+		mysqlx::TableSelect& debitById();
+
+		/* One page of an account's history after a (transactionTime, transactionID) cursor. Bind :owner, :fromTime, :toTime,
+		:afterTime and :afterID, and set the limit, before executing.*/
+		mysqlx::TableSelect& transactionPage();
+
+		/* Marks the connection as unusable so it is reconnected before being lent out again.*/
+		void discard();
+	};
+
+	/* Opens size sessions up front using connect. Connections idle for longer than healthCheckAfter are pinged with SELECT 1 before being lent out.*/
+	ConnectionPool(std::function<mysqlx::Session*()> connect, size_t size, std::chrono::milliseconds waitTimeout, std::chrono::seconds healthCheckAfter);
+
+	/* Throws DeadlineExceeded if no connection frees up within waitTimeout, or before deadline if one is given and comes sooner.*/
+	Lease acquire(const Deadline* deadline = nullptr);
+
+	size_t size();
+
+	size_t available();
+
+	void printMetrics();
+
+	void close();
+};
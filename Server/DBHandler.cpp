@@ -1,52 +1,61 @@
 #include "DBHandler.h"
 #include <croncpp/croncpp.h>
+#include <algorithm>
 #include <string>
 #include <fstream>
-using namespace mysqlx;
 
 DBHandler::DBHandler(TransactionHandler* tran)
 {
 	this->tran = tran;
-	this->schema = nullptr;
-	this->session = nullptr;
-	this->accounts = nullptr;
-	this->transactions = nullptr;
-	this->debits = nullptr;
+	this->store = nullptr;
+	this->transactionLog = nullptr;
+	this->accountCache = new AccountCache(std::chrono::seconds(300), 100000);
+	this->transferIDs = new IdAllocator([this](long long count) { return this->store->reserveIDs("transfer", count); }, 100);
 }
 
-bool DBHandler::logTransaction(Account* from, Account* to, time_t nowTime, int transactionID)
+pplx::task<bool> DBHandler::logTransaction(const Account* from, const Account* to, time_t nowTime, int transactionID)
 {
-	session->startTransaction();
-	try {
+	std::string transactionAddressFrom = std::to_string(from->getId()) + "'" + std::to_string(to->getId()) + "'" + std::to_string(transactionID) + ".txt";
+	std::string transactionAddressTo = std::to_string(to->getId()) + "'" + std::to_string(from->getId()) + "'" + std::to_string(transactionID) + ".txt";
+	return transactionLog->append({
+		LogRecord{ nowTime, "debit", transactionAddressFrom, from->getId(), to->getId() },
+		LogRecord{ nowTime, "credit", transactionAddressTo, to->getId(), from->getId() }
+	});
+}
+
+pplx::task<bool> DBHandler::logBulkTransaction(Account* from, std::vector<std::pair<Account*, int>> recipients, time_t nowTime)
+{
+	std::vector<LogRecord> records;
+	for (auto& [to, transactionID] : recipients) {
 		std::string transactionAddressFrom = std::to_string(from->getId()) + "'" + std::to_string(to->getId()) + "'" + std::to_string(transactionID) + ".txt";
 		std::string transactionAddressTo = std::to_string(to->getId()) + "'" + std::to_string(from->getId()) + "'" + std::to_string(transactionID) + ".txt";
-		transactions->insert("transactionTime", "transactionType", "amount", "transactionOwnerID", "otherAccountID").values(nowTime, "debit", transactionAddressFrom, from->getId(), to->getId()).execute();
-		transactions->insert("transactionTime", "transactionType", "amount", "transactionOwnerID", "otherAccountID").values(nowTime, "credit", transactionAddressTo, to->getId(), from->getId()).execute();
-		session->commit();
+		records.push_back(LogRecord{ nowTime, "debit", transactionAddressFrom, from->getId(), to->getId() });
+		records.push_back(LogRecord{ nowTime, "credit", transactionAddressTo, to->getId(), from->getId() });
+	}
+	return transactionLog->append(records);
+}
+
+// Called from the log writer thread only. Writes a whole batch in one commit
+bool DBHandler::writeTransactions(const std::vector<LogRecord>& records)
+{
+	try {
+		store->insertTransactions(records);
 		return true;
 	}
-	catch (const Error& e) {
+	catch (std::exception& e) {
 		std::cout << "Error caught: " << e.what() << std::endl;
-		session->rollback();
 		return false;
 	}
 }
 
-bool DBHandler::connectToDB()
+bool DBHandler::connectToDB(StorageBackend* store, int accountCacheSeconds, LogDurability logDurability, size_t logBatchSize, size_t logMaxQueued, int logFlushMs)
 {
 	try {
-		Session* session = new Session(mysqlx::SessionOption::USER, "root",
-			mysqlx::SessionOption::PWD, "admin",
-			mysqlx::SessionOption::HOST, "localhost",
-			mysqlx::SessionOption::PORT, 33060,
-			mysqlx::SessionOption::DB, "bankdb"
-		);
-		Schema* schema = new Schema(*session, "bankdb");
-		this->schema = schema;
-		this->session = session;
-		this->accounts = new Table(*schema, "accounts");
-		this->transactions = new Table(*schema, "transactions");
-		this->debits = new Table(*schema, "direct_debits");
+		accountCache->setTTL(std::chrono::seconds(accountCacheSeconds));
+		this->store = store;
+		store->open();
+		transactionLog = new TransactionLogWriter([this](const std::vector<LogRecord>& records) { return writeTransactions(records); },
+			logDurability, logBatchSize, logMaxQueued, std::chrono::milliseconds(logFlushMs));
 		return true;
 	}
 	catch (std::exception& e) {
@@ -58,10 +67,16 @@ bool DBHandler::connectToDB()
 
 bool DBHandler::endConnection() {
 	try {
-		if (session != nullptr && schema != nullptr) {
-			session->close();
-			schema = nullptr;
-			session = nullptr;
+		if (transactionLog != nullptr) {
+			transactionLog->stop();
+			transactionLog->printMetrics();
+			delete transactionLog;
+			transactionLog = nullptr;
+		}
+		if (store != nullptr) {
+			store->close();
+			delete store;
+			store = nullptr;
 			std::cout << "Connection closed." << std::endl;
 			return true;
 		}
@@ -75,50 +90,82 @@ bool DBHandler::endConnection() {
 	}
 }
 
-Schema* DBHandler::getSchema() {
-	return schema;
+void DBHandler::printMetrics() {
+	if (store != nullptr) {
+		store->printMetrics();
+	}
+	accountCache->printMetrics();
+	if (transactionLog != nullptr) {
+		transactionLog->printMetrics();
+	}
 }
 
-Session* DBHandler::getSession() {
-	return session;
+// Builds the shared record for a row and caches it
+std::shared_ptr<const Account> DBHandler::cacheAccount(const AccountRow& row, seal::SEALContext context) {
+	std::shared_ptr<const Account> account = std::make_shared<const Account>(row.id, row.firstName, row.lastName, row.overdraft, row.pin, row.balanceAddress, row.keyAddress, context);
+	accountCache->put(account);
+	return account;
 }
 
-Table* DBHandler::getAccounts() {
-	return accounts;
+DirectDebit* DBHandler::toDebit(const DebitRow& row, seal::SEALContext context) {
+	return new DirectDebit(row.debitID, getAccount(row.ownerID, context), getAccount(row.otherID, context), row.amount, cron::make_cron(row.regularity), row.timeSet);
 }
 
 std::vector<Account*> DBHandler::getAccounts(seal::SEALContext context) {
-	RowResult accountNums = accounts->select("id").orderBy("id").execute();
 	std::vector<Account*> accounts;
-	if (accountNums.count() == 0) {
+	std::vector<AccountRow> rows = store->getAccounts();
+	if (rows.size() == 0) {
 		std::cout << "No accounts exist." << std::endl;
 	}
 	else {
-		for (Row row : accountNums) {
-			int accountId = (int)row.get(0);
-			Account* toAdd = getAccount(accountId, context);
-			accounts.push_back(toAdd);
+		for (AccountRow& row : rows) {
+			accounts.push_back(new Account(*cacheAccount(row, context)));
 		}
 	}
 	return accounts;
 }
 
-Table* DBHandler::getTransactions() {
-	return transactions;
+std::map<int, Account*> DBHandler::getAccounts(std::vector<int> ids, seal::SEALContext context) {
+	std::map<int, Account*> found;
+	std::vector<int> missing;
+	for (int id : ids) {
+		if (found.contains(id)) {
+			continue;
+		}
+		std::shared_ptr<const Account> cached = accountCache->get(id);
+		if (cached != nullptr) {
+			found.insert(std::make_pair(id, new Account(*cached)));
+			continue;
+		}
+		if (std::find(missing.begin(), missing.end(), id) == missing.end()) {
+			missing.push_back(id);
+		}
+	}
+	if (missing.empty()) {
+		return found;
+	}
+	for (AccountRow& row : store->getAccounts(missing)) {
+		found.insert(std::make_pair(row.id, new Account(*cacheAccount(row, context))));
+	}
+	return found;
 }
 
+// Loads an account's history plus one batched lookup for any counterparties not already cached
 TransactionList* DBHandler::getTransactions(int accountId, seal::SEALContext context) {
-	RowResult tra = transactions->select("*").where("transactionOwnerID=" + std::to_string(accountId)).orderBy("transactionTime").execute();
-	if (tra.count() == 0) {
+	std::vector<TransactionRow> tra = store->getTransactions(accountId);
+	if (tra.size() == 0) {
 		std::cout << "No transactions have occurred on this account." << std::endl;
 		return nullptr;
 	}
 	else {
-		for (Row row : tra) {
-			int otherAccountId = (int)row.get(5);
-			Account* account = getAccount(accountId, context);
-			Account* otherAccount = getAccount(otherAccountId, context);
-			Transaction* temp = new Transaction((std::string)row.get(3), account, otherAccount, (std::string)row.get(2), (std::time_t)row.get(1));
+		// Counterparties are fetched together, mostly from the account cache, and each is shared by all of its transactions
+		std::vector<int> ids = { accountId };
+		for (TransactionRow& row : tra) {
+			ids.push_back(row.otherID);
+		}
+		std::map<int, Account*> found = getAccounts(ids, context);
+		for (TransactionRow& row : tra) {
+			Transaction* temp = new Transaction(row.amount, found[accountId], found[row.otherID], row.type, row.time);
 			tran->getTransactions()->addTransaction(temp);
 		}
 		return tran->getTransactions();
@@ -126,18 +173,64 @@ TransactionList* DBHandler::getTransactions(int accountId, seal::SEALContext con
 	return nullptr;
 }
 
+TransactionPage::~TransactionPage() {
+	for (Transaction* t : transactions) {
+		delete t;
+	}
+	for (Account* a : accounts) {
+		delete a;
+	}
+}
+
+void DBHandler::getTransactionPage(int accountId, time_t fromTime, time_t toTime, time_t afterTime, int afterID, size_t pageSize, seal::SEALContext context, TransactionPage& page) {
+	// One extra row is read to learn whether another page follows
+	std::vector<TransactionRow> rows = store->getTransactionPage(accountId, fromTime, toTime, afterTime, afterID, pageSize + 1);
+	page.more = rows.size() > pageSize;
+	if (page.more) {
+		rows.resize(pageSize);
+	}
+	if (rows.empty()) {
+		return;
+	}
+	std::vector<int> ids = { accountId };
+	for (TransactionRow& row : rows) {
+		ids.push_back(row.otherID);
+	}
+	std::map<int, Account*> found = getAccounts(ids, context);
+	for (auto& [id, account] : found) {
+		page.accounts.push_back(account);
+	}
+	for (TransactionRow& row : rows) {
+		page.transactions.push_back(new Transaction(row.amount, found[accountId], found[row.otherID], row.type, row.time));
+	}
+	page.lastTime = rows.back().time;
+	page.lastID = rows.back().transactionID;
+}
+
 Account* DBHandler::getAccount(int id, seal::SEALContext context) {
-	RowResult acc = accounts->select("*").where("id=" + std::to_string(id)).execute();
-	if (acc.count() == 1) {
-		Row row = acc.fetchOne();
-		std::string getBal = (std::string)row.get(3);
-		std::string getKey = (std::string)row.get(4);
-		Account* accountSearched = new Account((int)row.get(0), (std::string)row.get(1), (std::string)row.get(2), (double)row.get(5), (size_t)row.get(6), getBal, getKey, context);
-		return accountSearched;
+	std::shared_ptr<const Account> record = getAccountRecord(id, context);
+	if (record == nullptr) {
+		return nullptr;
+	}
+	return new Account(*record);
+}
+
+std::shared_ptr<const Account> DBHandler::getAccountRecord(int id, seal::SEALContext context) {
+	std::shared_ptr<const Account> cached = accountCache->get(id);
+	if (cached != nullptr) {
+		return cached;
+	}
+	AccountRow row;
+	if (store->getAccount(id, row)) {
+		return cacheAccount(row, context);
 	}
 	else return nullptr;
 }
 
+void DBHandler::invalidateAccount(int id) {
+	accountCache->invalidate(id);
+}
+
 bool DBHandler::directDebit(DirectDebit* dD, seal::PublicKey public_key, seal::SEALContext context, seal::EncryptionParameters params)
 {
 	/*try {
@@ -158,34 +251,25 @@ bool DBHandler::directDebit(DirectDebit* dD, seal::PublicKey public_key, seal::S
 bool DBHandler::addDebit(DirectDebit* d, std::string regString, seal::SEALContext context, seal::EncryptionParameters params)
 {
 	try {
-		session->startTransaction();
-		debits->insert("transactionOwnerID", "otherAccountID", "amount", "regularity", "timeSet").values(d->getFrom()->getId(), d->getTo()->getId(), d->getAmountAddress(), regString, d->getTimeSet()).execute();
-		session->commit();
+		d->setId(store->insertDebit(DebitRow{ 0, d->getFrom()->getId(), d->getTo()->getId(), d->getAmountAddress(), regString, d->getTimeSet() }));
 		return tran->getDebitList()->addDebit(d);
 	}
-	catch (Error& e) {
+	catch (std::exception& e) {
 		std::cout << e.what() << std::endl;
-		session->rollback();
 		return false;
 	}
 }
 
 DebitList* DBHandler::queryDebits(seal::SEALContext context) {
 	try {
-		RowResult deb = debits->select("*").execute();
+		std::vector<DebitRow> deb = store->getDebits();
 		DebitList* newList = new DebitList();
-		if (deb.count() > 0) {
-			for (Row r : deb) {
-				time_t newTime;
-				if ((time_t)r.get(5) < time(nullptr)) {
-					time_t now = time(nullptr);
-					time_t next = cron::cron_next(cron::make_cron((std::string)r.get(4)), now);
-					newTime = cron::cron_next(cron::make_cron((std::string)r.get(4)), time(nullptr));
-				}
-				else {
-					newTime = (time_t)r.get(5);
+		if (deb.size() > 0) {
+			for (DebitRow& r : deb) {
+				if (r.timeSet < time(nullptr)) {
+					r.timeSet = cron::cron_next(cron::make_cron(r.regularity), time(nullptr));
 				}
-				DirectDebit* d = new DirectDebit((int)r.get(0), getAccount((int)r.get(1), context), getAccount((int)r.get(2), context), (std::string)r.get(3), cron::make_cron((std::string)r.get(4)), newTime);
+				DirectDebit* d = toDebit(r, context);
 				newList->addDebit(d);
 				updateDebits(d);
 			}
@@ -201,15 +285,53 @@ DebitList* DBHandler::queryDebits(seal::SEALContext context) {
 	return nullptr;
 }
 
+std::vector<DirectDebit*> DBHandler::queryDebitsByOwner(int ownerID, seal::SEALContext context) {
+	std::vector<DirectDebit*> owned;
+	try {
+		std::vector<DebitRow> rows = store->getDebitsByOwner(ownerID);
+		if (rows.empty()) {
+			return owned;
+		}
+		Account* owner = getAccount(ownerID, context);
+		std::vector<int> recipientIDs;
+		for (DebitRow& r : rows) {
+			recipientIDs.push_back(r.otherID);
+		}
+		std::map<int, Account*> recipients = getAccounts(recipientIDs, context);
+		for (DebitRow& r : rows) {
+			Account* to = recipients.at(r.otherID);
+			// Each debit owns its recipient, so a recipient shared by several debits is copied
+			if (std::any_of(owned.begin(), owned.end(), [to](DirectDebit* d) { return d->getTo() == to; })) {
+				to = new Account(*to);
+			}
+			owned.push_back(new DirectDebit(r.debitID, owner, to, r.amount, cron::make_cron(r.regularity), r.timeSet));
+		}
+	}
+	catch (std::exception& e) {
+		std::cout << e.what() << std::endl;
+	}
+	return owned;
+}
+
+DirectDebit* DBHandler::getDebit(int debitID, seal::SEALContext context) {
+	try {
+		DebitRow r;
+		if (store->getDebit(debitID, r)) {
+			return toDebit(r, context);
+		}
+	}
+	catch (std::exception& e) {
+		std::cout << e.what() << std::endl;
+	}
+	return nullptr;
+}
+
 void DBHandler::updateDebits(DirectDebit* d) {
 	try {
-		session->startTransaction();
-		debits->update().set("timeSet", d->getTimeSet()).where("debitID = :id").bind("id", d->getId()).execute();
-		session->commit();
+		store->setDebitTime(d->getId(), d->getTimeSet());
 	}
 	catch (std::exception& e) {
 		std::cout << e.what() << std::endl;
-		session->rollback();
 	}
 }
 
@@ -225,62 +347,29 @@ void DBHandler::refreshDebits(seal::SEALContext context) {
 
 void DBHandler::removeDebit(DirectDebit* d)
 {
-	try {
-		session->startTransaction();
-		debits->remove().where("debitID = :debitID").bind("debitID", d->getId()).execute();
-		session->commit();
-	}
-	catch (std::exception& e) {
-		std::cout << e.what() << std::endl;
-		session->rollback();
-	}
+	removeDebit(d->getId());
 }
 
 void DBHandler::removeDebit(int id) {
 	try {
-		session->startTransaction();
-		debits->remove().where("debitID = :debitID").bind("debitID", id).execute();
-		session->commit();
+		store->removeDebit(id);
 	}
 	catch (std::exception& e) {
 		std::cout << e.what() << std::endl;
-		session->rollback();
 	}
 }
 
 void DBHandler::addInterestTransaction(Account* account, seal::SEALContext context, seal::EncryptionParameters params, seal::PublicKey publicKey, time_t nowTime) {
 	try {
-		session->startTransaction();
 		std::string outputAddress = std::to_string(1) + "'" + std::to_string(account->getId()) + "'" + std::to_string(nowTime) + ".txt";
 		std::ofstream output(outputAddress, std::ios::binary);
-		transactions->insert("transactionTime", "transactionType", "amount", "transactionOwnerID", "otherAccountID").values(nowTime, "Monthly interest", outputAddress, account->getId(), 1).execute();
-		session->commit();
+		store->insertTransactions({ LogRecord{ nowTime, "Monthly interest", outputAddress, account->getId(), 1 } });
 	}
 	catch (std::exception& e) {
 		std::cout << e.what() << std::endl;
-		session->rollback();
 	}
 }
 
-int DBHandler::getTransactionID() {
-
-	try {
-		auto trans = transactions->select("transactionID").execute();
-		if (trans.count() > 0) {
-			int max = 0;
-			for (Row r : trans) {
-				int comp = r.get(0);
-				if (max < comp) {
-					max = comp;
-				}
-			}
-			return max;
-		}
-		else {
-			return 1;
-		}
-	}
-	catch (std::exception& e) {
-		std::cout << e.what() << std::endl;
-	}
+int DBHandler::allocateTransactionIDs(int count) {
+	return (int)transferIDs->allocate(count);
 }
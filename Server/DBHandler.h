@@ -1,50 +1,95 @@
 #pragma once
 #include "TransactionHandler.h"
-
-#include <mysqlx/xdevapi.h>
-
-using mysqlx::Session;
-using mysqlx::Schema;
-using mysqlx::Table;
+#include "StorageBackend.h"
+#include "AccountCache.h"
+#include "IdAllocator.h"
+#include "TransactionLogWriter.h"
+
+#include <map>
+#include <memory>
+#include <utility>
+
+/* One page of an account's history. The page owns its transactions and the accounts they point to.
+When more is set, (lastTime, lastID) is the cursor to pass back for the next page.*/
+struct TransactionPage {
+	std::vector<Transaction*> transactions;
+	std::vector<Account*> accounts;
+	bool more = false;
+	time_t lastTime = 0;
+	int lastID = 0;
+
+	TransactionPage() = default;
+	TransactionPage(const TransactionPage&) = delete;
+	TransactionPage& operator=(const TransactionPage&) = delete;
+	~TransactionPage();
+};
 
 class DBHandler {
 private:
 	TransactionHandler* tran;
-	Session* session;
-	Schema* schema;
-	Table* accounts;
-	Table* transactions;
-	Table* debits;
+	StorageBackend* store;
+	AccountCache* accountCache;
+	IdAllocator* transferIDs;
+	TransactionLogWriter* transactionLog;
+
+	bool writeTransactions(const std::vector<LogRecord>& records);
+
+	std::shared_ptr<const Account> cacheAccount(const AccountRow& row, seal::SEALContext context);
+
+	DirectDebit* toDebit(const DebitRow& row, seal::SEALContext context);
 
 public:
 	DBHandler(TransactionHandler* tran);
 
-	bool logTransaction(Account* from, Account* to, time_t nowTime, int transactionID);
-
-	bool connectToDB();
+	/* Logs both legs of a transfer through the transaction log. In Flush mode the task completes with the commit's result,
+	in Enqueue mode once the rows are queued.*/
+	pplx::task<bool> logTransaction(const Account* from, const Account* to, time_t nowTime, int transactionID);
 
-	bool endConnection();
+	/* Logs one sender's transfers to many recipients in a single commit. Each recipient is paired with its transaction ID.*/
+	pplx::task<bool> logBulkTransaction(Account* from, std::vector<std::pair<Account*, int>> recipients, time_t nowTime);
 
-	Schema* getSchema();
+	/* Opens the store, which the handler then owns. Every call below may run on any handler thread; the store decides how they share connections.
+	Transaction rows are group-committed by a log writer flushing up to logBatchSize rows at a time.*/
+	bool connectToDB(StorageBackend* store, int accountCacheSeconds = 300,
+		LogDurability logDurability = LogDurability::Flush, size_t logBatchSize = 500, size_t logMaxQueued = 5000, int logFlushMs = 20);
 
-	Session* getSession();
+	bool endConnection();
 
-	Table* getAccounts();
+	void printMetrics();
 
 	std::vector<Account*> getAccounts(seal::SEALContext context);
 
-	Table* getTransactions();
+	/* Fetches every listed account in one query, keyed by ID. Unknown IDs are absent from the map.*/
+	std::map<int, Account*> getAccounts(std::vector<int> ids, seal::SEALContext context);
 
 	TransactionList* getTransactions(int accountId, seal::SEALContext context);
 
+	/* Fetches at most pageSize transactions in [fromTime, toTime] ordered by time, starting after the (afterTime, afterID) cursor.
+	Uses the (owner, time, ID) index, so cost depends on the page size rather than the account's history.*/
+	void getTransactionPage(int accountId, time_t fromTime, time_t toTime, time_t afterTime, int afterID, size_t pageSize, seal::SEALContext context, TransactionPage& page);
+
+	/* Returns a caller-owned copy of the account, served from the account cache when possible.*/
 	Account* getAccount(int id, seal::SEALContext context);
 
+	/* Read-through lookup returning the shared cached record. Nothing needs to be deleted.*/
+	std::shared_ptr<const Account> getAccountRecord(int id, seal::SEALContext context);
+
+	/* Drops an account from the cache so its next lookup reads the database. Call after changing its row.*/
+	void invalidateAccount(int id);
+
 	bool directDebit(DirectDebit* dD, seal::PublicKey public_key, seal::SEALContext context, seal::EncryptionParameters params);
 
 	bool addDebit(DirectDebit* d, std::string regString, seal::SEALContext context, seal::EncryptionParameters params);
 
 	DebitList* queryDebits(seal::SEALContext context);
 
+	/* Fetches only the debits owned by one account, read-only and ordered by ID. The owner Account is loaded once and shared by every
+	returned debit, so callers delete it once along with each debit and its recipient.*/
+	std::vector<DirectDebit*> queryDebitsByOwner(int ownerID, seal::SEALContext context);
+
+	/* Fetches a single debit by ID without modifying it. Returns nullptr if it does not exist.*/
+	DirectDebit* getDebit(int debitID, seal::SEALContext context);
+
 	void updateDebits(DirectDebit* d);
 
 	void refreshDebits(seal::SEALContext context);
@@ -55,5 +100,6 @@ public:
 
 	void addInterestTransaction(Account* account, seal::SEALContext context, seal::EncryptionParameters params, seal::PublicKey publicKey, time_t nowTime);
 
-	int getTransactionID();
+	/* Returns the first of count consecutive transfer IDs, unique across threads and server processes.*/
+	int allocateTransactionIDs(int count = 1);
 };
\ No newline at end of file
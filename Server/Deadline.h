@@ -0,0 +1,70 @@
+#pragma once
+#include <cpprest/http_client.h>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+/* Thrown when a stage of a request starts after, or runs past, the request's deadline. Each one is counted against its
+stage for printMetrics().*/
+class DeadlineExceeded : public std::runtime_error {
+public:
+	DeadlineExceeded(const std::string& stage);
+
+	const std::string& stage() const;
+
+	static void printMetrics();
+
+private:
+	std::string stageName;
+
+	static std::mutex statsLock;
+	static std::map<std::string, long long> counts;
+};
+
+/* Absolute time by which a request must be answered. It travels between servers in the X-Request-Deadline header as
+milliseconds since the Unix epoch, so the hosts' clocks must roughly agree.*/
+class Deadline {
+public:
+	static Deadline after(std::chrono::milliseconds budget);
+
+	/* The deadline an incoming request carries, or budget from now if it carries none. A caller's deadline is never extended.*/
+	static Deadline of(const web::http::http_request& request, std::chrono::milliseconds budget);
+
+	std::chrono::milliseconds remaining() const;
+
+	bool expired() const;
+
+	/* Throws DeadlineExceeded for stage if the deadline has passed.*/
+	void check(const std::string& stage) const;
+
+	/* Sets the X-Request-Deadline header on a request, replacing any already there.*/
+	void attach(web::http::http_request& request) const;
+
+	/* Sends outgoing to uri with the deadline attached and a client timeout of the time remaining. A timeout, or a 504 from the
+	other side, fails the task with DeadlineExceeded for stage.*/
+	pplx::task<web::http::http_response> send(const std::wstring& uri, web::http::http_request outgoing, const std::string& stage) const;
+
+	/* Makes a deadline the current one on this thread while in scope, for code reached through an interface that does not carry it,
+	such as a storage backend waiting on its connection pool. The deadline must outlive the scope.*/
+	class Scope {
+	public:
+		Scope(const Deadline& deadline);
+		~Scope();
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	private:
+		const Deadline* previous;
+	};
+
+	/* The innermost deadline in scope on this thread, or nullptr if there is none.*/
+	static const Deadline* current();
+
+private:
+	std::chrono::system_clock::time_point at;
+
+	static thread_local const Deadline* scoped;
+
+	Deadline(std::chrono::system_clock::time_point at);
+};
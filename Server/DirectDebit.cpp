@@ -45,6 +45,11 @@ void DirectDebit::setNewTime(std::time_t newTime)
 	this->timeSet = newTime;
 }
 
+void DirectDebit::setId(int debitID)
+{
+	this->debitID = debitID;
+}
+
 std::string DirectDebit::printDebitInfo()
 {
 	std::string details = "_________________________________________\n"+ (std::string)"Debit id: " + std::to_string(debitID) + (std::string)"\nAccount to: " + accountTo->getFirstName() + " " + accountTo->getLastName() + "\nNext time due to send: " + asctime(localtime(&timeSet)) + "Amount: " + (char)156;
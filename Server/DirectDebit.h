@@ -20,5 +20,6 @@ public:
 	cron::cronexpr getRegularity();
 	std::time_t getTimeSet();
 	void setNewTime(std::time_t newTime);
+	void setId(int debitID);
 	std::string printDebitInfo();
 };
\ No newline at end of file
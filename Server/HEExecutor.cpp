@@ -0,0 +1,131 @@
+#include "HEExecutor.h"
+#include <algorithm>
+#include <iostream>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+HEExecutor::HEExecutor(size_t threads, size_t capacity, bool pin) {
+	this->capacity = capacity;
+	this->stopping = false;
+	this->rejected = 0;
+	this->maxDepth = 0;
+	size_t cores = std::thread::hardware_concurrency();
+	if (cores == 0) {
+		cores = 1;
+	}
+	for (size_t i = 0; i < threads; i++) {
+		size_t core = cores > threads ? cores - threads + i : i % cores;
+		workers.push_back(std::thread([this, core, pin]() { work(core, pin); }));
+	}
+}
+
+HEExecutor::~HEExecutor() {
+	stop();
+}
+
+// CPU time used by the calling thread, so an operation is charged for its own work and not for time spent descheduled
+long long HEExecutor::threadCpuMicros() {
+#ifdef _WIN32
+	FILETIME created, exited, kernel, user;
+	GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user);
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return (long long)((k.QuadPart + u.QuadPart) / 10);
+#else
+	timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
+void HEExecutor::enqueue(const std::string& op, std::function<void()> run) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (stopping || queue.size() >= capacity) {
+			rejected++;
+			throw Busy();
+		}
+		queue.push_back(Job{ op, std::chrono::steady_clock::now(), run });
+		long long size = queue.size();
+		long long previous = maxDepth;
+		while (size > previous && !maxDepth.compare_exchange_weak(previous, size));
+	}
+	wake.notify_one();
+}
+
+void HEExecutor::work(size_t core, bool pin) {
+	if (pin) {
+#ifdef _WIN32
+		SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core);
+#else
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+	}
+	while (true) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [this]() { return stopping || !queue.empty(); });
+			if (queue.empty()) {
+				return;
+			}
+			job = std::move(queue.front());
+			queue.pop_front();
+		}
+		long long waited = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - job.queued).count();
+		long long cpuStart = threadCpuMicros();
+		job.run();
+		long long cpu = threadCpuMicros() - cpuStart;
+		std::lock_guard<std::mutex> guard(statsLock);
+		OpStats& op = stats[job.op];
+		op.count++;
+		op.totalWaitMicros += waited;
+		op.maxWaitMicros = std::max(op.maxWaitMicros, waited);
+		op.totalCpuMicros += cpu;
+		op.maxCpuMicros = std::max(op.maxCpuMicros, cpu);
+	}
+}
+
+size_t HEExecutor::depth() {
+	std::lock_guard<std::mutex> guard(lock);
+	return queue.size();
+}
+
+size_t HEExecutor::threads() {
+	return workers.size();
+}
+
+void HEExecutor::printMetrics() {
+	std::cout << "HE executor: " << workers.size() << " workers, " << depth() << "/" << capacity << " queued (max " << maxDepth << "), "
+		<< rejected << " rejected" << std::endl;
+	std::lock_guard<std::mutex> guard(statsLock);
+	for (auto& [name, op] : stats) {
+		std::cout << "  " << name << ": " << op.count << " runs, " << op.totalWaitMicros / op.count << "us mean wait, " << op.maxWaitMicros
+			<< "us max wait, " << op.totalCpuMicros / op.count << "us mean CPU, " << op.maxCpuMicros << "us max CPU" << std::endl;
+	}
+}
+
+void HEExecutor::stop() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers) {
+		if (worker.joinable()) {
+			worker.join();
+		}
+	}
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <pplx/pplxtasks.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/* Fixed pool of threads that runs the CKKS encode, encrypt, decrypt and evaluate work, so the HTTP listener threads
+only parse requests and send replies. A handler submits its HE step and finishes the request in a continuation on the
+returned task. The queue is bounded: submit() throws HEExecutor::Busy instead of letting work pile up behind a burst.*/
+class HEExecutor {
+public:
+	class Busy : public std::runtime_error {
+	public:
+		Busy() : std::runtime_error("HE executor queue is full") {}
+	};
+
+	/* Starts threads workers. With pin set, each worker is fixed to its own core, taken from the top of the core list so the
+	lower cores stay free for I/O threads.*/
+	HEExecutor(size_t threads, size_t capacity, bool pin);
+
+	~HEExecutor();
+
+	/* Queues work and returns a task completed with its result, or with the exception it threw. op names the operation in the metrics.*/
+	template<typename F>
+	auto submit(const std::string& op, F work) -> pplx::task<decltype(work())> {
+		using Result = decltype(work());
+		pplx::task_completion_event<Result> done;
+		enqueue(op, [work, done]() mutable {
+			try {
+				if constexpr (std::is_void_v<Result>) {
+					work();
+					done.set();
+				}
+				else {
+					done.set(work());
+				}
+			}
+			catch (...) {
+				done.set_exception(std::current_exception());
+			}
+		});
+		return pplx::create_task(done);
+	}
+
+	size_t depth();
+
+	size_t threads();
+
+	void printMetrics();
+
+	/* Runs what is queued, then stops the workers.*/
+	void stop();
+
+private:
+	struct Job {
+		std::string op;
+		std::chrono::steady_clock::time_point queued;
+		std::function<void()> run;
+	};
+
+	struct OpStats {
+		long long count = 0;
+		long long totalWaitMicros = 0;
+		long long maxWaitMicros = 0;
+		long long totalCpuMicros = 0;
+		long long maxCpuMicros = 0;
+	};
+
+	std::deque<Job> queue;
+	size_t capacity;
+	bool stopping;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::vector<std::thread> workers;
+
+	std::mutex statsLock;
+	std::map<std::string, OpStats> stats;
+	std::atomic<long long> rejected;
+	std::atomic<long long> maxDepth;
+
+	void enqueue(const std::string& op, std::function<void()> run);
+	void work(size_t core, bool pin);
+	static long long threadCpuMicros();
+};
@@ -0,0 +1,38 @@
+#include "IdAllocator.h"
+#include <algorithm>
+
+IdAllocator::IdAllocator(std::function<long long(long long)> reserve, long long blockSize) {
+	this->reserve = reserve;
+	this->blockSize = blockSize;
+	this->next = 0;
+	this->end = 0;
+}
+
+// Claims count IDs from the current block. Fails if the block does not have that many left
+bool IdAllocator::tryTake(long long count, long long& first) {
+	long long current = next.load();
+	while (current + count <= end.load()) {
+		if (next.compare_exchange_weak(current, current + count)) {
+			first = current;
+			return true;
+		}
+	}
+	return false;
+}
+
+long long IdAllocator::allocate(long long count) {
+	long long first = 0;
+	if (tryTake(count, first)) {
+		return first;
+	}
+	std::lock_guard<std::mutex> guard(refill);
+	if (tryTake(count, first)) {
+		return first;
+	}
+	long long reserved = std::max(blockSize, count);
+	long long start = reserve(reserved);
+	// next is moved before end so no thread can take IDs between the old block and the new one
+	next.store(start + count);
+	end.store(start + reserved);
+	return start;
+}
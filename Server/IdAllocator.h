@@ -0,0 +1,25 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+/* Hands out unique, increasing IDs from blocks reserved in the database. Allocation inside a block is a single
+compare-and-swap; only the thread that exhausts a block takes the lock and reserves the next one. Because blocks come
+from a shared sequence row, IDs never collide across threads or across server processes. IDs in a block left unused
+when the process exits are skipped.*/
+class IdAllocator {
+private:
+	std::function<long long(long long)> reserve; // Reserves count IDs and returns the first
+	long long blockSize;
+	std::atomic<long long> next;
+	std::atomic<long long> end;
+	std::mutex refill;
+
+	bool tryTake(long long count, long long& first);
+
+public:
+	IdAllocator(std::function<long long(long long)> reserve, long long blockSize);
+
+	/* Returns the first of count consecutive IDs.*/
+	long long allocate(long long count = 1);
+};
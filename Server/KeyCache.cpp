@@ -0,0 +1,48 @@
+#include "KeyCache.h"
+#include <fstream>
+#include <iostream>
+
+KeyCache::KeyCache() {
+	this->hits = 0;
+	this->misses = 0;
+}
+
+std::shared_ptr<const seal::SecretKey> KeyCache::get(const std::string& address, const seal::SEALContext& context) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		auto found = keys.find(address);
+		if (found != keys.end()) {
+			hits++;
+			return found->second;
+		}
+	}
+	misses++;
+	std::shared_ptr<seal::SecretKey> key = std::make_shared<seal::SecretKey>();
+	std::ifstream keyIn(address, std::ios::binary);
+	key->load(context, keyIn);
+	keyIn.close();
+	return key;
+}
+
+void KeyCache::load(const std::string& address, const seal::SEALContext& context) {
+	std::shared_ptr<seal::SecretKey> key = std::make_shared<seal::SecretKey>();
+	std::ifstream keyIn(address, std::ios::binary);
+	key->load(context, keyIn);
+	keyIn.close();
+	std::lock_guard<std::mutex> guard(lock);
+	keys[address] = key;
+}
+
+void KeyCache::remove(const std::string& address) {
+	std::lock_guard<std::mutex> guard(lock);
+	keys.erase(address);
+}
+
+void KeyCache::printMetrics() {
+	size_t size = 0;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		size = keys.size();
+	}
+	std::cout << "Key cache: " << size << " keys, " << hits << " hits, " << misses << " misses" << std::endl;
+}
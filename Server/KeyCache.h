@@ -0,0 +1,30 @@
+#pragma once
+#include <seal/seal.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/* Secret keys of logged-in accounts, keyed by key file address, so handlers do not reread the key file on every request.
+Keys are added when an account logs in and removed when it logs out, so keys of idle accounts are not kept in memory.*/
+class KeyCache {
+private:
+	std::map<std::string, std::shared_ptr<const seal::SecretKey>> keys;
+	std::mutex lock;
+	std::atomic<long long> hits;
+	std::atomic<long long> misses;
+
+public:
+	KeyCache();
+
+	/* Returns the cached key, or loads it from its file without caching it.*/
+	std::shared_ptr<const seal::SecretKey> get(const std::string& address, const seal::SEALContext& context);
+
+	/* Loads the key from its file and keeps it until remove() is called.*/
+	void load(const std::string& address, const seal::SEALContext& context);
+
+	void remove(const std::string& address);
+
+	void printMetrics();
+};
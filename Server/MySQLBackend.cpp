@@ -0,0 +1,304 @@
+#include "MySQLBackend.h"
+#include "Deadline.h"
+#include <iostream>
+using namespace mysqlx;
+
+MySQLBackend::MySQLBackend(size_t poolSize, int waitTimeoutMs, int statementTimeoutMs) {
+	this->pool = nullptr;
+	this->poolSize = poolSize;
+	this->waitTimeoutMs = waitTimeoutMs;
+	this->statementTimeoutMs = statementTimeoutMs;
+}
+
+MySQLBackend::~MySQLBackend() {
+	close();
+}
+
+// Row layouts follow bankDB.sql
+AccountRow MySQLBackend::toAccount(Row& row) {
+	return AccountRow{ (int)row.get(0), (std::string)row.get(1), (std::string)row.get(2), (std::string)row.get(3), (std::string)row.get(4), (double)row.get(5), (size_t)row.get(6) };
+}
+
+TransactionRow MySQLBackend::toTransaction(Row& row) {
+	return TransactionRow{ (int)row.get(0), (time_t)row.get(1), (std::string)row.get(2), (std::string)row.get(3), (int)row.get(4), (int)row.get(5) };
+}
+
+DebitRow MySQLBackend::toDebit(Row& row) {
+	return DebitRow{ (int)row.get(0), (int)row.get(1), (int)row.get(2), (std::string)row.get(3), (std::string)row.get(4), (time_t)row.get(5) };
+}
+
+void MySQLBackend::recover(ConnectionPool::Lease& conn, bool inTransaction) {
+	try {
+		if (inTransaction) {
+			conn.session().rollback();
+		}
+		// A statement timeout or constraint error leaves the session usable; a lost connection fails here too
+		conn.session().sql("SELECT 1").execute();
+	}
+	catch (std::exception& e) {
+		std::cout << "Discarding database connection: " << e.what() << std::endl;
+		conn.discard();
+	}
+}
+
+void MySQLBackend::open() {
+	pool = new ConnectionPool([this]() {
+		Session* session = new Session(mysqlx::SessionOption::USER, "root",
+			mysqlx::SessionOption::PWD, "admin",
+			mysqlx::SessionOption::HOST, "localhost",
+			mysqlx::SessionOption::PORT, 33060,
+			mysqlx::SessionOption::DB, "bankdb",
+			mysqlx::SessionOption::CONNECT_TIMEOUT, (unsigned)waitTimeoutMs
+		);
+		// The server aborts any read on this connection that runs longer, so one slow query cannot outlive the request waiting on it
+		session->sql("SET SESSION max_execution_time = " + std::to_string(statementTimeoutMs)).execute();
+		return session;
+	}, poolSize, std::chrono::milliseconds(waitTimeoutMs), std::chrono::seconds(30));
+	std::cout << "Opened " << pool->size() << " database connections" << std::endl;
+	// Starts the transfer sequence after every ID already used, so it can be introduced on an existing database
+	ConnectionPool::Lease conn = pool->acquire();
+	conn.session().sql("INSERT IGNORE INTO id_sequences (name, nextValue) SELECT 'transfer', COALESCE(MAX(transactionID), 0) + 1 FROM transactions").execute();
+}
+
+void MySQLBackend::close() {
+	if (pool != nullptr) {
+		pool->close();
+		delete pool;
+		pool = nullptr;
+	}
+}
+
+std::vector<AccountRow> MySQLBackend::getAccounts() {
+	std::vector<AccountRow> accounts;
+	ConnectionPool::Lease conn = pool->acquire(Deadline::current());
+	try {
+		RowResult rows = conn.accounts().select("*").orderBy("id").execute();
+		for (Row row : rows) {
+			accounts.push_back(toAccount(row));
+		}
+		return accounts;
+	}
+	catch (std::exception& e) {
+		recover(conn, false);
+		throw;
+	}
+}
+
+std::vector<AccountRow> MySQLBackend::getAccounts(const std::vector<int>& ids) {
+	std::vector<AccountRow> accounts;
+	if (ids.empty()) {
+		return accounts;
+	}
+	std::string idList = "";
+	for (int id : ids) {
+		if (!idList.empty()) {
+			idList += ",";
+		}
+		idList += std::to_string(id);
+	}
+	ConnectionPool::Lease conn = pool->acquire(Deadline::current());
+	try {
+		RowResult rows = conn.accounts().select("*").where("id IN (" + idList + ")").execute();
+		for (Row row : rows) {
+			accounts.push_back(toAccount(row));
+		}
+		return accounts;
+	}
+	catch (std::exception& e) {
+		recover(conn, false);
+		throw;
+	}
+}
+
+bool MySQLBackend::getAccount(int id, AccountRow& row) {
+	ConnectionPool::Lease conn = pool->acquire(Deadline::current());
+	try {
+		RowResult acc = conn.accountById().bind("id", id).execute();
+		if (acc.count() != 1) {
+			return false;
+		}
+		Row r = acc.fetchOne();
+		row = toAccount(r);
+		return true;
+	}
+	catch (std::exception& e) {
+		recover(conn, false);
+		throw;
+	}
+}
+
+std::vector<TransactionRow> MySQLBackend::getTransactions(int ownerID) {
+	std::vector<TransactionRow> transactions;
+	ConnectionPool::Lease conn = pool->acquire(Deadline::current());
+	try {
+		RowResult rows = conn.transactionsByOwner().bind("owner", ownerID).execute();
+		for (Row row : rows) {
+			transactions.push_back(toTransaction(row));
+		}
+		return transactions;
+	}
+	catch (std::exception& e) {
+		recover(conn, false);
+		throw;
+	}
+}
+
+std::vector<TransactionRow> MySQLBackend::getTransactionPage(int ownerID, time_t fromTime, time_t toTime, time_t afterTime, int afterID, size_t limit) {
+	std::vector<TransactionRow> transactions;
+	ConnectionPool::Lease conn = pool->acquire(Deadline::current());
+	try {
+		conn.transactionPage().limit(limit);
+		RowResult rows = conn.transactionPage().bind("owner", ownerID).bind("fromTime", fromTime).bind("toTime", toTime)
+			.bind("afterTime", afterTime).bind("afterID", afterID).execute();
+		for (Row row : rows) {
+			transactions.push_back(toTransaction(row));
+		}
+		return transactions;
+	}
+	catch (std::exception& e) {
+		recover(conn, false);
+		throw;
+	}
+}
+
+void MySQLBackend::insertTransactions(const std::vector<LogRecord>& records) {
+	ConnectionPool::Lease conn = pool->acquire(Deadline::current());
+	try {
+		conn.session().startTransaction();
+		auto insert = conn.transactions().insert("transactionTime", "transactionType", "amount", "transactionOwnerID", "otherAccountID");
+		for (const LogRecord& r : records) {
+			insert.values(r.time, r.type, r.amount, r.ownerID, r.otherID);
+		}
+		insert.execute();
+		conn.session().commit();
+	}
+	catch (std::exception& e) {
+		recover(conn, true);
+		throw;
+	}
+}
+
+int MySQLBackend::insertDebit(const DebitRow& row) {
+	ConnectionPool::Lease conn = pool->acquire(Deadline::current());
+	try {
+		conn.session().startTransaction();
+		Result res = conn.debits().insert("transactionOwnerID", "otherAccountID", "amount", "regularity", "timeSet").values(row.ownerID, row.otherID, row.amount, row.regularity, row.timeSet).execute();
+		conn.session().commit();
+		return (int)res.getAutoIncrementValue();
+	}
+	catch (std::exception& e) {
+		recover(conn, true);
+		throw;
+	}
+}
+
+std::vector<DebitRow> MySQLBackend::getDebits() {
+	std::vector<DebitRow> debits;
+	ConnectionPool::Lease conn = pool->acquire(Deadline::current());
+	try {
+		RowResult rows = conn.debits().select("*").execute();
+		for (Row row : rows) {
+			debits.push_back(toDebit(row));
+		}
+		return debits;
+	}
+	catch (std::exception& e) {
+		recover(conn, false);
+		throw;
+	}
+}
+
+std::vector<std::pair<int, time_t>> MySQLBackend::getDebitSchedule() {
+	std::vector<std::pair<int, time_t>> schedule;
+	ConnectionPool::Lease conn = pool->acquire(Deadline::current());
+	try {
+		RowResult rows = conn.debits().select("debitID", "timeSet").execute();
+		for (Row row : rows) {
+			schedule.push_back(std::make_pair((int)row.get(0), (time_t)row.get(1)));
+		}
+		return schedule;
+	}
+	catch (std::exception& e) {
+		recover(conn, false);
+		throw;
+	}
+}
+
+std::vector<DebitRow> MySQLBackend::getDebitsByOwner(int ownerID) {
+	std::vector<DebitRow> debits;
+	ConnectionPool::Lease conn = pool->acquire(Deadline::current());
+	try {
+		RowResult rows = conn.debitsByOwner().bind("owner", ownerID).execute();
+		for (Row row : rows) {
+			debits.push_back(toDebit(row));
+		}
+		return debits;
+	}
+	catch (std::exception& e) {
+		recover(conn, false);
+		throw;
+	}
+}
+
+bool MySQLBackend::getDebit(int debitID, DebitRow& row) {
+	ConnectionPool::Lease conn = pool->acquire(Deadline::current());
+	try {
+		RowResult deb = conn.debitById().bind("id", debitID).execute();
+		if (deb.count() != 1) {
+			return false;
+		}
+		Row r = deb.fetchOne();
+		row = toDebit(r);
+		return true;
+	}
+	catch (std::exception& e) {
+		recover(conn, false);
+		throw;
+	}
+}
+
+void MySQLBackend::setDebitTime(int debitID, time_t timeSet) {
+	ConnectionPool::Lease conn = pool->acquire(Deadline::current());
+	try {
+		conn.session().startTransaction();
+		conn.debits().update().set("timeSet", timeSet).where("debitID = :id").bind("id", debitID).execute();
+		conn.session().commit();
+	}
+	catch (std::exception& e) {
+		recover(conn, true);
+		throw;
+	}
+}
+
+void MySQLBackend::removeDebit(int debitID) {
+	ConnectionPool::Lease conn = pool->acquire(Deadline::current());
+	try {
+		conn.session().startTransaction();
+		conn.debits().remove().where("debitID = :debitID").bind("debitID", debitID).execute();
+		conn.session().commit();
+	}
+	catch (std::exception& e) {
+		recover(conn, true);
+		throw;
+	}
+}
+
+// LAST_INSERT_ID is per connection, so the update and the read share one lease
+long long MySQLBackend::reserveIDs(const std::string& sequence, long long count) {
+	ConnectionPool::Lease conn = pool->acquire(Deadline::current());
+	try {
+		conn.session().sql("UPDATE id_sequences SET nextValue = LAST_INSERT_ID(nextValue + ?) WHERE name = ?").bind(count, sequence).execute();
+		SqlResult last = conn.session().sql("SELECT LAST_INSERT_ID()").execute();
+		return (int64_t)last.fetchOne().get(0) - count;
+	}
+	catch (std::exception& e) {
+		recover(conn, false);
+		throw;
+	}
+}
+
+void MySQLBackend::printMetrics() {
+	if (pool != nullptr) {
+		pool->printMetrics();
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "StorageBackend.h"
+#include "ConnectionPool.h"
+
+/* Storage in the bankdb MySQL schema over the X DevAPI. Each call borrows a pooled connection and uses its cached statements.*/
+class MySQLBackend : public StorageBackend {
+private:
+	ConnectionPool* pool;
+	size_t poolSize;
+	int waitTimeoutMs;
+	int statementTimeoutMs;
+
+	static AccountRow toAccount(mysqlx::Row& row);
+	static TransactionRow toTransaction(mysqlx::Row& row);
+	static DebitRow toDebit(mysqlx::Row& row);
+
+	/* Called when a statement on conn has failed. Rolls back the open transaction, if any, and discards the connection if it no
+	longer answers, so a dropped session is reopened rather than lent to the next caller. Never throws, so the original error is the one reported.*/
+	static void recover(ConnectionPool::Lease& conn, bool inTransaction);
+
+public:
+	MySQLBackend(size_t poolSize, int waitTimeoutMs, int statementTimeoutMs);
+
+	~MySQLBackend();
+
+	void open() override;
+
+	void close() override;
+
+	std::vector<AccountRow> getAccounts() override;
+
+	std::vector<AccountRow> getAccounts(const std::vector<int>& ids) override;
+
+	bool getAccount(int id, AccountRow& row) override;
+
+	std::vector<TransactionRow> getTransactions(int ownerID) override;
+
+	std::vector<TransactionRow> getTransactionPage(int ownerID, time_t fromTime, time_t toTime, time_t afterTime, int afterID, size_t limit) override;
+
+	void insertTransactions(const std::vector<LogRecord>& records) override;
+
+	int insertDebit(const DebitRow& row) override;
+
+	std::vector<DebitRow> getDebits() override;
+
+	std::vector<std::pair<int, time_t>> getDebitSchedule() override;
+
+	std::vector<DebitRow> getDebitsByOwner(int ownerID) override;
+
+	bool getDebit(int debitID, DebitRow& row) override;
+
+	void setDebitTime(int debitID, time_t timeSet) override;
+
+	void removeDebit(int debitID) override;
+
+	long long reserveIDs(const std::string& sequence, long long count) override;
+
+	void printMetrics() override;
+};
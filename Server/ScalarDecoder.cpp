@@ -0,0 +1,61 @@
+#include "ScalarDecoder.h"
+#include <seal/util/rns.h>
+#include <seal/util/uintarith.h>
+#include <seal/util/uintarithsmallmod.h>
+#include <stdexcept>
+#include <vector>
+
+ScalarDecoder::ScalarDecoder(const seal::SEALContext& context) : context(context) {
+}
+
+double ScalarDecoder::decode(const seal::Plaintext& plain) const {
+	auto contextData = context.get_context_data(plain.parms_id());
+	if (!contextData) {
+		throw std::invalid_argument("Plaintext is not valid for the encryption parameters");
+	}
+	if (!plain.is_ntt_form()) {
+		throw std::invalid_argument("Plaintext is not in NTT form");
+	}
+	const std::vector<seal::Modulus>& coeffModulus = contextData->parms().coeff_modulus();
+	size_t modulusSize = coeffModulus.size();
+	size_t coeffCount = contextData->parms().poly_modulus_degree();
+
+	// The negacyclic NTT evaluates the polynomial at every odd power of a 2N-th root of unity. Summing those values cancels every
+	// coefficient except the constant one, which is counted N times
+	std::vector<std::uint64_t> constant(modulusSize);
+	for (size_t i = 0; i < modulusSize; i++) {
+		const seal::Modulus& prime = coeffModulus[i];
+		const std::uint64_t* values = plain.data() + i * coeffCount;
+		std::uint64_t sum = 0;
+		for (size_t j = 0; j < coeffCount; j++) {
+			sum = seal::util::add_uint_mod(sum, values[j], prime);
+		}
+		std::uint64_t inverseDegree = 0;
+		if (!seal::util::try_invert_uint_mod(coeffCount, prime, inverseDegree)) {
+			throw std::logic_error("Polynomial degree is not invertible modulo the coefficient modulus");
+		}
+		constant[i] = seal::util::multiply_uint_mod(sum, inverseDegree, prime);
+	}
+	contextData->rns_tool()->base_q()->compose(constant.data());
+
+	// Values above half the total modulus stand for negative amounts
+	const std::uint64_t* modulus = contextData->total_coeff_modulus();
+	bool negative = seal::util::is_greater_than_or_equal_uint(constant.data(), contextData->upper_half_threshold(), modulusSize);
+	if (negative) {
+		seal::util::sub_uint(modulus, constant.data(), modulusSize, constant.data());
+	}
+	const double twoPow64 = 18446744073709551616.0;
+	double value = 0.0;
+	double wordScale = 1.0;
+	for (size_t i = 0; i < modulusSize; i++) {
+		value += static_cast<double>(constant[i]) * wordScale;
+		wordScale *= twoPow64;
+	}
+	return (negative ? -value : value) / plain.scale();
+}
+
+double ScalarDecoder::decrypt(seal::Decryptor& decryptor, const seal::Ciphertext& encrypted) const {
+	seal::Plaintext plain;
+	decryptor.decrypt(encrypted, plain);
+	return decode(plain);
+}
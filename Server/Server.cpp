@@ -3,6 +3,16 @@
 #include "DebitList.h"
 #include "TransactionHandler.h"
 #include "DBHandler.h"
+#include "MySQLBackend.h"
+#include "MemoryBackend.h"
+#include "HEExecutor.h"
+#include "AdmissionController.h"
+#include "Deadline.h"
+#include "SingleFlight.h"
+#include "CiphertextCache.h"
+#include "KeyCache.h"
+#include "ZeroPool.h"
+#include "ScalarDecoder.h"
 #include <seal/seal.h>
 #include <filesystem>
 #include <fstream>
@@ -14,6 +24,7 @@
 #include <cpprest/json.h>
 #include <cpprest/filestream.h>
 #include <cpprest/http_client.h>
+#include <cpprest/producerconsumerstream.h>
 #include <codecvt>
 #include <openssl/conf.h>
 #include <openssl/evp.h>
@@ -24,7 +35,15 @@
 #include <openssl/aes.h>
 #include <openssl/pem.h>
 #include <openssl/rand.h>
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <thread>
+#include <climits>
 #include <utility>
 #pragma comment(lib, "cpprest_2_10")
 #define _CRTDBG_MAP_ALLOC
@@ -49,7 +68,6 @@ map<int, wstring> loggedIn;
 map<wstring, unsigned char*> ipsAndKeys;
 map<wstring, unsigned char*> ipsAndIvs;
 map <wstring, int> heartbeats;
-int transactionID;
 string pubKey;
 string priKey;
 
@@ -78,6 +96,282 @@ wstring readCloudDNS() {
 wstring serverDNS = readServerDNS();
 wstring cloudDNS = readCloudDNS();
 
+// Database settings, read from dbConfig.txt as key=value lines. Missing keys keep these defaults
+struct DBConfig {
+    bool inMemory = false; // backend=memory keeps everything in process, loading accounts from memorySeed.txt, and disables direct debits. For benchmarks only. backend=mysql uses bankdb
+    size_t poolSize = 8; // Connections shared by all request handlers
+    int waitTimeoutMs = 5000; // How long a handler waits for a free connection before failing the request
+    int statementTimeoutMs = 2000; // Longest a single database read may run before the server aborts it
+    int accountCacheSeconds = 300; // How long account metadata is served from memory before being reread
+    LogDurability logDurability = LogDurability::Flush; // logDurability=flush acknowledges transfers once committed, =enqueue once queued
+    size_t logBatchSize = 500; // Most transaction rows written per commit
+    size_t logMaxQueued = 5000; // Rows that may wait for a commit before transfers block, the most an enqueue-mode crash can lose
+    int logFlushMs = 20; // In enqueue mode, the longest a row waits for its batch to fill
+};
+
+DBConfig readDBConfig() {
+    DBConfig config;
+    try {
+        ifstream inFile("dbConfig.txt");
+        string line;
+        while (getline(inFile, line)) {
+            int index = line.find_first_of('=');
+            if (index == string::npos) {
+                continue;
+            }
+            string key = line.substr(0, index);
+            if (key.compare("logDurability") == 0) {
+                config.logDurability = line.substr(index + 1, line.length()).compare("enqueue") == 0 ? LogDurability::Enqueue : LogDurability::Flush;
+                continue;
+            }
+            if (key.compare("backend") == 0) {
+                config.inMemory = line.substr(index + 1, line.length()).compare("memory") == 0;
+                continue;
+            }
+            int value = stoi(line.substr(index + 1, line.length()));
+            if (value <= 0) {
+                continue;
+            }
+            if (key.compare("poolSize") == 0) {
+                config.poolSize = value;
+            }
+            else if (key.compare("waitTimeoutMs") == 0) {
+                config.waitTimeoutMs = value;
+            }
+            else if (key.compare("statementTimeoutMs") == 0) {
+                config.statementTimeoutMs = value;
+            }
+            else if (key.compare("accountCacheSeconds") == 0) {
+                config.accountCacheSeconds = value;
+            }
+            else if (key.compare("logBatchSize") == 0) {
+                config.logBatchSize = value;
+            }
+            else if (key.compare("logMaxQueued") == 0) {
+                config.logMaxQueued = value;
+            }
+            else if (key.compare("logFlushMs") == 0) {
+                config.logFlushMs = value;
+            }
+        }
+    }
+    catch (exception& e) {
+        cout << e.what() << endl;
+    }
+    return config;
+}
+
+// HE compute pool settings, read from computeConfig.txt as key=value lines. Missing keys keep these defaults
+struct ComputeConfig {
+    size_t threads = max(1, (int)thread::hardware_concurrency() - 2); // Workers for CKKS work, leaving cores for the listener threads
+    size_t queueCapacity = 256; // HE tasks allowed to wait before requests are turned away with 503
+    bool pin = true; // pin=0 lets the OS schedule workers on any core
+    size_t ciphertextCacheMB = 64; // Memory for balance ciphertexts kept for conditional cloud fetches. A top-level balance takes about 393KB, so this holds about 160. 0 turns the cache off
+    size_t zeroPoolDepth = 4; // Encryptions of zero kept ready per logged-in account, so amounts are encrypted with an add. 0 turns the pool off
+    size_t zeroPoolAccounts = 1024; // Most accounts with a zero pool at once
+    size_t bulkChunkPayments = 64; // Payments a bulk transfer encrypts, sends and commits at a time. Each chunk is applied by the cloud on its own
+};
+
+ComputeConfig readComputeConfig() {
+    ComputeConfig config;
+    try {
+        ifstream inFile("computeConfig.txt");
+        string line;
+        while (getline(inFile, line)) {
+            int index = line.find_first_of('=');
+            if (index == string::npos) {
+                continue;
+            }
+            string key = line.substr(0, index);
+            int value = stoi(line.substr(index + 1, line.length()));
+            if (key.compare("pin") == 0) {
+                config.pin = value != 0;
+                continue;
+            }
+            if (key.compare("ciphertextCacheMB") == 0 && value >= 0) {
+                config.ciphertextCacheMB = value;
+                continue;
+            }
+            if (key.compare("zeroPoolDepth") == 0 && value >= 0) {
+                config.zeroPoolDepth = value;
+                continue;
+            }
+            if (value <= 0) {
+                continue;
+            }
+            if (key.compare("threads") == 0) {
+                config.threads = value;
+            }
+            else if (key.compare("queueCapacity") == 0) {
+                config.queueCapacity = value;
+            }
+            else if (key.compare("zeroPoolAccounts") == 0) {
+                config.zeroPoolAccounts = value;
+            }
+            else if (key.compare("bulkChunkPayments") == 0) {
+                config.bulkChunkPayments = value;
+            }
+        }
+    }
+    catch (exception& e) {
+        cout << e.what() << endl;
+    }
+    return config;
+}
+
+// Admission control settings, read from admissionConfig.txt as key=value lines. Route keys are "route.setting", for example
+// history.concurrency=4, history.queue=16, history.maxWaitMs=2000, history.priority=low or bulktransfer.budgetMs=120000. Missing keys keep these defaults
+struct AdmissionConfig {
+    size_t maxInFlight = 64; // Normal and low priority requests handled at once across all routes
+    int requestBudgetMs = 8000; // Deadline given to a client request on arrival. It bounds every cloud call, HE task and database stage of the request
+    int cloudTimeoutMs = 5000; // How long a background call, such as a debit schedule update, may take
+    map<string, RouteLimits> routes;
+};
+
+RouteLimits routeLimits(size_t concurrency, size_t queueCapacity, int maxWaitMs, AdmissionPriority priority, int budgetMs = 0) {
+    RouteLimits limits;
+    limits.concurrency = concurrency;
+    limits.queueCapacity = queueCapacity;
+    limits.maxWait = chrono::milliseconds(maxWaitMs);
+    limits.priority = priority;
+    limits.budget = chrono::milliseconds(budgetMs);
+    return limits;
+}
+
+AdmissionConfig readAdmissionConfig() {
+    AdmissionConfig config;
+    // Heartbeats and logouts are cheap and keep sessions alive, so they are never held behind history or debit listings
+    config.routes["heartbeat"] = routeLimits(64, 256, 1000, AdmissionPriority::High);
+    config.routes["logout"] = routeLimits(16, 64, 1000, AdmissionPriority::High);
+    config.routes["login"] = routeLimits(8, 32, 2000, AdmissionPriority::Normal);
+    config.routes["requestkey"] = routeLimits(8, 32, 2000, AdmissionPriority::Normal);
+    config.routes["transfer"] = routeLimits(16, 64, 3000, AdmissionPriority::Normal);
+    // A bulk transfer runs chunk after chunk, so it gets its own deadline rather than the one sized for single requests
+    config.routes["bulktransfer"] = routeLimits(2, 4, 10000, AdmissionPriority::Normal, 120000);
+    config.routes["balance"] = routeLimits(16, 64, 2000, AdmissionPriority::Normal);
+    config.routes["adddebit"] = routeLimits(4, 16, 3000, AdmissionPriority::Normal);
+    config.routes["removedebit"] = routeLimits(4, 16, 3000, AdmissionPriority::Normal);
+    config.routes["history"] = routeLimits(4, 16, 2000, AdmissionPriority::Low);
+    config.routes["debits"] = routeLimits(4, 16, 2000, AdmissionPriority::Low);
+    try {
+        ifstream inFile("admissionConfig.txt");
+        string line;
+        while (getline(inFile, line)) {
+            int index = line.find_first_of('=');
+            if (index == string::npos) {
+                continue;
+            }
+            string key = line.substr(0, index);
+            string value = line.substr(index + 1, line.length());
+            int dot = key.find_first_of('.');
+            if (dot != string::npos && config.routes.contains(key.substr(0, dot))) {
+                RouteLimits& limits = config.routes.at(key.substr(0, dot));
+                string setting = key.substr(dot + 1, key.length());
+                if (setting.compare("priority") == 0) {
+                    limits.priority = value.compare("high") == 0 ? AdmissionPriority::High : value.compare("low") == 0 ? AdmissionPriority::Low : AdmissionPriority::Normal;
+                    continue;
+                }
+                int number = stoi(value);
+                if (number <= 0) {
+                    continue;
+                }
+                if (setting.compare("concurrency") == 0) {
+                    limits.concurrency = number;
+                }
+                else if (setting.compare("queue") == 0) {
+                    limits.queueCapacity = number;
+                }
+                else if (setting.compare("maxWaitMs") == 0) {
+                    limits.maxWait = chrono::milliseconds(number);
+                }
+                else if (setting.compare("budgetMs") == 0) {
+                    limits.budget = chrono::milliseconds(number);
+                }
+                continue;
+            }
+            int number = stoi(value);
+            if (number <= 0) {
+                continue;
+            }
+            if (key.compare("maxInFlight") == 0) {
+                config.maxInFlight = number;
+            }
+            else if (key.compare("requestBudgetMs") == 0) {
+                config.requestBudgetMs = number;
+            }
+            else if (key.compare("cloudTimeoutMs") == 0) {
+                config.cloudTimeoutMs = number;
+            }
+        }
+    }
+    catch (exception& e) {
+        cout << e.what() << endl;
+    }
+    return config;
+}
+
+AdmissionConfig admissionConfig = readAdmissionConfig();
+AdmissionController* admission = nullptr;
+
+// Deadline of a client request. The admission controller stamps it on arrival, so requestBudgetMs only applies here to requests that bypassed it
+Deadline requestDeadline(const http_request& request) {
+    return Deadline::of(request, chrono::milliseconds(admissionConfig.requestBudgetMs));
+}
+
+HEExecutor* heExecutor = nullptr;
+SingleFlight<seal::Ciphertext> balanceFetches; // Concurrent reads of one ciphertext share a single cloud fetch
+CiphertextCache* balanceCache = nullptr;
+KeyCache secretKeys; // Keys of logged-in accounts, loaded at login
+ZeroPool* zeroPool = nullptr; // Encryptions of zero for logged-in accounts
+size_t bulkChunkPayments = 64;
+
+// Set by Ctrl+C or a console close. main sleeps on shutdownSignal until then, and the heartbeat thread stops with it
+atomic<bool> shutdownRequested = false;
+mutex shutdownLock;
+condition_variable shutdownSignal;
+
+void requestShutdown() {
+    shutdownRequested = true;
+    shutdownSignal.notify_all();
+}
+
+#ifdef _WIN32
+BOOL WINAPI onConsoleEvent(DWORD event) {
+    requestShutdown();
+    return TRUE;
+}
+#else
+void onSignal(int sig) {
+    shutdownRequested = true; // Only the flag is safe to touch here; the waits below recheck it every second
+}
+#endif
+
+// State of one bulk transfer, shared by the continuations and HE tasks that work on it. The accounts are freed with the last of them
+struct BulkTransfer {
+    int idFrom = 0;
+    double total = 0.0;
+    vector<pair<int, double>> payments;
+    map<int, Account*> accounts;
+    map<string, seal::SecretKey> keys;
+    size_t chunkSize = 1;
+    size_t applied = 0; // Payments in chunks the cloud has committed. Chunks run one after another, so only one continuation writes this at a time
+    bool started = false;
+    atomic<bool> failed = false;
+
+    ~BulkTransfer() {
+        for (auto const& [id, account] : accounts) {
+            delete account;
+        }
+    }
+};
+
+// Result of a transfer's HE step: whether the sender can cover the amount and, if so, the debit and credit legs
+struct TransferLegs {
+    bool funded = false;
+    seal::Ciphertext from;
+    seal::Ciphertext to;
+};
+
 // Generate sessional AES key
 void GenerateAESKey(unsigned char* outAESKey, unsigned char* outAESIv) {
     unsigned char* key = new unsigned char[AES_BITS];
@@ -389,38 +683,307 @@ string RsaPriDecrypt(const std::string& cipher_text, const std::string& pri_key)
     return decrypt_text;
 }
 
-// Upon receiving request from client, authenticate user and retrieve balance from cloud server, then convert from CKKS to AES and send encrypted amount to client
-http::status_code getAmount(wstring balAddress, seal::Ciphertext& ciphertext) {
-    seal::Ciphertext ciphertext2;
-    http_client client(cloudDNS + L":8081/balance");
-    wcout << "File requested: " << balAddress << endl;
-    auto response = client.request(methods::GET, balAddress);
-    auto buf = response.get().body().streambuf();
-    if (response.get().status_code() == status_codes::OK) {
-        string contents = "";
-        while (!buf.is_eof()) {
-            if (buf.getc().get() != -2) // Gets rid of weird requiring 'async required' bugs
-                contents += buf.sbumpc();
+// A ciphertext together with the cloud version it was read at
+struct VersionedCiphertext {
+    seal::Ciphertext ciphertext;
+    wstring etag;
+};
+
+// Fetches a ciphertext from the cloud server. The task completes once the body has arrived, and fails if the cloud does not have the file.
+// A fetch of the same file already in flight is joined rather than repeated. A cached copy is revalidated with If-None-Match and reused on 304
+pplx::task<seal::Ciphertext> getAmount(wstring balAddress, const Deadline& deadline) {
+    return balanceFetches.run(balAddress, [balAddress, deadline]() {
+        wcout << "File requested: " << balAddress << endl;
+        shared_ptr<VersionedCiphertext> cached = make_shared<VersionedCiphertext>();
+        http_request cloudRequest(methods::GET);
+        cloudRequest.set_request_uri(balAddress);
+        if (balanceCache->get(balAddress, cached->ciphertext, cached->etag)) {
+            cloudRequest.headers().add(L"If-None-Match", cached->etag);
+        }
+        return deadline.send(cloudDNS + L":8081/balance", cloudRequest, "cloud fetch").then([balAddress, cached](http_response response) {
+            if (response.status_code() == status_codes::NotModified && !cached->etag.empty()) {
+                balanceCache->confirm(balAddress);
+                return pplx::task_from_result(cached->ciphertext);
+            }
+            if (response.status_code() != status_codes::OK) {
+                throw runtime_error("Cloud server could not supply " + std::wstring_convert<std::codecvt_utf8<wchar_t>>().to_bytes(balAddress));
+            }
+            wstring etag = response.headers().has(L"ETag") ? response.headers()[L"ETag"] : L"";
+            return response.extract_vector().then([balAddress, etag](vector<unsigned char> contents) {
+                stringstream contentsIn(string(contents.begin(), contents.end()), std::ios::in | std::ios::binary);
+                seal::Ciphertext ciphertext;
+                ciphertext.load(*context, contentsIn);
+                if (!etag.empty()) {
+                    balanceCache->put(balAddress, ciphertext, etag);
+                }
+                return ciphertext;
+            });
+        });
+    });
+}
+
+// Brings cached balances up to date after a cloud write. versions holds the cloud's "balanceFile,previousETag,newETag" lines, and legs the
+// balance and amount of every leg written, in the order the cloud applied them. A cached copy at the previous version has the same amounts
+// subtracted, as the cloud did, so the next balance check is answered with 304 instead of a full fetch
+void advanceCachedBalances(const string& versions, const vector<pair<wstring, seal::Ciphertext>>& legs) {
+    stringstream versionsIn(versions);
+    string line;
+    seal::Evaluator evaluator(*context);
+    while (getline(versionsIn, line)) {
+        int first = line.find_first_of(',');
+        int second = line.find_first_of(',', first + 1);
+        if (first == string::npos || second == string::npos) {
+            continue;
+        }
+        wstring balanceFile = wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(line.substr(0, first));
+        wstring previousEtag = wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(line.substr(first + 1, second - first - 1));
+        wstring etag = wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(line.substr(second + 1, line.length()));
+        seal::Ciphertext balance;
+        wstring cachedEtag;
+        if (!balanceCache->get(balanceFile, balance, cachedEtag)) {
+            continue;
+        }
+        if (cachedEtag.compare(previousEtag) != 0) {
+            // Already refetched at the new version, or the write was applied to contents this cache never held
+            if (cachedEtag.compare(etag) != 0) {
+                balanceCache->invalidate(balanceFile);
+            }
+            continue;
         }
         try {
-            ofstream outFile(balAddress, std::ios::binary);
-            outFile << contents;
-            outFile.close();
-            ifstream inFile(balAddress, std::ios::binary | std::ios::beg);
-            ciphertext2.load(*context, inFile);
-            inFile.close();
-            ciphertext = ciphertext2;
-            std::remove(std::wstring_convert<std::codecvt_utf8<wchar_t>>().to_bytes(balAddress).c_str());
-            return status_codes::OK;
+            for (auto& [legBalance, amount] : legs) {
+                if (legBalance.compare(balanceFile) != 0) {
+                    continue;
+                }
+                seal::Ciphertext aligned = amount;
+                if (aligned.parms_id() != balance.parms_id()) {
+                    evaluator.mod_switch_to_inplace(aligned, balance.parms_id());
+                }
+                evaluator.sub_inplace(balance, aligned);
+            }
+            balanceCache->advance(balanceFile, previousEtag, balance, etag);
         }
         catch (exception& e) {
-            cout << e.what() << endl;
-            return status_codes::NotFound;
+            cout << "Could not update cached balance: " << e.what() << endl;
+            balanceCache->invalidate(balanceFile);
+        }
+    }
+}
+
+// Runs advanceCachedBalances on the HE pool once a write has been accepted. If the pool is full the written balances are dropped from the cache instead
+pplx::task<http::status_code> afterCloudWrite(http_response response, vector<pair<wstring, seal::Ciphertext>> legs) {
+    http::status_code code = response.status_code();
+    if (code != status_codes::OK) {
+        return pplx::task_from_result(code);
+    }
+    return response.extract_utf8string().then([code, legs](string versions) {
+        try {
+            return heExecutor->submit("cache update", [versions, legs]() { advanceCachedBalances(versions, legs); }).then([code](pplx::task<void> done) {
+                try {
+                    done.get();
+                }
+                catch (exception& e) {
+                    cout << "Could not update cached balances: " << e.what() << endl;
+                }
+                return code;
+            });
         }
+        catch (HEExecutor::Busy&) {
+            for (auto& [balanceFile, amount] : legs) {
+                balanceCache->invalidate(balanceFile);
+            }
+            return pplx::task_from_result(code);
+        }
+    });
+}
+
+// Fetches many ciphertexts from the cloud server in one request. Ciphertexts come back in the order requested
+pplx::task<vector<seal::Ciphertext>> getAmounts(vector<string> names, const Deadline& deadline) {
+    string body = "";
+    for (string& name : names) {
+        body += name + "\n";
+    }
+    http_request cloudRequest(methods::POST);
+    cloudRequest.set_body(body, "text/plain");
+    return deadline.send(cloudDNS + L":8081/balances", cloudRequest, "cloud fetch").then([](http_response response) {
+        if (response.status_code() != status_codes::OK) {
+            throw runtime_error("Batched ciphertext request failed with status " + to_string(response.status_code()));
+        }
+        return response.extract_vector();
+    }).then([count = names.size()](vector<unsigned char> contents) {
+        stringstream contentsIn(string(contents.begin(), contents.end()), std::ios::in | std::ios::binary);
+        vector<seal::Ciphertext> ciphertexts(count);
+        for (seal::Ciphertext& ciphertext : ciphertexts) {
+            ciphertext.load(*context, contentsIn);
+        }
+        return ciphertexts;
+    });
+}
+
+// Sends both legs of a transfer to the cloud server in one request. The cloud applies them atomically, so a failure leaves neither balance changed
+pplx::task<http::status_code> sendTransferToCloud(wstring fromBalance, wstring toBalance, wstring fromAmountFile, wstring toAmountFile, seal::Ciphertext& amountFrom, seal::Ciphertext& amountTo, const Deadline& deadline) {
+    stringstream body(std::ios::in | std::ios::out | std::ios::binary);
+    amountFrom.save(body);
+    amountTo.save(body);
+    string bytes = body.str();
+    http_request cloudRequest(methods::PUT);
+    cloudRequest.set_request_uri(fromBalance + L"," + toBalance + L"," + fromAmountFile + L"," + toAmountFile);
+    cloudRequest.set_body(vector<unsigned char>(bytes.begin(), bytes.end()));
+    vector<pair<wstring, seal::Ciphertext>> legs;
+    if (balanceCache->contains(fromBalance)) {
+        legs.push_back(make_pair(fromBalance, amountFrom));
+    }
+    if (balanceCache->contains(toBalance)) {
+        legs.push_back(make_pair(toBalance, amountTo));
+    }
+    return deadline.send(cloudDNS + L":8081/transfer2", cloudRequest, "cloud transfer").then([fromBalance, toBalance, legs](http_response response) {
+        balanceFetches.forget(fromBalance);
+        balanceFetches.forget(toBalance);
+        return afterCloudWrite(response, legs);
+    });
+}
+
+// Tells the debit server that a direct debit was added, moved or deleted so it can update its schedule without polling the database.
+// The request is not waited for. A failure is only logged; the debit server reloads the full schedule from the database whenever it restarts
+void notifyDebitScheduler(method m, wstring uri) {
+    try {
+        http_request scheduleRequest(m);
+        scheduleRequest.set_request_uri(uri);
+        Deadline::after(chrono::milliseconds(admissionConfig.cloudTimeoutMs)).send(serverDNS + L":8082/schedule", scheduleRequest, "debit scheduler").then([uri](pplx::task<http_response> response) {
+            try {
+                status_code code = response.get().status_code();
+                if (code != status_codes::OK) {
+                    wcout << "Debit server rejected schedule change " << uri << " with code " << code << endl;
+                }
+            }
+            catch (exception& e) {
+                cout << "Could not reach debit server: " << e.what() << endl;
+            }
+        });
+    }
+    catch (exception& e) {
+        cout << "Could not reach debit server: " << e.what() << endl;
+    }
+}
+
+// Sends a batch of transfer legs to the cloud server in one request. Each manifest entry pairs a balance file with the amount file its ciphertext is stored under.
+// The body is streamed: the manifest goes first, then each amount is serialised as it is written, framed as a "size" line followed by its bytes
+pplx::task<http::status_code> sendBatchToCloud(const vector<pair<string, string>>& manifest, shared_ptr<vector<seal::Ciphertext>> amounts, const Deadline& deadline) {
+    string header = to_string(manifest.size()) + "\n";
+    for (auto& [balanceFile, amountFile] : manifest) {
+        header += balanceFile + "," + amountFile + "\n";
     }
-    else {
-        return status_codes::NotFound;
+    concurrency::streams::producer_consumer_buffer<uint8_t> body;
+    http_request cloudRequest(methods::PUT);
+    cloudRequest.set_body(body.create_istream());
+    vector<wstring> balances;
+    vector<pair<wstring, seal::Ciphertext>> legs;
+    for (size_t i = 0; i < manifest.size(); ++i) {
+        balances.push_back(wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(manifest[i].first));
+        if (balanceCache->contains(balances.back())) {
+            legs.push_back(make_pair(balances.back(), (*amounts)[i]));
+        }
     }
+    pplx::task<http_response> sent = deadline.send(cloudDNS + L":8081/transferbatch", cloudRequest, "cloud batch");
+    pplx::create_task([body, header, amounts]() mutable {
+        try {
+            body.putn_nocopy((const uint8_t*)header.data(), header.size()).wait();
+            for (seal::Ciphertext& amount : *amounts) {
+                stringstream serialised(std::ios::in | std::ios::out | std::ios::binary);
+                amount.save(serialised);
+                string bytes = serialised.str();
+                string size = to_string(bytes.size()) + "\n";
+                body.putn_nocopy((const uint8_t*)size.data(), size.size()).wait();
+                body.putn_nocopy((const uint8_t*)bytes.data(), bytes.size()).wait();
+            }
+            body.close(std::ios_base::out).wait();
+        }
+        catch (exception& e) {
+            cout << "Could not stream batch to cloud server: " << e.what() << endl;
+            body.close(std::ios_base::out, std::current_exception()).wait();
+        }
+    });
+    return sent.then([balances, legs](http_response response) {
+        for (const wstring& balance : balances) {
+            balanceFetches.forget(balance);
+        }
+        return afterCloudWrite(response, legs);
+    });
+}
+
+// Session generation of each account, bumped by coolAccount at every logout. A warmAccount task compares it with the generation it
+// started under rather than reading loggedIn from another thread, and holds warmLock from that check to its track so a logout cannot
+// slip in between
+mutex warmLock;
+map<int, long long> warmGenerations;
+
+long long accountGeneration(int id) {
+    lock_guard<mutex> guard(warmLock);
+    return warmGenerations[id];
+}
+
+// Loads a newly logged-in account's secret key and balance ciphertext in the background, so its first request finds them cached
+// instead of paying for the key file read and full cloud download. The account record is already cached by the login lookup.
+// generation is the account's accountGeneration() from before it was marked logged in.
+// A failure here is only logged; the first request then loads what it needs itself
+void warmAccount(shared_ptr<const Account> account, long long generation) {
+    pplx::create_task([account, generation]() {
+        secretKeys.load(account->getKeyAddress(), *context);
+        lock_guard<mutex> guard(warmLock);
+        if (warmGenerations[account->getId()] != generation) {
+            // Logged out while the key was loading
+            secretKeys.remove(account->getKeyAddress());
+            return;
+        }
+        zeroPool->track(account->getKeyAddress(), secretKeys.get(account->getKeyAddress(), *context));
+    }).then([](pplx::task<void> loaded) {
+        try {
+            loaded.get();
+        }
+        catch (exception& e) {
+            cout << "Could not preload secret key: " << e.what() << endl;
+        }
+    });
+    try {
+        wstring balAddress = wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(account->getBalanceAddress());
+        getAmount(balAddress, Deadline::after(chrono::milliseconds(admissionConfig.cloudTimeoutMs))).then([](pplx::task<seal::Ciphertext> fetched) {
+            try {
+                fetched.get();
+            }
+            catch (exception& e) {
+                cout << "Could not preload balance: " << e.what() << endl;
+            }
+        });
+    }
+    catch (exception& e) {
+        cout << "Could not preload balance: " << e.what() << endl;
+    }
+}
+
+// Drops what warmAccount loaded once the account logs out
+void coolAccount(int id) {
+    shared_ptr<const Account> account = dat->getAccountRecord(id, *context);
+    lock_guard<mutex> guard(warmLock);
+    warmGenerations[id]++;
+    if (account != nullptr) {
+        secretKeys.remove(account->getKeyAddress());
+        zeroPool->untrack(account->getKeyAddress());
+    }
+}
+
+// Runs a handler once the whole request body has arrived, so its extract calls complete immediately and a slow upload never holds a listener thread
+function<void(http_request)> whenBodyReady(function<bool(http_request)> handler) {
+    return [handler](http_request request) {
+        request.content_ready().then([handler, request](pplx::task<http_request> ready) {
+            try {
+                handler(ready.get());
+            }
+            catch (exception& e) {
+                cout << "Could not read request body: " << e.what() << endl;
+                request._reply_if_not_already(status_codes::BadRequest);
+            }
+        });
+    };
 }
 
 // Function invoked when creating the CKKS params used. Same as what is advised in SEAL documentation
@@ -492,7 +1055,7 @@ bool sendKeys(http_request request) {
                 ivToEncrypt += to_string(toAdd) + ",";
             }
             string toSend = RsaPubEncrypt(keyToEncrypt + "'" + ivToEncrypt, rsaKey);
-            request.reply(status_codes::OK, toSend).get();
+            request.reply(status_codes::OK, toSend);
             wcout << L"Keys negotiated for IP " << request.get_remote_address() << endl;
             return true;
     }
@@ -550,34 +1113,32 @@ bool serverLogin(http_request request) {
             return false;
         }
         else {
-            Account* acc = dat->getAccount(idNum, *context);
+            shared_ptr<const Account> acc = dat->getAccountRecord(idNum, *context);
             if (idNum == 1) { // Checks to see if the account is null or the admin account.
                 cout << "Attempted login to the admin account." << endl << endl;
                 request.reply(status_codes::BadRequest, L"Invalid user ID.");
-                delete acc;
                 return false;
             }
             else if (acc == nullptr) {
                 cout << "Could not find user ID: " << idNum << endl;
                 request.reply(status_codes::BadRequest, L"Invalid user ID.");
-                delete acc;
                 return false;
             }
             else {
                 wstring actualPin = to_wstring(acc->getHashedPin());
                 wstring pin = wstring_convert<codecvt_utf8<wchar_t>>().from_bytes(pinToCheck);
                 if (pin.compare(actualPin) == 0) {
+                    long long generation = accountGeneration(acc->getId());
                     loggedIn.insert(pair<int, wstring>(acc->getId(), request.get_remote_address()));
                     heartbeats.insert(make_pair(request.get_remote_address(), time(nullptr)));
                     wcout << "Account " << idNum << " logged in." << endl << endl;
                     request.reply(status_codes::OK);
-                    delete acc;
+                    warmAccount(acc, generation);
                     return true;
                 }
                 else {
                     wcout << "Unsuccessful login attempt on account" << idNum << endl << endl;
                     request.reply(status_codes::NotAcceptable, L"Some of your login details were wrong. Please try again.");
-                    delete acc;
                     return false;
                 }
             }
@@ -629,6 +1190,7 @@ bool serverLogout(http_request request) {
         if (loggedIn.contains(idNum)) {
             if (loggedIn.at(idNum).compare(request.get_remote_address()) == 0) {
                 loggedIn.erase(idNum);
+                coolAccount(idNum);
                 wcout << "Account " << idNum << " logged out." << endl << endl;
                 delete[] aesKey;
                 delete[] iv;
@@ -709,127 +1271,111 @@ bool serverTransfer(http_request request) {
             return false;
         }
         else {
-            Account* accFrom = dat->getAccount(idFrom, *context);
-            Account* accTo = dat->getAccount(idTo, *context);
-            if (accTo == nullptr) {
-                wcout << "Attempt to send money to invalid account with ID " << idTo << "." << endl << endl;
-                request.reply(status_codes::BadRequest, L"Invalid recipient account selected. You cannot choose this account as a recipient.");
-                delete accFrom;
-                delete accTo;
+            wstring amount = request.extract_utf16string().get();
+            double am = 0.0;
+            try {
+                am = stod(aesDecrypt(amount, aesKey, iv));
+            }
+            catch (exception& e) {
+                cout << "Unable to read the amount desired to be sent." << endl;
+                request.reply(status_codes::BadRequest, L"Invalid amount to be sent.");
                 return false;
             }
-            else {
-                wstring amount = request.extract_utf16string().get();
-                double am = 0.0;
-                try {
-                    am = stod(aesDecrypt(amount, aesKey, iv));
-                }
-                catch (exception& e) {
-                    cout << "Unable to read the amount desired to be sent." << endl;
-                    request.reply(status_codes::BadRequest, L"Invalid amount to be sent.");
-                    delete accFrom;
-                    delete accTo;
-                    return false;
+            cout << "Amount to transfer: " << am << endl;
+            if (!loggedIn.contains(idFrom)) {
+                wcout << "Attempted access to logged out account " << idFrom << "." << endl << endl;
+                request.reply(status_codes::Conflict);
+                return false;
+            }
+            if (loggedIn.at(idFrom).compare(request.get_remote_address()) != 0) {
+                wcout << "Attempted access to account " << idFrom << " from a different IP." << endl << endl;
+                request.reply(status_codes::Conflict);
+                return false;
+            }
+            time_t nowTime = time(nullptr);
+            Deadline deadline = requestDeadline(request);
+            // Account lookup, fetch, balance check and encryption, then the cloud call and reply, each run as a task or continuation so the listener thread never waits on the database or another server
+            pplx::create_task([idFrom, idTo, deadline]() {
+                Deadline::Scope scope(deadline);
+                return make_pair(dat->getAccountRecord(idFrom, *context), dat->getAccountRecord(idTo, *context));
+            }).then([request, idTo, am, nowTime, deadline](pair<shared_ptr<const Account>, shared_ptr<const Account>> accounts) {
+                shared_ptr<const Account> accFrom = accounts.first;
+                shared_ptr<const Account> accTo = accounts.second;
+                if (accTo == nullptr) {
+                    wcout << "Attempt to send money to invalid account with ID " << idTo << "." << endl << endl;
+                    request.reply(status_codes::BadRequest, L"Invalid recipient account selected. You cannot choose this account as a recipient.");
+                    return pplx::task_from_result();
                 }
-                cout << "Amount to transfer: " << am << endl;
-                if (loggedIn.contains(idFrom)) {
-                    if (loggedIn.at(idFrom).compare(request.get_remote_address()) == 0) {
+                wstring balAddress = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(accFrom->getBalanceAddress());
+                return getAmount(balAddress, deadline).then([accFrom, accTo, am, deadline](seal::Ciphertext balance) {
+                    // The balance check and both encryptions run on the HE pool
+                    return heExecutor->submit("transfer", [accFrom, accTo, balance, am, deadline]() {
+                        deadline.check("he queue");
                         seal::CKKSEncoder encoder(*context);
-                        seal::SecretKey secret_keyFrom;
-                        seal::SecretKey secret_keyTo;
-                        string keyAddressFrom = accFrom->getKeyAddress();
-                        string keyAddressTo = accTo->getKeyAddress();
-                        ifstream keyIn(keyAddressFrom, std::ios::binary);
-                        secret_keyFrom.load(*context, keyIn);
-                        keyIn.close();
-                        ifstream keyIn2(keyAddressTo, std::ios::binary);
-                        secret_keyTo.load(*context, keyIn2);
-                        keyIn2.close();
-                        seal::Encryptor encryptorFrom(*context, secret_keyFrom);
-                        seal::Encryptor encryptorTo(*context, secret_keyTo);
-                        seal::Decryptor decryptor(*context, secret_keyFrom);
-                        seal::Plaintext plaintext;
-                        seal::Ciphertext ciphertext;
+                        shared_ptr<const seal::SecretKey> secret_keyFrom = secretKeys.get(accFrom->getKeyAddress(), *context);
+                        shared_ptr<const seal::SecretKey> secret_keyTo = secretKeys.get(accTo->getKeyAddress(), *context);
+                        seal::Encryptor encryptorFrom(*context, *secret_keyFrom);
+                        seal::Encryptor encryptorTo(*context, *secret_keyTo);
+                        seal::Decryptor decryptor(*context, *secret_keyFrom);
+                        TransferLegs legs;
                         double scale = pow(2, 20);
-                        encoder.encode(am, scale, plaintext);
-                        encryptorFrom.encrypt_symmetric(plaintext, ciphertext);
-                        time_t nowTime = time(nullptr);
-                        transactionID = dat->getTransactionID() + 1;
-                        wstring fileName = to_wstring(idFrom) + L"'" + to_wstring(idTo) + L"'" + to_wstring(transactionID) + L".txt";
-                        std::ofstream outFile(fileName, std::ios::binary);
-                        ciphertext.save(outFile);
-                        outFile.close();
-                        wstring balAddress = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(accFrom->getBalanceAddress());
-                        vector<double> res;
-                        status_code code = getAmount(balAddress, ciphertext);
-                        if (code != status_codes::OK) {
-                            cout << "Could not access balance on cloud server." << endl;
-                            delete accFrom;
-                            delete accTo;
-                            request.reply(status_codes::InternalError);
+                        double available = ScalarDecoder(*context).decrypt(decryptor, balance);
+                        legs.funded = am <= available + accFrom->getOverdraft() && am > 0.00999;
+                        if (legs.funded) {
+                            // Debit leg under the sender's key, credit leg (negated) under the recipient's key
+                            zeroPool->encrypt(accFrom->getKeyAddress(), am, scale, encoder, encryptorFrom, legs.from);
+                            zeroPool->encrypt(accTo->getKeyAddress(), -am, scale, encoder, encryptorTo, legs.to);
                         }
-                        remove(std::wstring_convert<std::codecvt_utf8<wchar_t>>().to_bytes(balAddress).c_str());
-                        decryptor.decrypt(ciphertext, plaintext);
-                        encoder.decode(plaintext, res);
-                        if (am <= res[0] + accFrom->getOverdraft() && am > 0.00999) {
-                            // Send the first file
-                            http_client client2(cloudDNS + L":8081/transfer");
-                            auto f = file_stream<char>::open_istream(fileName, std::ios::binary).get();
-                            wstring toSendFile = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(accFrom->getBalanceAddress()) + L"," + std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(accTo->getBalanceAddress()) + L"," + fileName;
-                            auto response = client2.request(methods::PUT, toSendFile, f.streambuf()).get();
-                            if (response.status_code() == status_codes::OK) {
-                                // Send the second file
-                                am = -am;
-                                encoder.encode(am, scale, plaintext);
-                                encryptorTo.encrypt_symmetric(plaintext, ciphertext);
-                                fileName = to_wstring(idTo) + L"'" + to_wstring(idFrom) + L"'" + to_wstring(transactionID) + L".txt";
-                                ofstream outFile2(fileName, std::ios::binary);
-                                ciphertext.save(outFile2);
-                                outFile2.close();
-                                toSendFile = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(accTo->getBalanceAddress()) + L"," + std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(accFrom->getBalanceAddress()) + L"," + fileName;
-                                f = file_stream<char>::open_istream(fileName, std::ios::binary).get();
-                                response = client2.request(methods::PUT, toSendFile, f.streambuf()).get();
-                                if (response.status_code() == status_codes::OK) {
-                                    dat->logTransaction(accFrom, accTo, nowTime, transactionID);
-                                    cout << "Transferred successful from " << idFrom << " to " << idTo << " for amount " << (char)156 << -am << "." << endl << endl;
-                                    request.reply(status_codes::OK);
-                                    delete accFrom;
-                                    delete accTo;
-                                    return true;
-                                }
-                            }
+                        return legs;
+                    });
+                }).then([request, accFrom, accTo, balAddress, am, nowTime, deadline](TransferLegs legs) {
+                    if (!legs.funded) {
+                        cout << "Attempted transaction with invalid amount." << endl << endl;
+                        request.reply(status_codes::BadRequest, L"You don't have enough in your account. Please try again.");
+                        return pplx::task_from_result();
+                    }
+                    int idFrom = accFrom->getId();
+                    int idTo = accTo->getId();
+                    deadline.check("db");
+                    int transactionID = dat->allocateTransactionIDs();
+                    wstring fileNameFrom = to_wstring(idFrom) + L"'" + to_wstring(idTo) + L"'" + to_wstring(transactionID) + L".txt";
+                    wstring fileNameTo = to_wstring(idTo) + L"'" + to_wstring(idFrom) + L"'" + to_wstring(transactionID) + L".txt";
+                    wstring balAddressTo = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(accTo->getBalanceAddress());
+                    return sendTransferToCloud(balAddress, balAddressTo, fileNameFrom, fileNameTo, legs.from, legs.to, deadline).then([request, accFrom, accTo, am, nowTime, transactionID](http::status_code code) {
+                        if (code != status_codes::OK) {
                             cout << "Error on cloud server." << endl;
                             request.reply(status_codes::InternalError);
-                            delete accFrom;
-                            delete accTo;
-                            return false;
-                        }
-                        else {
-                            cout << "Attempted transaction with invalid amount." << endl << endl;
-                            request.reply(status_codes::BadRequest, L"You don't have enough in your account. Please try again.");
-                            delete accFrom;
-                            delete accTo;
-                            return false;
+                            return pplx::task_from_result();
                         }
-                    }
-                    else {
-                        wcout << "Attempted access to account " << idFrom << " from a different IP." << endl << endl;
-                        request.reply(status_codes::Conflict);
-                        delete accFrom;
-                        delete accTo;
-                        return false;
-                    }
+                        return dat->logTransaction(accFrom.get(), accTo.get(), nowTime, transactionID).then([request, accFrom, accTo, am, transactionID](bool logged) {
+                            if (!logged) {
+                                // The money has moved, so the client is still told the transfer succeeded
+                                cout << "Transfer " << transactionID << " was applied but could not be recorded in the transaction history." << endl;
+                            }
+                            cout << "Transferred successful from " << accFrom->getId() << " to " << accTo->getId() << " for amount " << (char)156 << am << "." << endl << endl;
+                            request.reply(status_codes::OK);
+                        });
+                    });
+                });
+            }).then([request](pplx::task<void> done) {
+                try {
+                    done.get();
                 }
-                else {
-                    wcout << "Attempted access to logged out account " << idFrom << "." << endl << endl;
-                    request.reply(status_codes::Conflict);
-                    delete accFrom;
-                    delete accTo;
-                    return false;
+                catch (HEExecutor::Busy& e) {
+                    cout << "Transfer turned away: " << e.what() << endl;
+                    request.reply(status_codes::ServiceUnavailable, L"The server is busy. Please try again shortly.");
                 }
-            }
-            delete accFrom;
-            delete accTo;
+                catch (DeadlineExceeded& e) {
+                    cout << e.what() << endl;
+                    request.reply(status_codes::GatewayTimeout, L"The request took too long. Please try again.");
+                }
+                catch (exception& e) {
+                    cout << "Internal error occurred." << endl;
+                    cout << e.what() << endl << endl;
+                    request._reply_if_not_already(status_codes::InternalError);
+                }
+            });
+            return true;
         }
     }
     catch (exception& e) {
@@ -848,6 +1394,263 @@ bool serverTransfer(http_request request) {
     }
 }
 
+// Encrypts, sends and logs the chunk of a bulk transfer starting at payment first, then moves on to the next. The cloud applies each chunk
+// atomically under its own journal entry, so a failure leaves earlier chunks applied and later ones untouched. The chain stops at the first chunk that fails
+pplx::task<void> runBulkChunk(shared_ptr<BulkTransfer> bulk, Account* accFrom, size_t first, const Deadline& deadline) {
+    size_t count = min(bulk->chunkSize, bulk->payments.size() - first);
+    if (count == 0) {
+        return pplx::task_from_result();
+    }
+
+    // Encrypt the chunk's debit and credit legs in one task per HE worker, in manifest order. Each task owns its encoder and encryptors
+    shared_ptr<vector<seal::Ciphertext>> legs = make_shared<vector<seal::Ciphertext>>(2 * count);
+    size_t workers = min<size_t>(heExecutor->threads(), count);
+    vector<pplx::task<void>> pool;
+    for (size_t w = 0; w < workers; ++w) {
+        pool.push_back(heExecutor->submit("bulk encrypt", [bulk, accFrom, legs, w, workers, first, count, deadline]() {
+            deadline.check("he queue");
+            try {
+                seal::CKKSEncoder workerEncoder(*context);
+                map<string, unique_ptr<seal::Encryptor>> encryptors;
+                for (auto const& [address, key] : bulk->keys) {
+                    encryptors.insert(make_pair(address, make_unique<seal::Encryptor>(*context, key)));
+                }
+                seal::Plaintext workerPlain;
+                double scale = pow(2, 20);
+                for (size_t i = w; i < count; i += workers) {
+                    pair<int, double>& payment = bulk->payments[first + i];
+                    Account* to = bulk->accounts.at(payment.first);
+                    workerEncoder.encode(payment.second, scale, workerPlain);
+                    encryptors.at(accFrom->getKeyAddress())->encrypt_symmetric(workerPlain, (*legs)[2 * i]);
+                    workerEncoder.encode(-payment.second, scale, workerPlain);
+                    encryptors.at(to->getKeyAddress())->encrypt_symmetric(workerPlain, (*legs)[2 * i + 1]);
+                }
+            }
+            catch (exception& e) {
+                cout << e.what() << endl;
+                bulk->failed = true;
+            }
+        }));
+    }
+    return pplx::when_all(pool.begin(), pool.end()).then([bulk, accFrom, legs, first, count, deadline]() {
+        if (bulk->failed) {
+            throw runtime_error("Encryption failed during bulk transfer");
+        }
+        int idFrom = bulk->idFrom;
+        deadline.check("db");
+        int firstID = dat->allocateTransactionIDs((int)count);
+        time_t nowTime = time(nullptr);
+        vector<pair<string, string>> manifest;
+        vector<pair<Account*, int>> recipients;
+        for (size_t i = 0; i < count; ++i) {
+            Account* to = bulk->accounts.at(bulk->payments[first + i].first);
+            int id = firstID + i;
+            manifest.push_back(make_pair(accFrom->getBalanceAddress(), to_string(idFrom) + "'" + to_string(to->getId()) + "'" + to_string(id) + ".txt"));
+            manifest.push_back(make_pair(to->getBalanceAddress(), to_string(to->getId()) + "'" + to_string(idFrom) + "'" + to_string(id) + ".txt"));
+            recipients.push_back(make_pair(to, id));
+        }
+        return sendBatchToCloud(manifest, legs, deadline).then([bulk, accFrom, recipients, nowTime, first, count, deadline](http::status_code code) {
+            if (code != status_codes::OK) {
+                throw runtime_error("Cloud server rejected bulk transfer chunk with status " + to_string(code));
+            }
+            bulk->applied += count;
+            return dat->logBulkTransaction(accFrom, recipients, nowTime).then([bulk, accFrom, first, count, deadline](bool logged) {
+                if (!logged) {
+                    // The money has moved, so the chunk still counts as applied
+                    cout << "Could not record payments " << first + 1 << "-" << first + count << " of bulk transfer from " << bulk->idFrom << " in the transaction history." << endl;
+                }
+                return runBulkChunk(bulk, accFrom, first + count, deadline);
+            });
+        });
+    });
+}
+
+// Reply to a bulk transfer. The first line is "applied,total" and each following line gives one chunk's payments and whether they were
+// applied, failed or not attempted. When stopped is true the chunk after the last applied one is the one that failed
+string bulkReport(const BulkTransfer& bulk, bool stopped) {
+    size_t total = bulk.payments.size();
+    string report = to_string(bulk.applied) + "," + to_string(total) + "\n";
+    size_t chunk = 1;
+    for (size_t first = 0; first < total; first += bulk.chunkSize, ++chunk) {
+        size_t last = min(first + bulk.chunkSize, total);
+        string state = first < bulk.applied ? "applied" : (stopped && first == bulk.applied) ? "failed" : "not attempted";
+        report += "Chunk " + to_string(chunk) + ": payments " + to_string(first + 1) + "-" + to_string(last) + " " + state + "\n";
+    }
+    return report;
+}
+
+// Receive a bulk (payroll-style) transfer from one sender to many recipients. The sender balance is fetched and checked once against the whole batch,
+// then the payments are encrypted and applied by the cloud server in chunks of bulkChunkPayments. The reply reports each chunk's result
+bool serverBulkTransfer(http_request request) {
+    try {
+        wstring ip = request.get_remote_address();
+        unsigned char* aesKey = new unsigned char[2];
+        unsigned char* iv = new unsigned char[2];
+        try {
+            aesKey = ipsAndKeys.at(ip);
+        }
+        catch (exception& e) {
+            cout << e.what() << endl;
+            delete[] aesKey;
+            request.reply(status_codes::Forbidden, L"Invalid login credentials");
+            return false;
+        }
+        try {
+            iv = ipsAndIvs.at(ip);
+        }
+        catch (exception& e) {
+            delete[] iv;
+            delete[] aesKey;
+            cout << e.what() << endl;
+            request.reply(status_codes::Forbidden, L"Invalid login credentials");
+            return false;
+        }
+        wstring uri = request.relative_uri().to_string();
+        uri = uri.substr(1, uri.length());
+        int idFrom = 0;
+        try {
+            idFrom = stoi(aesDecrypt(uri, aesKey, iv));
+        }
+        catch (exception& e) {
+            cout << "Invalid account ID on bulk transfer." << endl;
+            request.reply(status_codes::Forbidden, L"Invalid login credentials");
+            return false;
+        }
+        if (!loggedIn.contains(idFrom) || loggedIn.at(idFrom).compare(ip) != 0) {
+            wcout << "Attempted bulk transfer from logged out account " << idFrom << "." << endl << endl;
+            request.reply(status_codes::Conflict);
+            return false;
+        }
+
+        // Payments arrive as "recipient,amount;" pairs
+        string payload = aesDecrypt(request.extract_utf16string().get(), aesKey, iv);
+        vector<pair<int, double>> payments;
+        vector<int> ids;
+        ids.push_back(idFrom);
+        double total = 0.0;
+        stringstream payloadIn(payload);
+        string entry;
+        while (getline(payloadIn, entry, ';')) {
+            if (entry.empty()) {
+                continue;
+            }
+            int index = entry.find_first_of(",");
+            int idTo = stoi(entry.substr(0, index));
+            double am = stod(entry.substr(index + 1, entry.length()));
+            if (idTo == 1 || idTo == idFrom || am <= 0.00999) {
+                cout << "Bulk transfer from account " << idFrom << " contains an invalid payment." << endl << endl;
+                request.reply(status_codes::BadRequest, L"Invalid payment in bulk transfer. Please check the recipients and amounts.");
+                return false;
+            }
+            payments.push_back(make_pair(idTo, am));
+            ids.push_back(idTo);
+            total += am;
+        }
+        if (payments.empty()) {
+            request.reply(status_codes::BadRequest, L"No payments were included in the bulk transfer.");
+            return false;
+        }
+
+        shared_ptr<BulkTransfer> bulk = make_shared<BulkTransfer>();
+        bulk->idFrom = idFrom;
+        bulk->total = total;
+        bulk->payments = payments;
+        bulk->chunkSize = bulkChunkPayments;
+        // Look up every account and load each distinct secret key once, then fetch and decrypt the sender balance once and check the overdraft against the whole batch.
+        // The lookup can reach the database and keys of recipients who are not logged in are read from disk, so both run as a task rather than on the listener thread
+        Deadline deadline = requestDeadline(request);
+        pplx::create_task([bulk, ids, deadline]() {
+            Deadline::Scope scope(deadline);
+            bulk->accounts = dat->getAccounts(ids, *context);
+            for (int id : ids) {
+                if (!bulk->accounts.contains(id)) {
+                    wcout << "Bulk transfer from account " << bulk->idFrom << " names unknown account " << id << "." << endl << endl;
+                    return false;
+                }
+            }
+            for (auto const& [id, account] : bulk->accounts) {
+                if (!bulk->keys.contains(account->getKeyAddress())) {
+                    bulk->keys.insert(make_pair(account->getKeyAddress(), *secretKeys.get(account->getKeyAddress(), *context)));
+                }
+            }
+            return true;
+        }).then([request, bulk, deadline](bool known) {
+            if (!known) {
+                request.reply(status_codes::BadRequest, L"Invalid recipient account selected. You cannot choose this account as a recipient.");
+                return pplx::task_from_result();
+            }
+            Account* accFrom = bulk->accounts.at(bulk->idFrom);
+            wstring balAddress = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(accFrom->getBalanceAddress());
+            return getAmount(balAddress, deadline).then([bulk, accFrom, deadline](seal::Ciphertext balance) {
+                return heExecutor->submit("decrypt balance", [bulk, accFrom, balance, deadline]() {
+                    deadline.check("he queue");
+                    seal::Decryptor decryptor(*context, bulk->keys.at(accFrom->getKeyAddress()));
+                    return ScalarDecoder(*context).decrypt(decryptor, balance);
+                });
+            }).then([request, bulk, accFrom, deadline](double available) {
+                if (bulk->total > available + accFrom->getOverdraft()) {
+                    cout << "Attempted bulk transfer exceeding the balance of account " << bulk->idFrom << "." << endl << endl;
+                    request.reply(status_codes::BadRequest, L"You don't have enough in your account. Please try again.");
+                    return pplx::task_from_result();
+                }
+
+                // Payments are encrypted, sent and committed a chunk at a time, so no request to the cloud carries the whole batch
+                bulk->started = true;
+                return runBulkChunk(bulk, accFrom, 0, deadline);
+            });
+        }).then([request, bulk, aesKey, iv](pplx::task<void> done) {
+            try {
+                done.get();
+                if (!bulk->started) {
+                    return;
+                }
+                cout << "Bulk transfer of " << bulk->payments.size() << " payments from " << bulk->idFrom << " for a total of " << (char)156 << bulk->total << "." << endl << endl;
+                request.reply(status_codes::OK, aesEncrypt(bulkReport(*bulk, false), aesKey, iv));
+                return;
+            }
+            catch (HEExecutor::Busy& e) {
+                cout << "Bulk transfer turned away: " << e.what() << endl;
+                if (bulk->applied == 0) {
+                    // Encryption tasks already queued hold their own reference to the transfer, so it is safe to answer now
+                    request.reply(status_codes::ServiceUnavailable, L"The server is busy. Please try again shortly.");
+                    return;
+                }
+            }
+            catch (DeadlineExceeded& e) {
+                cout << e.what() << endl;
+                if (bulk->applied == 0) {
+                    request.reply(status_codes::GatewayTimeout, L"The request took too long. Please try again.");
+                    return;
+                }
+            }
+            catch (exception& e) {
+                cout << "Internal error occurred." << endl;
+                cout << e.what() << endl << endl;
+                if (bulk->applied == 0) {
+                    request._reply_if_not_already(status_codes::InternalError);
+                    return;
+                }
+            }
+            // Earlier chunks are committed, so the client is told exactly which payments went through
+            cout << "Bulk transfer from " << bulk->idFrom << " stopped after " << bulk->applied << " of " << bulk->payments.size() << " payments." << endl << endl;
+            request.reply(status_codes::OK, aesEncrypt(bulkReport(*bulk, true), aesKey, iv));
+        });
+        return true;
+    }
+    catch (exception& e) {
+        string errmsg = e.what();
+        if (errmsg.compare("invalid stoi argument") == 0 || errmsg.compare("invalid stod argument") == 0) {
+            request.reply(status_codes::BadRequest);
+            wcout << "Invalid input in bulk transaction" << endl << endl;
+            return false;
+        }
+        cout << "Internal error occurred." << endl;
+        cout << e.what() << endl << endl;
+        request.reply(status_codes::InternalError);
+        return false;
+    }
+}
+
 // Authenticate user and get their balance from the server. Then send balance to client
 bool serverBalance(http_request request) {
     try {
@@ -888,35 +1691,48 @@ bool serverBalance(http_request request) {
         }
         if (loggedIn.contains(id)) {
             if (loggedIn.at(id).compare(request.get_remote_address()) == 0) {
-                Account* account = dat->getAccount(id, *context);
-                string keyAddress = account->getKeyAddress();
+                shared_ptr<const Account> account = dat->getAccountRecord(id, *context);
                 wstring balAddress = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(account->getBalanceAddress());
-                ifstream keyIn(keyAddress, std::ios::binary);
-                seal::SecretKey secret_key;
-                secret_key.load(*context, keyIn);
-                keyIn.close();
-                seal::Decryptor decryptor(*context, secret_key);
-                seal::CKKSEncoder encoder(*context);
-                seal::Ciphertext ciphertext;
-                seal::Plaintext plaintext;
-                vector<double> result;
-                http::status_code code = getAmount(balAddress, ciphertext);
-                if (code == status_codes::OK) {
-                    decryptor.decrypt(ciphertext, plaintext);
-                    encoder.decode(plaintext, result);
-                    string toEncrypt = to_string(result[0]);
-                    wstring toSend = aesEncrypt(toEncrypt, aesKey, iv);
-                    request.reply(status_codes::OK, toSend);
-                    std::remove(std::wstring_convert<std::codecvt_utf8<wchar_t>>().to_bytes(balAddress).c_str());
-                    delete account;
-                    return true;
-                }
-                else {
-                    cout << "Information for " << id << " not found on cloud server." << endl;
-                    request.reply(status_codes::NotFound, "Cannot locate account. Please contact an administrator.");
-                    delete account;
-                    return false;
-                }
+                // The fetch completes on a cloud I/O continuation, decryption runs on the HE pool and the reply is sent from its continuation
+                Deadline deadline = requestDeadline(request);
+                getAmount(balAddress, deadline).then([request, account, id, aesKey, iv, deadline](pplx::task<seal::Ciphertext> fetched) {
+                    seal::Ciphertext ciphertext;
+                    try {
+                        ciphertext = fetched.get();
+                    }
+                    catch (DeadlineExceeded& e) {
+                        throw;
+                    }
+                    catch (exception& e) {
+                        cout << "Information for " << id << " not found on cloud server." << endl;
+                        request.reply(status_codes::NotFound, "Cannot locate account. Please contact an administrator.");
+                        return pplx::task_from_result();
+                    }
+                    return heExecutor->submit("decrypt balance", [account, ciphertext, deadline]() {
+                        deadline.check("he queue");
+                        seal::Decryptor decryptor(*context, *secretKeys.get(account->getKeyAddress(), *context));
+                        return ScalarDecoder(*context).decrypt(decryptor, ciphertext);
+                    }).then([request, aesKey, iv](double balance) {
+                        request.reply(status_codes::OK, aesEncrypt(to_string(balance), aesKey, iv));
+                    });
+                }).then([request](pplx::task<void> done) {
+                    try {
+                        done.get();
+                    }
+                    catch (HEExecutor::Busy& e) {
+                        cout << "Balance request turned away: " << e.what() << endl;
+                        request.reply(status_codes::ServiceUnavailable, L"The server is busy. Please try again shortly.");
+                    }
+                    catch (DeadlineExceeded& e) {
+                        cout << e.what() << endl;
+                        request.reply(status_codes::GatewayTimeout, L"The request took too long. Please try again.");
+                    }
+                    catch (exception& e) {
+                        cout << e.what() << endl;
+                        request._reply_if_not_already(status_codes::InternalError);
+                    }
+                });
+                return true;
             }
             else {
                 wcout << "Attempted access to account " << idTo << " from a different IP." << endl << endl;
@@ -963,11 +1779,37 @@ bool serverHistory(http_request request) {
             request.reply(status_codes::Forbidden, L"Invalid login credentials");
             return false;
         }
-        wstring idTo = request.relative_uri().to_string();
-        idTo = idTo.substr(1, idTo.length());
+        // URI is the encrypted string "id,pageSize,fromTime,toTime,cursor". Everything after the ID is optional; an empty cursor starts at the oldest transaction
+        wstring query = request.relative_uri().to_string();
+        query = query.substr(1, query.length());
         int id = 0;
+        size_t pageSize = 20;
+        time_t fromTime = 0;
+        time_t toTime = LLONG_MAX;
+        time_t afterTime = LLONG_MIN;
+        int afterID = 0;
         try {
-            id = stoi(aesDecrypt(idTo, aesKey, iv));
+            vector<string> fields;
+            stringstream fieldStream(aesDecrypt(query, aesKey, iv));
+            string field;
+            while (getline(fieldStream, field, ',')) {
+                fields.push_back(field);
+            }
+            id = stoi(fields.at(0));
+            if (fields.size() > 1 && !fields[1].empty()) {
+                pageSize = min<size_t>(max(1, stoi(fields[1])), 100);
+            }
+            if (fields.size() > 2 && !fields[2].empty()) {
+                fromTime = stoll(fields[2]);
+            }
+            if (fields.size() > 3 && !fields[3].empty()) {
+                toTime = stoll(fields[3]);
+            }
+            if (fields.size() > 4 && !fields[4].empty()) {
+                int index = fields[4].find_first_of('_');
+                afterTime = stoll(fields[4].substr(0, index));
+                afterID = stoi(fields[4].substr(index + 1, fields[4].length()));
+            }
         }
         catch (exception& e) {
             request.reply(status_codes::Forbidden, L"Invalid login credentials");
@@ -975,53 +1817,67 @@ bool serverHistory(http_request request) {
         }
         if (loggedIn.contains(id)) {
             if (loggedIn.at(id).compare(request.get_remote_address()) == 0) {
-                TransactionList* transactionList = dat->getTransactions(id, *context);
-                std::string details = "";
-                if (transactionList == nullptr) {
-                    details = "No transactions have occurred on this account.";
-                    wstring toSend = aesEncrypt(details, aesKey, iv);
-                    request.reply(status_codes::OK, toSend);
-                    return true;
-                }
-                else {
-                    for (Transaction* transaction : transactionList->getTransactions()) {
-                        details += transaction->printTransaction();
-                        wstring balAddress = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(transaction->getAmount());
-                        Account* account = dat->getAccount(id, *context);
-                        seal::Ciphertext ciphertext;
-                        seal::Plaintext plaintext;
-                        vector<double> res;
-                        seal::SecretKey secret_key;
-                        ifstream keyIn(account->getKeyAddress(), std::ios::binary);
-                        secret_key.load(*context, keyIn);
-                        keyIn.close();
-                        seal::Decryptor decryptor(*context, secret_key);
-                        seal::CKKSEncoder encoder(*context);
-                        http::status_code code = getAmount(balAddress, ciphertext);
-                        if (code != status_codes::OK) {
-                            cout << "Could not access file on cloud server." << endl;
-                            request.reply(status_codes::InternalError);
-                            for (Transaction* t : transactionList->getTransactions()) {
-                                transactions->removeTransaction(t);
+                Deadline deadline = requestDeadline(request);
+                shared_ptr<TransactionPage> page = make_shared<TransactionPage>();
+                // The page and account lookups reach the database, so they run as a task rather than on the listener thread
+                pplx::create_task([id, fromTime, toTime, afterTime, afterID, pageSize, page, deadline]() {
+                    Deadline::Scope scope(deadline);
+                    dat->getTransactionPage(id, fromTime, toTime, afterTime, afterID, pageSize, *context, *page);
+                    return page->transactions.empty() ? shared_ptr<const Account>() : dat->getAccountRecord(id, *context);
+                }).then([id, afterTime, page, deadline](shared_ptr<const Account> account) {
+                    if (page->transactions.empty()) {
+                        return pplx::task_from_result(string(afterTime == LLONG_MIN ? "No transactions have occurred on this account." : "No more transactions."));
+                    }
+                    // Only this page's amounts are fetched, in one cloud round trip
+                    vector<string> names;
+                    vector<string> lines;
+                    for (Transaction* transaction : page->transactions) {
+                        names.push_back(transaction->getAmount());
+                        lines.push_back(transaction->printTransaction());
+                    }
+                    cout << "Account " << id << " requested " << page->transactions.size() << " transactions of their history." << endl << endl;
+                    return getAmounts(names, deadline).then([account, lines, deadline](vector<seal::Ciphertext> amounts) {
+                        return heExecutor->submit("decrypt history", [account, amounts, lines, deadline]() {
+                            deadline.check("he queue");
+                            seal::Decryptor decryptor(*context, *secretKeys.get(account->getKeyAddress(), *context));
+                            ScalarDecoder decoder(*context);
+                            std::string details = "";
+                            for (size_t i = 0; i < lines.size(); ++i) {
+                                details += lines[i];
+                                std::stringstream ss;
+                                ss << fixed << setprecision(2) << abs(decoder.decrypt(decryptor, amounts[i]));
+                                string bal;
+                                ss >> bal;
+                                details += bal;
+                                details += "\n";
                             }
-                            return false;
+                            return details;
+                        });
+                    });
+                }).then([request, aesKey, iv, page](pplx::task<string> decrypted) {
+                    try {
+                        http_response response(status_codes::OK);
+                        response.set_body(aesEncrypt(decrypted.get(), aesKey, iv));
+                        if (page->more) {
+                            response.headers().add(L"X-Next-Cursor", aesEncrypt(to_string(page->lastTime) + "_" + to_string(page->lastID), aesKey, iv));
                         }
-                        decryptor.decrypt(ciphertext, plaintext);
-                        encoder.decode(plaintext, res);
-                        std::stringstream ss;
-                        ss << fixed << setprecision(2) << abs(res[0]);
-                        string bal;
-                        ss >> bal;
-                        details += bal;
-                        details += "\n";
-                        transactions->removeTransaction(transaction);
+                        request.reply(response);
                     }
-                    cout << "Account " << id << " requested their transactions history." << endl << endl;
-                    wstring toSend = aesEncrypt(details, aesKey, iv);
-                    request.reply(status_codes::OK, toSend);
-                    _CrtDumpMemoryLeaks();
-                    return true;
-                }
+                    catch (HEExecutor::Busy& e) {
+                        cout << "History request turned away: " << e.what() << endl;
+                        request.reply(status_codes::ServiceUnavailable, L"The server is busy. Please try again shortly.");
+                    }
+                    catch (DeadlineExceeded& e) {
+                        cout << e.what() << endl;
+                        request.reply(status_codes::GatewayTimeout, L"The request took too long. Please try again.");
+                    }
+                    catch (exception& e) {
+                        cout << "Could not access file on cloud server." << endl;
+                        cout << e.what() << endl;
+                        request.reply(status_codes::InternalError);
+                    }
+                });
+                return true;
             }
         }
         request.reply(status_codes::Forbidden, L"Invalid login credentials");
@@ -1035,6 +1891,11 @@ bool serverHistory(http_request request) {
     }
 }
 
+// Replaces the debit routes while backend=memory. The debit server keeps its own in-memory store, so a debit added here would never fire
+void rejectDebits(http_request request) {
+    request.reply(status_codes::NotImplemented, L"Direct debits are not available on this server.");
+}
+
 // Authenticate user and collect debits on account from the cloud server. Send these to the requesting client
 bool serverDebits(http_request request) {
     try {
@@ -1072,48 +1933,63 @@ bool serverDebits(http_request request) {
             request.reply(status_codes::Forbidden, L"Invalid login credentials");
             return false;
         }
-        string details = "";
         if (loggedIn.contains(id)) {
             if (loggedIn.at(id).compare(request.get_remote_address()) == 0) {
-                DebitList* debits = dat->queryDebits(*context);
-                if (debits == nullptr) {
-                    details = "No debits exist on this account.\n";
+                vector<DirectDebit*> debits = dat->queryDebitsByOwner(id, *context);
+                if (debits.empty()) {
+                    request.reply(status_codes::OK, aesEncrypt("No debits exist on this account.\n", aesKey, iv));
+                    return true;
                 }
-                else {
-                    int counter = 0;
-                    for (DirectDebit* debit : debits->getDebits()) {
-                        if (debit->getFrom()->getId() == id) {
-                            counter++;
-                            details += debit->printDebitInfo();
-                            seal::Ciphertext ciphertext;
-                            wstring balAddress = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(debit->getAmountAddress());
-                            getAmount(balAddress, ciphertext);
-                            seal::SecretKey secret_key;
-                            ifstream keyIn(debit->getFrom()->getKeyAddress(), std::ios::binary);
-                            secret_key.load(*context, keyIn);
-                            keyIn.close();
-                            seal::Plaintext plaintext;
-                            seal::CKKSEncoder encoder(*context);
-                            seal::Decryptor decryptor(*context, secret_key);
-                            vector<double> res;
-                            decryptor.decrypt(ciphertext, plaintext);
-                            encoder.decode(plaintext, res);
+                // Every debit here belongs to the same owner, so their key is loaded once. The amounts come from the cloud in one batch
+                string keyAddress = debits.front()->getFrom()->getKeyAddress();
+                vector<string> names;
+                vector<string> lines;
+                for (DirectDebit* debit : debits) {
+                    names.push_back(debit->getAmountAddress());
+                    lines.push_back(debit->printDebitInfo());
+                }
+                delete debits.front()->getFrom();
+                for (DirectDebit* debit : debits) {
+                    delete debit->getTo();
+                    delete debit;
+                }
+                Deadline deadline = requestDeadline(request);
+                getAmounts(names, deadline).then([keyAddress, lines, deadline](vector<seal::Ciphertext> amounts) {
+                    return heExecutor->submit("decrypt debits", [keyAddress, amounts, lines, deadline]() {
+                        deadline.check("he queue");
+                        seal::Decryptor decryptor(*context, *secretKeys.get(keyAddress, *context));
+                        ScalarDecoder decoder(*context);
+                        string details = "";
+                        for (size_t i = 0; i < lines.size(); ++i) {
+                            details += lines[i];
                             std::stringstream ss;
-                            ss << fixed << setprecision(2) << abs(res[0]);
+                            ss << fixed << setprecision(2) << abs(decoder.decrypt(decryptor, amounts[i]));
                             string result;
                             ss >> result;
                             details += result;
                             details += " \n";
-                            remove(std::wstring_convert<std::codecvt_utf8<wchar_t>>().to_bytes(balAddress).c_str());
                         }
+                        return details;
+                    });
+                }).then([request, aesKey, iv](pplx::task<string> decrypted) {
+                    try {
+                        request.reply(status_codes::OK, aesEncrypt(decrypted.get(), aesKey, iv));
                     }
-                }
-                if (details.compare("") == 0) {
-                    details = "No debits exist on this account.\n";
-                }
-                wstring toSend = aesEncrypt(details, aesKey, iv);
-                request.reply(status_codes::OK, toSend);
-                delete debits;
+                    catch (HEExecutor::Busy& e) {
+                        cout << "Debit request turned away: " << e.what() << endl;
+                        request.reply(status_codes::ServiceUnavailable, L"The server is busy. Please try again shortly.");
+                    }
+                    catch (DeadlineExceeded& e) {
+                        cout << e.what() << endl;
+                        request.reply(status_codes::GatewayTimeout, L"The request took too long. Please try again.");
+                    }
+                    catch (exception& e) {
+                        cout << "Internal error occurred: " << endl;
+                        cout << e.what() << endl;
+                        cout << "This is probably due to a necessary file being missing on the cloud server." << endl;
+                        request.reply(status_codes::InternalError);
+                    }
+                });
                 return true;
             }
         }
@@ -1196,7 +2072,6 @@ bool serverAddDebits(http_request request) {
                     request.reply(status_codes::BadRequest, L"Invalid recipient account. Please try again.");
                     return false;
                 }
-                DebitList* debitList = dat->queryDebits(*context);
                 bool exists = false;
                 if (to == nullptr) {
                     cout << "Attempting to send money to an invalid account." << endl;
@@ -1220,11 +2095,7 @@ bool serverAddDebits(http_request request) {
                         request.reply(status_codes::BadRequest, L"Invalid regularity. Please try again.");
                         return false;
                     }
-                        seal::SecretKey secret_key;
-                        ifstream keyIn(from->getKeyAddress(), std::ios::binary);
-                        secret_key.load(*context, keyIn);
-                        keyIn.close();
-                        seal::Encryptor encryptor(*context, secret_key);
+                        seal::Encryptor encryptor(*context, *secretKeys.get(from->getKeyAddress(), *context));
                         seal::CKKSEncoder encoder(*context);
                         double amount = 0.0;
                         try {
@@ -1236,32 +2107,45 @@ bool serverAddDebits(http_request request) {
                         }
                         if (amount != 0.0) {
                             double scale = pow(2, 20);
-                            seal::Plaintext plaintext;
-                            encoder.encode(amount, scale, plaintext);
                             seal::Ciphertext ciphertext;
-                            encryptor.encrypt_symmetric(plaintext, ciphertext);
+                            zeroPool->encrypt(from->getKeyAddress(), amount, scale, encoder, encryptor, ciphertext);
                             time_t nowTime = time(nullptr);
                             string address = to_string(id) + "'" + std::wstring_convert<std::codecvt_utf8<wchar_t>>().to_bytes(idString) + "'" + to_string(nowTime) + ".txt";
                             ofstream outFile(address, std::ios::binary);
                             ciphertext.save(outFile);
                             outFile.close();
-                            wstring toSend = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(address);
-                            http_client client(cloudDNS + L":8081/debits");
-                            auto f = file_stream<char>::open_istream(toSend, std::ios::binary).get();
-                            auto response = client.request(methods::POST, toSend, f.streambuf());
-                            if (response.get().status_code() == status_codes::OK) {
-                                DirectDebit* debit = new DirectDebit(0, from, to, address, expression, nowTime);
-                                dat->addDebit(debit, regString, *context, *params);
-                                cout << "Direct debit created from account " << from->getId() << " to account " << to->getId() << endl;
-                                delete debit;
-                                request.reply(status_codes::OK, L"Debit created successfully!");
+                            stringstream body(std::ios::in | std::ios::out | std::ios::binary);
+                            ciphertext.save(body);
+                            string bytes = body.str();
+                            http_request cloudRequest(methods::POST);
+                            cloudRequest.set_request_uri(std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(address));
+                            cloudRequest.set_body(vector<unsigned char>(bytes.begin(), bytes.end()));
+                            requestDeadline(request).send(cloudDNS + L":8081/debits", cloudRequest, "cloud debit").then([request, from, to, address, expression, regString, nowTime](pplx::task<http_response> response) {
+                                try {
+                                    if (response.get().status_code() == status_codes::OK) {
+                                        DirectDebit* debit = new DirectDebit(0, from, to, address, expression, cron::cron_next(expression, nowTime));
+                                        dat->addDebit(debit, regString, *context, *params);
+                                        notifyDebitScheduler(methods::POST, L"/" + to_wstring(debit->getId()) + L"," + to_wstring(debit->getTimeSet()));
+                                        cout << "Direct debit created from account " << from->getId() << " to account " << to->getId() << endl;
+                                        delete debit;
+                                        request.reply(status_codes::OK, L"Debit created successfully!");
+                                    }
+                                    else {
+                                        request.reply(status_codes::InternalError, L"Internal error when locating your files. Please contact an administrator");
+                                    }
+                                }
+                                catch (DeadlineExceeded& e) {
+                                    cout << e.what() << endl;
+                                    request.reply(status_codes::GatewayTimeout, L"The request took too long. Please try again.");
+                                }
+                                catch (exception& e) {
+                                    cout << "Could not store debit on cloud server: " << e.what() << endl;
+                                    request.reply(status_codes::InternalError, L"Internal error when locating your files. Please contact an administrator");
+                                }
                                 delete from;
                                 delete to;
-                                delete debitList;
-                                return true;
-                            }
-                            request.reply(status_codes::InternalError, L"Internal error when locating your files. Please contact an administrator");
-                            return false;
+                            });
+                            return true;
                         }
                     }
             }
@@ -1330,41 +2214,30 @@ bool serverRemoveDebit(http_request request) {
                     delete acc;
                     return false;
                 }
-                DebitList* debits = dat->queryDebits(*context);
-                if (debits == nullptr) {
-                    delete acc;
-                    delete debits;
-                    cout << "No debits exist to check" << endl;
-                    request.reply(status_codes::NotFound, L"Invalid debit ID");
-                    return false;
-                }
-                else {
-                    for (DirectDebit* d : debits->getDebits())
-                    {
-                        if (d->getId() == deb) {
-                            if (d->getFrom()->getId() == id) {
-                                dat->removeDebit(d->getId());
-                                std::string address = d->getAmountAddress();
-                                wstring add = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(address);
-                                cout << address << endl;
-
-                                http_client client(cloudDNS + L":8081/debits");
-                                debits->removeDebit(d);
-                                remove(address.c_str());
-                                cout << "Deleted debit with ID" << id << endl;
-                                request.reply(status_codes::OK, L"Debit deleted!");
-                                delete debits;
-                                delete acc;
-                                return true;
-                            }
-                        }
-                    }
+                DirectDebit* d = dat->getDebit(deb, *context);
+                if (d == nullptr || d->getFrom()->getId() != id) {
                     cout << "Debit not found" << endl;
                     request.reply(status_codes::NotFound, L"Invalid debit ID");
-                    delete debits;
+                    if (d != nullptr) {
+                        delete d->getFrom();
+                        delete d->getTo();
+                        delete d;
+                    }
                     delete acc;
                     return false;
                 }
+                dat->removeDebit(d->getId());
+                notifyDebitScheduler(methods::DEL, L"/" + to_wstring(d->getId()));
+                std::string address = d->getAmountAddress();
+                cout << address << endl;
+                remove(address.c_str());
+                cout << "Deleted debit with ID" << id << endl;
+                request.reply(status_codes::OK, L"Debit deleted!");
+                delete d->getFrom();
+                delete d->getTo();
+                delete d;
+                delete acc;
+                return true;
             }
         }
         request.reply(status_codes::Forbidden, L"Invalid login credentials");
@@ -1394,7 +2267,7 @@ bool replyToHeartbeat(http_request request) {
 
 // Check that logged in users have sent a heartbeat in the last 15 seconds. If not, forcibly log them out
 void checkHeartbeats() {
-    while (true) {
+    while (!shutdownRequested) {
         try {
             for (auto const& [ip, lastHeartbeat] : heartbeats) {
                 if (lastHeartbeat < time(nullptr) - 15) {
@@ -1405,6 +2278,7 @@ void checkHeartbeats() {
                         if (ip2.compare(ip) == 0) {
                             heartbeats.erase(ip);
                             loggedIn.erase(id);
+                            coolAccount(id);
                             ipsAndIvs.erase(ip);
                             ipsAndKeys.erase(ip);
                             cout << "Logged out account " << to_string(id) << endl;
@@ -1412,7 +2286,24 @@ void checkHeartbeats() {
                     }
                 }
             }
-            _sleep(14800);
+            dat->printMetrics();
+            if (heExecutor != nullptr) {
+                heExecutor->printMetrics();
+            }
+            if (admission != nullptr) {
+                admission->printMetrics();
+            }
+            DeadlineExceeded::printMetrics();
+            balanceFetches.printMetrics();
+            if (balanceCache != nullptr) {
+                balanceCache->printMetrics();
+            }
+            secretKeys.printMetrics();
+            if (zeroPool != nullptr) {
+                zeroPool->printMetrics();
+            }
+            unique_lock<mutex> guard(shutdownLock);
+            shutdownSignal.wait_for(guard, chrono::milliseconds(14800), []() { return shutdownRequested.load(); });
         }
         catch (exception& e) {
             cout << e.what() << endl;
@@ -1422,6 +2313,12 @@ void checkHeartbeats() {
 
 int main()
 {
+#ifdef _WIN32
+    SetConsoleCtrlHandler(onConsoleEvent, TRUE);
+#else
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+#endif
     std::thread heartbeatThread(checkHeartbeats);
 
     try {
@@ -1431,31 +2328,58 @@ int main()
             seal::SEALContext con(*params);
             context = new seal::SEALContext(con);
         } while (false);
-        dat->connectToDB();
-        transactionID = dat->getTransactionID();
+        DBConfig dbConfig = readDBConfig();
+        StorageBackend* store = nullptr;
+        if (dbConfig.inMemory) {
+            store = new MemoryBackend("memorySeed.txt");
+        }
+        else {
+            store = new MySQLBackend(dbConfig.poolSize, dbConfig.waitTimeoutMs, dbConfig.statementTimeoutMs);
+        }
+        dat->connectToDB(store, dbConfig.accountCacheSeconds, dbConfig.logDurability, dbConfig.logBatchSize, dbConfig.logMaxQueued, dbConfig.logFlushMs);
+        ComputeConfig computeConfig = readComputeConfig();
+        heExecutor = new HEExecutor(computeConfig.threads, computeConfig.queueCapacity, computeConfig.pin);
+        balanceCache = new CiphertextCache(computeConfig.ciphertextCacheMB * 1024 * 1024);
+        zeroPool = new ZeroPool(*context, computeConfig.zeroPoolDepth, computeConfig.zeroPoolAccounts);
+        bulkChunkPayments = computeConfig.bulkChunkPayments;
+        admission = new AdmissionController(admissionConfig.maxInFlight, chrono::milliseconds(admissionConfig.requestBudgetMs));
+        for (auto const& [route, limits] : admissionConfig.routes) {
+            admission->addRoute(route, limits);
+        }
         http_listener loginListener(serverDNS + L":8080/login");
-        loginListener.support(methods::PUT, serverLogin);
-        loginListener.support(methods::DEL, serverLogout);
+        loginListener.support(methods::PUT, admission->admit("login", whenBodyReady(serverLogin)));
+        loginListener.support(methods::DEL, admission->admit("logout", serverLogout));
 
         http_listener transactionListener(serverDNS + L":8080/transfer");
-        transactionListener.support(methods::POST, serverTransfer);
+        transactionListener.support(methods::POST, admission->admit("transfer", whenBodyReady(serverTransfer)));
+
+        http_listener bulkTransferListener(serverDNS + L":8080/bulktransfer");
+        bulkTransferListener.support(methods::POST, admission->admit("bulktransfer", whenBodyReady(serverBulkTransfer)));
 
         http_listener balanceListener(serverDNS + L":8080/balance");
-        transactionListener.support(methods::GET, serverBalance);
+        transactionListener.support(methods::GET, admission->admit("balance", serverBalance));
 
         http_listener historyListener(serverDNS + L":8080/history");
-        historyListener.support(methods::GET, serverHistory);
+        historyListener.support(methods::GET, admission->admit("history", serverHistory));
 
         http_listener debitListener(serverDNS + L":8080/debits");
-        debitListener.support(methods::GET, serverDebits);
-        debitListener.support(methods::POST, serverAddDebits);
-        debitListener.support(methods::DEL, serverRemoveDebit);
+        if (dbConfig.inMemory) {
+            cout << "Direct debits are disabled: backend=memory is for benchmarks and is not shared with the debit server." << endl;
+            debitListener.support(methods::GET, rejectDebits);
+            debitListener.support(methods::POST, rejectDebits);
+            debitListener.support(methods::DEL, rejectDebits);
+        }
+        else {
+            debitListener.support(methods::GET, admission->admit("debits", serverDebits));
+            debitListener.support(methods::POST, admission->admit("adddebit", whenBodyReady(serverAddDebits)));
+            debitListener.support(methods::DEL, admission->admit("removedebit", whenBodyReady(serverRemoveDebit)));
+        }
 
         http_listener keyListener(serverDNS + L":8080/requestkey");
-        keyListener.support(methods::POST, sendKeys);
+        keyListener.support(methods::POST, admission->admit("requestkey", whenBodyReady(sendKeys)));
 
         http_listener heartbeatListener(serverDNS + L":8080/heartbeat");
-        heartbeatListener.support(methods::GET, replyToHeartbeat);
+        heartbeatListener.support(methods::GET, admission->admit("heartbeat", replyToHeartbeat));
 
         loginListener
             .open()
@@ -1467,6 +2391,11 @@ int main()
             .then([&transactionListener]() {wcout << (L"Starting to listen for transactions") << endl; })
             .wait();
 
+        bulkTransferListener
+            .open()
+            .then([&bulkTransferListener]() {wcout << (L"Starting to listen for bulk transfers") << endl; })
+            .wait();
+
         balanceListener
             .open()
             .then([&balanceListener]() {wcout << (L"Starting to listen for balance requests") << endl; })
@@ -1491,12 +2420,27 @@ int main()
             .open()
             .then([&heartbeatListener]() {wcout << ("Starting to listen for client heartbeats") << endl; })
             .wait();
-        while (true);
-        heartbeatThread.join();
+
+        // Handlers run as continuations on the cpprest pool, so this thread only waits to be told to stop
+        {
+            unique_lock<mutex> guard(shutdownLock);
+            while (!shutdownRequested) {
+                shutdownSignal.wait_for(guard, chrono::seconds(1));
+            }
+        }
+        cout << "Shutting down." << endl;
+        for (http_listener* listener : { &loginListener, &transactionListener, &bulkTransferListener, &balanceListener, &historyListener, &debitListener, &keyListener, &heartbeatListener }) {
+            listener->close().wait();
+        }
+        heExecutor->stop();
+        zeroPool->stop();
+        dat->endConnection();
     }
     catch (exception& e) {
         cout << e.what() << endl;
     }
+    requestShutdown();
+    heartbeatThread.join();
     // Delete all pointers
     delete transactions;
     delete debits;
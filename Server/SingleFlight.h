@@ -0,0 +1,93 @@
+#pragma once
+#include <pplx/pplxtasks.h>
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+
+/* Coalesces concurrent fetches of the same object. The first caller for a key starts the fetch. Callers that arrive while it is
+in flight are handed the same task, so they share one round trip and one deserialisation and each receives its own copy of the
+result. The entry is dropped when the fetch settles, so nothing is cached: a caller arriving afterwards starts a new fetch.
+The first caller's deadline governs the shared fetch, and a failure is delivered to every caller that joined it.*/
+template<typename T>
+class SingleFlight {
+public:
+	SingleFlight() {
+		this->started = 0;
+		this->joined = 0;
+	}
+
+	/* Returns the in-flight task for key, or calls fetch() to start one. fetch runs outside the lock.*/
+	template<typename F>
+	pplx::task<T> run(const std::wstring& key, F fetch) {
+		pplx::task_completion_event<T> done;
+		pplx::task<T> shared;
+		long long flight;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			auto existing = inFlight.find(key);
+			if (existing != inFlight.end()) {
+				joined++;
+				return existing->second.task;
+			}
+			shared = pplx::create_task(done);
+			flight = ++generation;
+			inFlight[key] = Flight{ flight, shared };
+			started++;
+		}
+		try {
+			fetch().then([this, key, flight, done](pplx::task<T> result) {
+				settle(key, flight);
+				try {
+					done.set(result.get());
+				}
+				catch (...) {
+					done.set_exception(std::current_exception());
+				}
+			});
+		}
+		catch (...) {
+			settle(key, flight);
+			done.set_exception(std::current_exception());
+		}
+		return shared;
+	}
+
+	/* Stops later callers joining the fetch in flight for key. Called once the object has been rewritten, so a read that starts after
+	the write never receives data fetched before it.*/
+	void forget(const std::wstring& key) {
+		std::lock_guard<std::mutex> guard(lock);
+		inFlight.erase(key);
+	}
+
+	void printMetrics() {
+		size_t pending;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			pending = inFlight.size();
+		}
+		std::cout << "Single-flight: " << started << " fetches started, " << joined << " callers joined one in flight, " << pending << " in flight" << std::endl;
+	}
+
+private:
+	struct Flight {
+		long long generation;
+		pplx::task<T> task;
+	};
+
+	std::map<std::wstring, Flight> inFlight;
+	std::mutex lock;
+	long long generation = 0;
+	std::atomic<long long> started;
+	std::atomic<long long> joined;
+
+	// Drops the entry only if it is still this fetch's, since forget() may have let a newer fetch take the key
+	void settle(const std::wstring& key, long long flight) {
+		std::lock_guard<std::mutex> guard(lock);
+		auto entry = inFlight.find(key);
+		if (entry != inFlight.end() && entry->second.generation == flight) {
+			inFlight.erase(entry);
+		}
+	}
+};
@@ -0,0 +1,158 @@
+#include "TransactionLogWriter.h"
+#include <iostream>
+
+TransactionLogWriter::TransactionLogWriter(std::function<bool(const std::vector<LogRecord>&)> write, LogDurability durability, size_t maxBatch,
+	size_t maxQueued, std::chrono::milliseconds maxDelay) {
+	this->write = write;
+	this->durability = durability;
+	this->maxBatch = maxBatch;
+	this->maxQueued = maxQueued;
+	this->maxDelay = maxDelay;
+	this->queuedRecords = 0;
+	this->inFlight = 0;
+	this->stopping = false;
+	this->flushing = false;
+	this->appends = 0;
+	this->batches = 0;
+	this->recordsWritten = 0;
+	this->failures = 0;
+	this->dropped = 0;
+	this->totalFlushMicros = 0;
+	this->maxFlushMicros = 0;
+	this->totalCommitMicros = 0;
+	this->maxDepth = 0;
+	this->worker = std::thread([this]() { run(); });
+}
+
+TransactionLogWriter::~TransactionLogWriter() {
+	stop();
+}
+
+pplx::task<bool> TransactionLogWriter::append(std::vector<LogRecord> records) {
+	if (records.empty()) {
+		return pplx::task_from_result(true);
+	}
+	Pending pending{ std::move(records), std::chrono::steady_clock::now() };
+	pplx::task<bool> result = pplx::create_task(pending.done);
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		drained.wait(guard, [this]() { return stopping || queuedRecords < maxQueued; });
+		if (stopping) {
+			std::cout << "Transaction log is closed, " << pending.records.size() << " records not written" << std::endl;
+			return pplx::task_from_result(false);
+		}
+		queuedRecords += pending.records.size();
+		long long depth = queuedRecords;
+		long long previous = maxDepth;
+		while (depth > previous && !maxDepth.compare_exchange_weak(previous, depth));
+		queue.push_back(std::move(pending));
+	}
+	appends++;
+	wake.notify_one();
+	if (durability == LogDurability::Flush) {
+		return result;
+	}
+	return pplx::task_from_result(true);
+}
+
+// Writer thread. Takes whole appends off the queue up to maxBatch records and commits them as one insert
+void TransactionLogWriter::run() {
+	while (true) {
+		std::vector<Pending> batch;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [this]() { return stopping || !queue.empty(); });
+			if (queue.empty()) {
+				return;
+			}
+			if (durability == LogDurability::Enqueue) {
+				// Nobody is waiting on these records, so let the batch fill, but never hold the oldest longer than maxDelay
+				wake.wait_until(guard, queue.front().queued + maxDelay, [this]() { return stopping || flushing || queuedRecords >= maxBatch; });
+			}
+			size_t count = 0;
+			while (!queue.empty() && (batch.empty() || count + queue.front().records.size() <= maxBatch)) {
+				count += queue.front().records.size();
+				batch.push_back(std::move(queue.front()));
+				queue.pop_front();
+			}
+			queuedRecords -= count;
+			inFlight = batch.size();
+		}
+		drained.notify_all();
+
+		std::vector<LogRecord> rows;
+		for (Pending& pending : batch) {
+			rows.insert(rows.end(), pending.records.begin(), pending.records.end());
+		}
+		auto start = std::chrono::steady_clock::now();
+		bool written = false;
+		for (int attempt = 0; attempt < 3 && !written; attempt++) {
+			if (attempt > 0) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(100 * attempt));
+			}
+			try {
+				written = write(rows);
+			}
+			catch (std::exception& e) {
+				std::cout << "Transaction log flush failed: " << e.what() << std::endl;
+			}
+		}
+		auto end = std::chrono::steady_clock::now();
+		long long flushMicros = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+		totalFlushMicros += flushMicros;
+		long long previous = maxFlushMicros;
+		while (flushMicros > previous && !maxFlushMicros.compare_exchange_weak(previous, flushMicros));
+		batches++;
+		if (written) {
+			recordsWritten += rows.size();
+		}
+		else {
+			failures++;
+			dropped += rows.size();
+			std::cout << "Transaction log gave up on " << rows.size() << " records" << std::endl;
+		}
+		for (Pending& pending : batch) {
+			totalCommitMicros += std::chrono::duration_cast<std::chrono::microseconds>(end - pending.queued).count();
+			pending.done.set(written);
+		}
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			inFlight = 0;
+		}
+		drained.notify_all();
+	}
+}
+
+void TransactionLogWriter::flush() {
+	std::unique_lock<std::mutex> guard(lock);
+	flushing = true;
+	wake.notify_one();
+	drained.wait(guard, [this]() { return queue.empty() && inFlight == 0; });
+	flushing = false;
+}
+
+void TransactionLogWriter::stop() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	drained.notify_all();
+	if (worker.joinable()) {
+		worker.join();
+	}
+}
+
+size_t TransactionLogWriter::depth() {
+	std::lock_guard<std::mutex> guard(lock);
+	return queuedRecords;
+}
+
+void TransactionLogWriter::printMetrics() {
+	long long batchCount = batches;
+	long long appendCount = appends;
+	std::cout << "Transaction log: " << depth() << " queued (max " << maxDepth << "), " << recordsWritten << " records in " << batchCount << " commits, "
+		<< (batchCount == 0 ? 0 : totalFlushMicros / batchCount) << "us mean flush, " << maxFlushMicros << "us max flush, "
+		<< (appendCount == 0 ? 0 : totalCommitMicros / appendCount) << "us mean enqueue to commit, "
+		<< failures << " failed commits, " << dropped << " records dropped" << std::endl;
+}
@@ -0,0 +1,170 @@
+#include "ZeroPool.h"
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+ZeroPool::Slot::Slot(const seal::SEALContext& context, std::shared_ptr<const seal::SecretKey> key) : key(key), encryptor(context, *key) {
+	this->used = std::chrono::steady_clock::now();
+}
+
+ZeroPool::ZeroPool(const seal::SEALContext& context, size_t depth, size_t maxKeys) : context(context) {
+	this->depth = depth;
+	this->maxKeys = maxKeys;
+	this->stopping = false;
+	this->hits = 0;
+	this->misses = 0;
+	this->refilled = 0;
+	this->emptied = 0;
+	this->refiller = std::thread([this]() { refill(); });
+}
+
+ZeroPool::~ZeroPool() {
+	stop();
+}
+
+void ZeroPool::track(const std::string& address, std::shared_ptr<const seal::SecretKey> key) {
+	if (depth == 0 || maxKeys == 0 || key == nullptr) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		auto found = slots.find(address);
+		if (found != slots.end()) {
+			found->second->used = std::chrono::steady_clock::now();
+			return;
+		}
+		if (slots.size() >= maxKeys) {
+			auto oldest = slots.begin();
+			for (auto it = slots.begin(); it != slots.end(); ++it) {
+				if (it->second->used < oldest->second->used) {
+					oldest = it;
+				}
+			}
+			slots.erase(oldest);
+		}
+		slots[address] = std::make_shared<Slot>(context, key);
+	}
+	wake.notify_one();
+}
+
+void ZeroPool::untrack(const std::string& address) {
+	std::lock_guard<std::mutex> guard(lock);
+	slots.erase(address);
+}
+
+bool ZeroPool::tracked(const std::string& address) {
+	std::lock_guard<std::mutex> guard(lock);
+	return slots.contains(address);
+}
+
+bool ZeroPool::take(const std::string& address, seal::Ciphertext& zero) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		auto found = slots.find(address);
+		if (found == slots.end() || found->second->zeros.empty()) {
+			if (found != slots.end()) {
+				emptied++;
+			}
+			misses++;
+			return false;
+		}
+		Slot& slot = *found->second;
+		zero = std::move(slot.zeros.front());
+		slot.zeros.pop_front();
+		slot.used = std::chrono::steady_clock::now();
+		hits++;
+	}
+	wake.notify_one();
+	return true;
+}
+
+void ZeroPool::encrypt(const std::string& address, double value, double scale, seal::CKKSEncoder& encoder, seal::Encryptor& encryptor, seal::Ciphertext& destination) {
+	seal::Plaintext plaintext;
+	encoder.encode(value, scale, plaintext);
+	if (take(address, destination)) {
+		// A fresh zero is at the top level with scale 1; only the scale needs to match the plaintext
+		destination.scale() = plaintext.scale();
+		seal::Evaluator evaluator(context);
+		evaluator.add_plain_inplace(destination, plaintext);
+	}
+	else {
+		encryptor.encrypt_symmetric(plaintext, destination);
+	}
+}
+
+// Tops up every tracked key one zero at a time, so a newly tracked key is not starved behind one with an empty pool
+void ZeroPool::refill() {
+	while (true) {
+		std::vector<std::pair<std::string, std::shared_ptr<Slot>>> low;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			if (stopping) {
+				return;
+			}
+			for (auto& [address, slot] : slots) {
+				if (slot->zeros.size() < depth) {
+					low.push_back(std::make_pair(address, slot));
+				}
+			}
+			if (low.empty()) {
+				wake.wait_for(guard, std::chrono::seconds(1));
+				continue;
+			}
+		}
+		while (!low.empty()) {
+			std::vector<std::pair<std::string, std::shared_ptr<Slot>>> stillLow;
+			for (auto& [address, slot] : low) {
+				seal::Ciphertext zero;
+				try {
+					// Only this thread uses a slot's encryptor
+					slot->encryptor.encrypt_zero_symmetric(zero);
+				}
+				catch (std::exception& e) {
+					std::cout << "Could not refill zero pool: " << e.what() << std::endl;
+					continue;
+				}
+				std::lock_guard<std::mutex> guard(lock);
+				if (stopping) {
+					return;
+				}
+				auto found = slots.find(address);
+				if (found == slots.end() || found->second != slot) {
+					continue;
+				}
+				slot->zeros.push_back(std::move(zero));
+				refilled++;
+				if (slot->zeros.size() < depth) {
+					stillLow.push_back(std::make_pair(address, slot));
+				}
+			}
+			low = std::move(stillLow);
+		}
+	}
+}
+
+void ZeroPool::printMetrics() {
+	size_t keys = 0;
+	size_t zeros = 0;
+	size_t shallowest = depth;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		keys = slots.size();
+		for (auto& [address, slot] : slots) {
+			zeros += slot->zeros.size();
+			shallowest = std::min(shallowest, slot->zeros.size());
+		}
+	}
+	std::cout << "Zero pool: " << keys << "/" << maxKeys << " keys, " << zeros << " zeros ready (shallowest " << (keys == 0 ? 0 : shallowest) << "/" << depth
+		<< "), " << hits << " used, " << misses << " encrypted directly (" << emptied << " on an empty pool), " << refilled << " refilled" << std::endl;
+}
+
+void ZeroPool::stop() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	if (refiller.joinable()) {
+		refiller.join();
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <seal/seal.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/* Keeps a few fresh encryptions of zero for each tracked key, refilled by a background thread. Encrypting an amount is then an
+encode and an add_plain onto a pooled zero, which is exactly what encrypt_symmetric does internally, so the randomness sampling and
+NTTs leave the request path. A zero is handed out once and never reused. Keys are tracked explicitly, up to maxKeys of them; tracking
+one more drops the least recently used.*/
+class ZeroPool {
+public:
+	/* depth is how many zeros are kept ready per key.*/
+	ZeroPool(const seal::SEALContext& context, size_t depth, size_t maxKeys);
+
+	~ZeroPool();
+
+	void track(const std::string& address, std::shared_ptr<const seal::SecretKey> key);
+
+	void untrack(const std::string& address);
+
+	bool tracked(const std::string& address);
+
+	/* Moves a pooled zero for the key into zero. Returns false if the key is not tracked or its pool is empty.*/
+	bool take(const std::string& address, seal::Ciphertext& zero);
+
+	/* Encrypts value at scale under the key at address, from a pooled zero when one is ready and with encryptor otherwise.*/
+	void encrypt(const std::string& address, double value, double scale, seal::CKKSEncoder& encoder, seal::Encryptor& encryptor, seal::Ciphertext& destination);
+
+	void printMetrics();
+
+	void stop();
+
+private:
+	struct Slot {
+		std::shared_ptr<const seal::SecretKey> key;
+		seal::Encryptor encryptor;
+		std::deque<seal::Ciphertext> zeros;
+		std::chrono::steady_clock::time_point used;
+
+		Slot(const seal::SEALContext& context, std::shared_ptr<const seal::SecretKey> key);
+	};
+
+	seal::SEALContext context;
+	size_t depth;
+	size_t maxKeys;
+	std::map<std::string, std::shared_ptr<Slot>> slots;
+	std::mutex lock;
+	std::condition_variable wake;
+	bool stopping;
+	std::thread refiller;
+
+	std::atomic<long long> hits;
+	std::atomic<long long> misses;
+	std::atomic<long long> refilled;
+	std::atomic<long long> emptied;
+
+	void refill();
+};
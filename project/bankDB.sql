@@ -1,5 +1,7 @@
 CREATE DATABASE bankDB;
 use bankDB;
+drop table interest_shards;
+drop table id_sequences;
 drop table direct_debits;
 drop table transactions;
 drop table accounts;
@@ -58,6 +60,7 @@ transactionType varchar(50) not null,
 amount VARCHAR(100) not null,
 transactionOwnerID integer not null,
 otherAccountID integer,
+index transactionsByOwnerTime (transactionOwnerID, transactionTime, transactionID),
 foreign key (transactionOwnerID) references accounts(id),
 foreign key (otherAccountID) references accounts(id)
 );
@@ -69,10 +72,28 @@ otherAccountID int not null,
 amount varchar(100) not null,
 regularity varchar(50) not null,
 timeSet BIGINT not null,
+index debitsByOwner (transactionOwnerID, debitID),
 foreign key (transactionOwnerID) references accounts(id),
 foreign key (otherAccountID) references accounts(id)
 );
 
+create table interest_shards(
+runID BIGINT not null,
+shardID int not null,
+firstAccountID int not null,
+lastAccountID int not null,
+checkpointAccountID int not null,
+status varchar(20) not null,
+owner varchar(100),
+leaseExpires BIGINT not null,
+primary key (runID, shardID)
+);
+
+create table id_sequences(
+name varchar(50) primary key,
+nextValue BIGINT not null
+);
+
 use bankDB;
 select * from accounts;
 select * from transactions;